@@ -0,0 +1,46 @@
+# Annotate a disassembly listing with ROM execution counts
+#
+# The counts come from "cmodel -c" / "cmodel_cic -c" (one "pu:pl count" line
+# per executed address). Each listing line gets its count in a left column;
+# routine entries (reset/interrupt vectors and TRS/CALL/TL targets) without a
+# count are listed at the end. The C models count routine entries only, so
+# small helpers they inline show up there too.
+
+import argparse
+import re
+
+parser = argparse.ArgumentParser("annotate")
+parser.add_argument("coverage", \
+                    help="coverage file written by cmodel -c")
+parser.add_argument("listing", nargs="?", default="disasm.txt", \
+                    help="disassembly listing (default: disasm.txt)")
+args = parser.parse_args()
+
+counts = {}
+with open(args.coverage) as f:
+    for line in f:
+        address, count = line.split()
+        counts[address] = counts.get(address, 0) + int(count)
+
+entries = {"00:00", "02:00", "02:02", "02:04"}
+lines = []
+with open(args.listing) as f:
+    for line in f:
+        line = line.rstrip("\n")
+        match = re.match(r"\$([0-9a-f]{2}:[0-9a-f]{2}):", line)
+        address = match.group(1) if match else None
+        target = re.search(r"(TRS|CALL|TL) \$([0-9a-f]{2}:[0-9a-f]{2})", line)
+        if target:
+            entries.add(target.group(2))
+        lines.append((address, line))
+
+for address, line in lines:
+    count = counts.get(address)
+    print(f"{count if count is not None else '':>10}  {line}")
+
+listed = {address for address, line in lines}
+missed = sorted(entry for entry in entries if entry in listed and entry not in counts)
+print()
+print(f"# {len(counts)} addresses executed, {len(missed)} routine entries without a count:")
+for entry in missed:
+    print(f"#   ${entry}")
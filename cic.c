@@ -0,0 +1,72 @@
+#include "cic.h"
+
+#include "cmodel.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+
+// Library harness for cmodel_cic.c (built with -DCMODEL_LIB). The CIC never
+// returns on its own, so cic_run() is left with a longjmp, either from a
+// callback through cic_stop() or from fatalError().
+
+void start(void);
+bool initCIC(int cic);
+
+MODEL_TLS const cic_devices* devices;
+MODEL_TLS jmp_buf exitRun;
+MODEL_TLS FILE* trace;
+
+u8 readIO(u8 port) {
+  cycles += IO_CYCLES;
+  u8 value = devices->readPort ? devices->readPort(devices->user, port) & 0xf : 0;
+  if (trace)
+    fprintf(trace, "%x\n", value);
+  return value;
+}
+
+void writeIO(u8 port, u8 value) {
+  cycles += IO_CYCLES;
+  if (trace)
+    fprintf(trace, "=w %x %x\n", port, value);
+  if (devices->writePort)
+    devices->writePort(devices->user, port, value);
+}
+
+void fatalError(void) {
+  longjmp(exitRun, 1);
+}
+
+bool cic_run(int type, const cic_devices* dev) {
+  if (!initCIC(type))
+    return false;
+
+  memset(&r, 0, sizeof(r));
+  memset(ram, 0, sizeof(ram));
+  cycles = 0;
+  devices = dev;
+  if (trace)
+    fprintf(trace, "# CIC type\n%d\n", type);
+
+  int how = setjmp(exitRun);
+  if (how) {
+    if (trace && how == 2)
+      fprintf(trace, "q\n");
+    return how == 2;
+  }
+
+  start();
+  return false;
+}
+
+void cic_stop(void) {
+  longjmp(exitRun, 2);
+}
+
+void cic_trace(FILE* f) {
+  trace = f;
+}
+
+uint64_t cic_cycles(void) {
+  return cycles;
+}
@@ -0,0 +1,31 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Embeddable CIC: the C model from cmodel_cic.c run on the calling thread,
+// with its port traffic going to callbacks. Port 2 is the PIF interface:
+// reads return bit 0 = data line, bit 1 = clock line, writes drive bit 0 of
+// the (open-drain) data line.
+//
+// Link with libcic.a, which exports nothing but the cic_* symbols.
+
+typedef struct {
+  void* user;
+  uint8_t (*readPort)(void* user, uint8_t port);
+  void (*writePort)(void* user, uint8_t port, uint8_t value);
+} cic_devices;
+
+// Run a CIC of the given part number (6101, 6102, 7101, ...). Returns false
+// for an unknown part or once the CIC detects an error, and true when a
+// callback ends the run with cic_stop().
+bool cic_run(int type, const cic_devices* devices);
+void cic_stop(void);
+
+// Record the next cic_run() on this thread as a cmodel_cic trace streamed to
+// f: the part number, then the value of every port read and an =w check for
+// every port write. The read a callback cuts short with cic_stop() becomes
+// the closing "q". Pass NULL to stop recording; f is left open.
+void cic_trace(FILE* f);
+
+// Modeled SM5 cycles of the CIC running on this thread.
+uint64_t cic_cycles(void);
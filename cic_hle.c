@@ -0,0 +1,207 @@
+#include "cmodel.h"
+#include "cmodel_cic.h"
+#include "cmodel_compare.h"
+#include "cmodel_pif.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+extern MODEL_TLS bool regionPAL;
+
+// High-level CIC, see cmodel_pif.h. The phase is where the CIC ROM waits
+// for the PIF next; what it sends is queued first, and what it reads is
+// collected in the same queue.
+enum {
+  CIC_HLE_SEND,       // sending the queue, then on to the next phase
+  CIC_HLE_PULSE,      // checksum ready, waiting for the clock pulse
+  CIC_HLE_SEED,       // reading the compare seed
+  CIC_HLE_COMMAND,    // in cicLoop()
+  CIC_HLE_CHALLENGE,  // reading the challenge
+  CIC_HLE_ANSWER,     // challenge answered, sending the 0 bit first
+  CIC_HLE_HALTED,
+
+  // the CIC's countdown before it answers a reset (CIC 03:1F)
+  CIC_HLE_RESET_DELAY = 0x10000 * 3,
+};
+
+struct cicHLE {
+  const cicPart* part;
+  u8 phase;
+  u8 next;  // after CIC_HLE_SEND
+  r4 queue[CIC_CHALLENGE_NIBBLES];
+  u8 head;
+  u8 count;
+  compareState compare;
+};
+
+// CIC 02:2B: chain each nibble into the next
+void cicHleEncode(r4* n, u8 count) {
+  for (u8 i = 1; i < count; ++i)
+    n[i].l += n[i - 1].l + 1;
+}
+
+void cicHleSend(cicHLE* c, const r4* n, u8 count, u8 next) {
+  memmove(c->queue, n, count * sizeof(r4));
+  c->head = 0;
+  c->count = count;
+  c->phase = CIC_HLE_SEND;
+  c->next = next;
+}
+
+// what the CIC answers from its secret nibbles, starting with nibble first
+void cicHleSecret(const cicHLE* c, r4* n, u8 first, u8 count) {
+  for (u8 i = 0; i < count; ++i) {
+    u8 byte = c->part->secret[(first + i) / 2];
+    n[i].l = (first + i) & 1 ? byte : byte >> 4;
+  }
+}
+
+cicHLE* cicHleCreate(int type) {
+  const cicPart* part = findCicPart(type);
+  if (!part)
+    return NULL;
+  cicHLE* c = calloc(1, sizeof(cicHLE));
+  if (!c)
+    return NULL;
+  c->part = part;
+
+  // start() in cmodel_cic.c: the status bits (the first one pulled low, no
+  // 64DD), then the encoded seed
+  r4 n[7] = {{part->pal << 2 | 1}, {0xb}, {5}};
+  cicHleSecret(c, n + 3, 0, 4);
+  cicHleEncode(n + 1, 6);
+  cicHleEncode(n + 1, 6);
+  cicHleSend(c, n, 7, CIC_HLE_PULSE);
+  return c;
+}
+
+void cicHleDestroy(cicHLE* c) {
+  free(c);
+}
+
+u64 cicHleHash(const cicHLE* c) {
+  // calloc'd, so the padding hashes alike too
+  u64 h = 0xcbf29ce484222325;
+  for (size_t i = 0; i < sizeof(*c); ++i)
+    h = (h ^ ((const u8*)c)[i]) * 0x100000001b3;
+  return h;
+}
+
+u8 cicHleReadNibble(void) {
+  cicHLE* c = hleCIC;
+  cycles += 4 * CIC_READ_BIT_CYCLES;
+  if (c->phase != CIC_HLE_SEND) {
+    c->phase = CIC_HLE_HALTED;
+    return 0xf;
+  }
+
+  u8 value = c->queue[c->head++].l;
+  if (c->head == c->count) {
+    c->phase = c->next;
+    c->count = 0;
+  }
+  return value;
+}
+
+void cicHleWriteNibble(u8 value) {
+  cicHLE* c = hleCIC;
+  cycles += 4 * CIC_WRITE_BIT_CYCLES;
+  if (c->phase != CIC_HLE_SEED && c->phase != CIC_HLE_CHALLENGE) {
+    c->phase = CIC_HLE_HALTED;
+    return;
+  }
+
+  c->queue[c->count++].l = value;
+  if (c->phase == CIC_HLE_SEED && c->count == 2) {
+    // start2() in cmodel_cic.c
+    compareSeed(&c->compare, c->queue[0].l << 4 | c->queue[1].l, c->part->pal);
+    c->phase = CIC_HLE_COMMAND;
+  } else if (c->phase == CIC_HLE_CHALLENGE && c->count == CIC_CHALLENGE_NIBBLES) {
+    // cicChallengeExec() in cmodel_cic.c
+    if (c->part->challenge) {
+      challenge6105(c->queue, 5, c->count);
+    } else {
+      for (u8 i = 0; i < c->count; ++i)
+        c->queue[i].l ^= 0xf;
+    }
+    c->phase = CIC_HLE_ANSWER;
+  }
+}
+
+// the clock pulse in cicCompareInit(), which starts the checksum
+void cicHlePulse(void) {
+  cicHLE* c = hleCIC;
+  cycles += 2 * IO_CYCLES;
+  if (c->phase != CIC_HLE_PULSE) {
+    c->phase = CIC_HLE_HALTED;
+    return;
+  }
+
+  // the checksum behind a zero key
+  r4 n[16] = {{0}};
+  cicHleSecret(c, n + 4, 4, 12);
+  for (int i = 0; i < 4; ++i)
+    cicHleEncode(n, 16);
+  cicHleSend(c, n, 16, CIC_HLE_SEED);
+}
+
+// the 0 the CIC sends before the challenge answer
+bool cicHleReadBit(void) {
+  cicHLE* c = hleCIC;
+  cycles += CIC_READ_BIT_CYCLES;
+  if (c->phase != CIC_HLE_ANSWER) {
+    c->phase = CIC_HLE_HALTED;
+    return 1;
+  }
+
+  cicHleSend(c, c->queue, CIC_CHALLENGE_NIBBLES, CIC_HLE_COMMAND);
+  return 0;
+}
+
+// The compare command and exchange, the PIF's running from nibble first:
+// bit n of sent is the PIF's bit for nibble n, bit n of the result the CIC's.
+u16 cicHleCompare(u8 first, u16 sent) {
+  cicHLE* c = hleCIC;
+  cycles += 2 * CIC_WRITE_BIT_CYCLES;
+  for (u8 b = first; b & 0xf; b += COMPARE_STEP(regionPAL))
+    cycles += CIC_WRITE_BIT_CYCLES + CIC_READ_BIT_CYCLES;
+  if (c->phase != CIC_HLE_COMMAND) {
+    c->phase = CIC_HLE_HALTED;
+    return 0xffff;
+  }
+
+  compareRounds(&c->compare);
+  u16 answer = 0;
+  for (u8 b = compareOffset(&c->compare); b & 0xf; b += COMPARE_STEP(c->part->pal)) {
+    bool expected = c->compare.lo[b & 0xf].l & 1;
+    if (c->phase == CIC_HLE_HALTED || (c->compare.hi[b & 0xf].l & 1))
+      answer |= BIT(b & 0xf);
+    if (!!(sent & BIT(b & 0xf)) != expected)
+      c->phase = CIC_HLE_HALTED;
+  }
+  return answer;
+}
+
+void cicHleChallenge(void) {
+  cicHLE* c = hleCIC;
+  cycles += 2 * CIC_WRITE_BIT_CYCLES;
+  if (c->phase != CIC_HLE_COMMAND) {
+    c->phase = CIC_HLE_HALTED;
+    return;
+  }
+
+  // the challenge timer, then the challenge itself
+  r4 n[2] = {{0xa}, {0xa}};
+  cicHleSend(c, n, 2, CIC_HLE_CHALLENGE);
+}
+
+// the reset command: true if the CIC answers the PIF
+bool cicHleReset(void) {
+  cicHLE* c = hleCIC;
+  cycles += 2 * CIC_WRITE_BIT_CYCLES + 2 * IO_CYCLES + CIC_HLE_RESET_DELAY;
+  if (c->phase != CIC_HLE_COMMAND) {
+    c->phase = CIC_HLE_HALTED;
+    return false;
+  }
+  return true;
+}
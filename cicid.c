@@ -0,0 +1,242 @@
+#include "cmodel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Identify the CIC type from the handshake the PIF reads in start() and
+// cicCompareInit(), without running the CIC model once per type.
+//
+// Each capture is one line of 23 hex nibbles, whitespace ignored: the status
+// nibble, the 6 encoded seed nibbles and the 16 encoded checksum nibbles, as
+// read by cicReadNibble(). Comments start with #.
+//
+// The seed and checksum are fixed per CIC secret, but the checksum goes out
+// behind 4 nibbles of a timing-based key (prefixChecksum() in cmodel_cic.c)
+// and the encoding chains every nibble into the next, so the encoded checksum
+// changes with the key. The descrambled one doesn't: after doing what the PIF
+// does (cicDescramble() twice for the seed, four times for the checksum) the
+// key is the first 4 nibbles and is dropped. Region, seed and checksum then
+// index a small hash table built from initCIC() for every part number.
+//
+// -b N classifies N generated captures with random keys and reports the rate.
+
+enum {
+  STATUS_NIBBLES = 1,
+  SEED_NIBBLES = 6,
+  CHECKSUM_NIBBLES = 16,
+  CAPTURE_NIBBLES = STATUS_NIBBLES + SEED_NIBBLES + CHECKSUM_NIBBLES,
+
+  INDEX_BITS = 5,
+  INDEX_SIZE = 1 << INDEX_BITS,
+};
+
+extern MODEL_TLS bool regionPAL;
+extern MODEL_TLS const u8* romSecret;
+bool initCIC(int cic);
+
+const int cicTypes[] = {
+    6101, 6102, 6103, 6105, 6106, 7101, 7102, 7103, 7105, 7106,
+};
+
+// seed (romSecret[0..1]) above checksum (romSecret[2..7]), plus the region
+typedef struct {
+  u64 secret;
+  bool pal;
+  int type;  // 0 for an empty slot
+} indexEntry;
+
+indexEntry cicIndex[INDEX_SIZE];
+
+// the model is never run
+u8 readIO(u8 port) {
+  (void)port;
+  return 0;
+}
+
+void writeIO(u8 port, u8 value) {
+  (void)port;
+  (void)value;
+}
+
+void fatalError(void) {
+  exit(1);
+}
+
+unsigned slot(u64 secret, bool pal) {
+  return ((secret ^ pal) * 0x9e3779b97f4a7c15ull) >> (64 - INDEX_BITS);
+}
+
+void buildIndex(void) {
+  for (unsigned i = 0; i < sizeof(cicTypes) / sizeof(cicTypes[0]); ++i) {
+    initCIC(cicTypes[i]);
+    u64 secret = 0;
+    for (int j = 0; j < 8; ++j)
+      secret = secret << 8 | romSecret[j];
+
+    unsigned s = slot(secret, regionPAL);
+    while (cicIndex[s].type)
+      s = (s + 1) % INDEX_SIZE;
+    cicIndex[s] = (indexEntry){secret, regionPAL, cicTypes[i]};
+  }
+}
+
+// cicDescramble()
+void descramble(u8* n, int count) {
+  u8 a = 0xf;
+  for (int i = 0; i < count; ++i) {
+    u8 b = n[i];
+    n[i] = (n[i] - a - 1) & 0xf;
+    a = b;
+  }
+}
+
+// cicEncode() on the CIC side, for -b
+void encode(u8* n, int count) {
+  for (int i = 0; i + 1 < count; ++i)
+    n[i + 1] = (n[i + 1] + n[i] + 1) & 0xf;
+}
+
+// Returns the part number, or 0 if the capture matches none.
+int identify(const u8* capture) {
+  u8 status = capture[0];
+  if ((status & 3) != 1)
+    return 0;
+
+  u8 seed[SEED_NIBBLES];
+  u8 checksum[CHECKSUM_NIBBLES];
+  memcpy(seed, capture + STATUS_NIBBLES, SEED_NIBBLES);
+  memcpy(checksum, capture + STATUS_NIBBLES + SEED_NIBBLES, CHECKSUM_NIBBLES);
+  descramble(seed, SEED_NIBBLES);
+  descramble(seed, SEED_NIBBLES);
+  for (int i = 0; i < 4; ++i)
+    descramble(checksum, CHECKSUM_NIBBLES);
+
+  u64 secret = 0;
+  for (int i = 2; i < SEED_NIBBLES; ++i)
+    secret = secret << 4 | seed[i];
+  for (int i = 4; i < CHECKSUM_NIBBLES; ++i)
+    secret = secret << 4 | checksum[i];
+
+  bool pal = status & BIT(2);
+  for (unsigned s = slot(secret, pal); cicIndex[s].type; s = (s + 1) % INDEX_SIZE) {
+    if (cicIndex[s].secret == secret && cicIndex[s].pal == pal)
+      return cicIndex[s].type;
+  }
+  return 0;
+}
+
+// What the CIC sends in start(), with the given key.
+void generate(u8* capture, int type, const u8* key) {
+  initCIC(type);
+  u8 secret[16];
+  for (int i = 0; i < 16; ++i)
+    secret[i] = romSecret[i / 2] >> (i & 1 ? 0 : 4) & 0xf;
+
+  capture[0] = BIT(0) | (regionPAL ? BIT(2) : 0);
+
+  u8* seed = capture + STATUS_NIBBLES;
+  seed[0] = 0xb;
+  seed[1] = 5;
+  memcpy(seed + 2, secret, 4);
+  encode(seed, SEED_NIBBLES);
+  encode(seed, SEED_NIBBLES);
+
+  u8* checksum = capture + STATUS_NIBBLES + SEED_NIBBLES;
+  memcpy(checksum, key, 4);
+  memcpy(checksum + 4, secret + 4, 12);
+  for (int i = 0; i < 4; ++i)
+    encode(checksum, CHECKSUM_NIBBLES);
+}
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int benchmark(long count) {
+  const int types = sizeof(cicTypes) / sizeof(cicTypes[0]);
+  u8(*captures)[CAPTURE_NIBBLES] = malloc(count * CAPTURE_NIBBLES);
+  int* expected = malloc(count * sizeof(int));
+  srand(1);
+  for (long i = 0; i < count; ++i) {
+    u8 key[4];
+    for (int j = 0; j < 4; ++j)
+      key[j] = rand() & 0xf;
+    expected[i] = cicTypes[rand() % types];
+    generate(captures[i], expected[i], key);
+  }
+
+  long wrong = 0;
+  double start = now();
+  for (long i = 0; i < count; ++i)
+    wrong += identify(captures[i]) != expected[i];
+  double seconds = now() - start;
+
+  printf("%ld captures, %ld misidentified, %.1f ns each\n", count, wrong, seconds * 1e9 / count);
+  free(captures);
+  free(expected);
+  return wrong != 0;
+}
+
+int main(int argc, char* argv[]) {
+  long benchCount = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "b:")) != -1) {
+    switch (opt) {
+      case 'b':
+        benchCount = atol(optarg);
+        break;
+      default:
+        printf("usage: %s [-b count] [captures]\n", argv[0]);
+        exit(4);
+    }
+  }
+
+  buildIndex();
+  if (benchCount > 0)
+    return benchmark(benchCount);
+
+  FILE* input = optind < argc ? fopen(argv[optind], "r") : stdin;
+  if (!input) {
+    printf("cannot open %s\n", argv[optind]);
+    exit(4);
+  }
+
+  bool failed = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), input)) {
+    u8 capture[CAPTURE_NIBBLES];
+    int count = 0;
+    for (char* p = line; *p && *p != '#'; ++p) {
+      if (*p == ' ' || *p == '\t' || *p == '\n')
+        continue;
+      unsigned value;
+      if (count == CAPTURE_NIBBLES || 1 != sscanf((char[]){*p, 0}, "%x", &value)) {
+        count = -1;
+        break;
+      }
+      capture[count++] = value;
+    }
+    if (!count)
+      continue;
+    if (count != CAPTURE_NIBBLES) {
+      printf("bad capture\n");
+      failed = 1;
+      continue;
+    }
+
+    int type = identify(capture);
+    if (type) {
+      printf("%d%s\n", type, capture[0] & BIT(3) ? " 64dd" : "");
+    } else {
+      printf("unknown\n");
+      failed = 1;
+    }
+  }
+  return failed;
+}
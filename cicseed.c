@@ -0,0 +1,192 @@
+#include "cmodel.h"
+#include "cmodel_compare.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Recover the PIF's compare seed from a captured CIC compare bitstream.
+//
+// cicCompareCreateSeed() leaves an 8-bit hardware RNG value in
+// CIC_COMPARE_LO+8/+9, which becomes CIC_COMPARE_LO+1/CIC_COMPARE_HI+1; the
+// rest of the compare state comes from the ROM table. From then on every
+// cicCompare() is deterministic, so trying all 256 values (and, for captures
+// taken mid-session, the number of compares already done) finds the state.
+//
+// The capture is read from a file or stdin as whitespace-separated tokens of
+// digits, one bit per digit, non-zero meaning 1: "0 8 0 8" (port 5 reads as in
+// traces) and "0101" are the same. Other tokens ("pass"), comments and =
+// expectations are skipped.
+//
+// By default the bits are the CIC's answers, one per compare step, which is
+// what traces record. They only depend on CIC_COMPARE_HI, so they give the low
+// nibble of the seed. With -w they are every bit on the data line (the two
+// start bits of each compare, then PIF and CIC bit for each step), which gives
+// the whole seed.
+//
+// For each match the compare state at the end of the capture is printed as
+// =ram lines for CIC_COMPARE_LO+1 (with -w) and CIC_COMPARE_HI+1.
+//
+//   sed -n '/Compare mode/,/Reset/p' input.txt | ./cicseed -t 6102
+
+enum {
+  MAX_BITS = 1 << 16,
+};
+
+typedef struct {
+  bool found;
+  int skipped;  // compares before the capture started
+  compareState end;
+} result;
+
+bool regionPAL;
+bool lineBits;
+int maxSkip;
+int threads;
+int seeds;  // 256, or 16 when only the low nibble is visible
+u8 bits[MAX_BITS];
+int bitCount;
+result results[256];
+
+// Run cicCompare() on s for as long as the capture lasts, stopping at the
+// first bit that differs.
+bool matches(compareState* s) {
+  int i = 0;
+  while (i < bitCount) {
+    if (lineBits) {
+      if (bits[i++] || (i < bitCount && bits[i++]))
+        return false;
+    }
+    compareRounds(s);
+    for (u8 offset = compareOffset(s); offset & 0xf && i < bitCount;
+         offset += COMPARE_STEP(regionPAL)) {
+      if (lineBits && bits[i++] != (s->lo[offset & 0xf].l & 1))
+        return false;
+      if (i < bitCount && bits[i++] != (s->hi[offset & 0xf].l & 1))
+        return false;
+    }
+  }
+  return true;
+}
+
+// Seeds are dealt out round-robin to the threads.
+void* search(void* arg) {
+  for (int seed = (int)(intptr_t)arg; seed < seeds; seed += threads) {
+    compareState s;
+    compareSeed(&s, seed, regionPAL);
+    for (int skipped = 0; skipped <= maxSkip; ++skipped) {
+      compareState t = s;
+      if (matches(&t)) {
+        results[seed] = (result){1, skipped, t};
+        break;
+      }
+      compareRounds(&s);
+    }
+  }
+  return NULL;
+}
+
+void readBits(FILE* input) {
+  char token[64];
+  while (1 == fscanf(input, "%63s", token)) {
+    // comments and =ram/=w expectations run to the end of the line
+    if (token[0] == '#' || token[0] == '=') {
+      fscanf(input, "%*[^\n]");
+      continue;
+    }
+    if (strspn(token, "0123456789") != strlen(token))
+      continue;
+    for (char* p = token; *p; ++p) {
+      if (bitCount == MAX_BITS) {
+        printf("capture too long\n");
+        exit(4);
+      }
+      bits[bitCount++] = *p != '0';
+    }
+  }
+}
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void printNibbles(u8 address, const r4* n) {
+  printf("=ram %02x ", address);
+  for (int i = 1; i < 16; ++i)
+    printf("%x", n[i].l);
+  printf("\n");
+}
+
+int main(int argc, char* argv[]) {
+  int type = 6102;
+  threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:n:j:w")) != -1) {
+    switch (opt) {
+      case 't':
+        type = atoi(optarg);
+        break;
+      case 'n':
+        maxSkip = atoi(optarg);
+        break;
+      case 'j':
+        threads = atoi(optarg);
+        break;
+      case 'w':
+        lineBits = 1;
+        break;
+      default:
+        printf("usage: %s [-t cic] [-n max-skipped-compares] [-j threads] [-w] [capture]\n",
+               argv[0]);
+        exit(4);
+    }
+  }
+  // only the region matters to the PIF side of the compare
+  if (type / 1000 != 6 && type / 1000 != 7) {
+    printf("bad arguments\n");
+    exit(4);
+  }
+  regionPAL = type / 1000 == 7;
+  if (threads < 1)
+    threads = 1;
+  if (threads > 256)
+    threads = 256;
+
+  FILE* input = optind < argc ? fopen(argv[optind], "r") : stdin;
+  if (!input) {
+    printf("cannot open %s\n", argv[optind]);
+    exit(4);
+  }
+  readBits(input);
+  seeds = lineBits ? 256 : 16;
+
+  double start = now();
+  pthread_t workers[threads];
+  for (int i = 0; i < threads; ++i)
+    pthread_create(&workers[i], NULL, search, (void*)(intptr_t)i);
+  for (int i = 0; i < threads; ++i)
+    pthread_join(workers[i], NULL);
+  double seconds = now() - start;
+
+  int found = 0;
+  for (int seed = 0; seed < seeds; ++seed) {
+    if (!results[seed].found)
+      continue;
+    ++found;
+    if (lineBits) {
+      printf("seed %02x after %d compares\n", seed, results[seed].skipped);
+      printNibbles(0x61, results[seed].end.lo);
+    } else {
+      printf("seed ?%x after %d compares\n", seed, results[seed].skipped);
+    }
+    printNibbles(0x71, results[seed].end.hi);
+  }
+  fprintf(stderr, "%d bits, %d seeds match, %.2f ms\n", bitCount, found, seconds * 1e3);
+  return found ? 0 : 1;
+}
@@ -1,9 +1,20 @@
 #include "cmodel.h"
+#ifndef CMODEL_ROM
+#include "cmodel_compare.h"
+#endif
+#include "cmodel_pif.h"
+#include "journal.h"
+#include "perf.h"
+#include "ring.h"
+#include "vcd.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 // C model reference implementation of SM5 PIF ROM
 // Goals:
@@ -14,133 +25,55 @@
 // - model every register and memory state transition
 // - model timing
 
-enum {
-  PORT_JOYBUS_WRITE = 0,
-  PORT_JOYBUS_READ = 1,
-  PORT_JOYBUS_CTRL = 2,
-  PORT_JOYBUS_STATUS = 3,
-  PORT_JOYBUS_ERROR = 4,
-  PORT_CIC = 5,
-  PORT_ROM = 6,
-  PORT_RCP_XFER = 7,
-  PORT_RESET = 8,
-  PORT_RNG = 9,    // Used as a RNG, maybe it's an ADC?
-  PORT_JOYBUS_CHANNEL = 0xa,
-  REG_INT_EN = 0xe,
-
-  JOYBUS_STATUS_CLOCK = BIT(3),
-
-  JOYBUS_CTRL_WRITESTOPBIT = BIT(1),
+MODEL_TLS rfile r;
+MODEL_TLS r4 ram[256];
+MODEL_TLS u32 romHits[0x1000];
+MODEL_TLS watchState watch;
+MODEL_TLS u64 cycles;
 
-  JOYBUS_ERROR_RESET = 0,
-  JOYBUS_ERROR_NOANSWER = BIT(3),
+MODEL_TLS bool reset = 0;
+MODEL_TLS bool regionPAL = 0;  // compile time constant in real PIF ROMs
 
-  INT_A_EN = BIT(0),
-  INT_B_EN = BIT(2),
+// set by harnesses that want latencies timed, see cmodel_pif.h
+MODEL_TLS latencyStats* latency;
 
-  ROM_LOCKOUT = BIT(0),
+// RCP writes to external PIF-RAM, see cmodel_pif.h
+MODEL_TLS externalWrites external;
 
-  CIC_DATA_W = BIT(0),
-  CIC_CLOCK = BIT(1),
-  CIC_DATA_R = BIT(3),
+// set by harnesses that replace the CIC, see cmodel_pif.h
+MODEL_TLS cicHLE* hleCIC;
 
-  RCP_XFER_READ = BIT(3),
-  RCP_XFER_64B = BIT(2),
+// set by harnesses that take whole messages, see cmodel_pif.h
+MODEL_TLS const ioTransactions* transactions;
 
-  RESET_CPU_IRQ = BIT(1),
-  RESET_CPU_NMI = BIT(0),
-  RESET_BUTTON = BIT(3),
-
-  RNG_START = BIT(0),
-  RNG_DATA = BIT(3),
-};
+// firmware phase, and the harness hook told when it changes, see cmodel_pif.h
+MODEL_TLS u8 phase;
+MODEL_TLS void (*phaseChange)(u8 from, u8 to);
 
-enum {
-  JOYBUS_ADDR_L = 0x00,     // pointer to the start of the frame in external RAM for each joybus channel (low nibble)
-  JOYBUS_ADDR_U = 0x10,     // pointer to the start of the frame in external RAM for each joybus channel (high nibble)
-  CIC_CHALLENGE_TIMER_U = 0x0a,
-  CIC_CHALLENGE_TIMER_L = 0x0b,
-  RESET_TIMER = 0x0c,
-  RESET_TIMER_END = 0x10,
-  CIC_SEED_BUF = 0x1a,
-  CIC_SEED = 0x1c,
-  CIC_SEED_END = 0x20,
-  OSINFO = 0x1b,
-  OSINFO_RESET = 1,
-  OSINFO_VERSION = 2,
-  OSINFO_64DD = 3,
-  CIC_CHECKSUM_BUF = 0x20,
-  CIC_CHECKSUM = 0x24,
-  CIC_CHECKSUM_END = 0x30,
-  JOYBUS_SEND_COUNT_U = 0x22,
-  JOYBUS_SEND_COUNT_L = 0x23,
-  JOYBUS_SENDERR_NO_DEVICE = 8,
-  JOYBUS_SENDERR_TIMEOUT = 4,
-  PIF_CHECKSUM = 0x34,
-  PIF_CHECKSUM_END = 0x40,
-  JOYBUS_RECV_COUNT_U = 0x32,
-  JOYBUS_RECV_COUNT_L = 0x33,
-  JOYBUS_STATUS = 0x40,
-  JOYBUS_STATUS_RESET = 0,
-  JOYBUS_STATUS_SKIP = 3,
-  JOYBUS_STATUS_END = 0x46,
-  SAVE_SBL = 0x47,
-  BOOT_TIMER = 0x4a,
-  BOOT_TIMER_END = 0x50,
-  SAVE_A = 0x56,
-  SAVE_SBM = 0x57,
-  SAVE_X = 0x58,
-  SAVE_C = 0x59,
-  STATUS = 0x5e,
-  STATUS_CHALLENGE = 1,
-  STATUS_RUNNING = 3,
-  CIC_COMPARE_LO = 0x60,
-  CIC_COMPARE_LO_END = 0x70,
-  CIC_COMPARE_HI = 0x70,
-  CIC_COMPARE_HI_END = 0x80,
-  RAM_EXTERNAL = 0x80,
-  CIC_CHALLENGE_COUNT_OUT = 0xdd,
-  CIC_CHALLENGE_COUNT_IN = 0xdf,
-  CIC_CHALLENGE_LO = 0xe0,
-  CIC_CHALLENGE_HI = 0xf0,
-  PIF_CMD_U = 0xfe,
-  PIF_CMD_U_LOCKOUT = 0,
-  PIF_CMD_U_GET_CHECKSUM = 1,
-  PIF_CMD_U_CHECK_CHECKSUM = 2,
-  PIF_CMD_U_ACK = 3,
-  PIF_CMD_L = 0xff,
-  PIF_CMD_L_JOYBUS = 0,
-  PIF_CMD_L_CHALLENGE = 1,
-  PIF_CMD_L_2 = 2,
-  PIF_CMD_L_TERMINATE = 3,
-};
+void start(void);
+void interruptA(void);
+void interruptB(void);
+u8 phaseEnter(u8 to);
 
-bool reset = 0;
-bool regionPAL = 0;  // compile time constant in real PIF ROMs
+// With -DCMODEL_ROM the routines below come from the recompiled ROM image
+// instead (see recompiler.py), and only the state and harness are built here.
+#ifndef CMODEL_ROM
 
-// The only non-code data in the ROM, taken from 04:00.
-const u8 romNTSC[] = {
-    0x19, 0x4a, 0xf1, 0x88, 0xb5, 0x5a, 0x71,
-    0xc3, 0xde, 0x61, 0x10, 0xed, 0x9e, 0x8c,
-};
-const u8 romPAL[] = {
-    0x14, 0x2f, 0x35, 0xf1, 0x82, 0x21, 0x77,
-    0x11, 0x99, 0x88, 0x15, 0x17, 0x55, 0xca,
-};
+// cicCompare() for the region, picked in start(); real ROMs are assembled
+// per region, so the compare loop doesn't test regionPAL
+MODEL_TLS void (*cicCompare)(void);
 
-void start(void);
 void bootTimerInit(u8 address);
 void memZero(u8 address);
 void joybusStatusInit(void);
 void cicWriteBit(bool value);
 bool cicReadBit(void);
-void interruptA(void);
-void interruptB(void);
 void regRestore(void);
 void interruptEpilog(void);
 void executeRCPTransfer(void);
 void cicLoop(void);
-void cicCompare(void);
+void cicCompareNTSC(void);
+void cicComparePAL(void);
 void signalError(void);
 void memSwapRanges(void);
 void memSwap(u8 address);
@@ -174,10 +107,22 @@ void cicCompareRound(u8 address);
 void cicCompareExpandSeed(void);
 void cicCompareCreateSeed(void);
 void regSave(void);
+void latencyBegin(u8 kind);
+void latencyEnd(u8 kind);
+void latencyKind(u8 kind);
+void latencyEndRCP(void);
+void joybusParse(void);
+void joybusTransferMessage(u8 sb);
 
 // 00:00
 void start(void) {
-  writeIO(PORT_CIC, CIC_DATA_W);
+  COVER(0x00, 0x00);
+  phaseEnter(PHASE_START);
+  cicCompare = regionPAL ? cicComparePAL : cicCompareNTSC;
+  if (hleCIC)
+    cycles += IO_CYCLES;  // the write the high-level CIC stands in for
+  else
+    writeIO(PORT_CIC, CIC_DATA_W);
   writeIO(REG_INT_EN, INT_A_EN);
 
   regInitSB();
@@ -185,11 +130,11 @@ void start(void) {
   memZero(PIF_CHECKSUM);
 
   cicReadNibble(STATUS);
-  if ((RAM(STATUS) & 3) == 1 && RAM_BIT_TEST(STATUS, 2) == regionPAL) {
+  if ((RAM(STATUS) & 3) == 1 && !!RAM_BIT_TEST(STATUS, 2) == regionPAL) {
     if (RAM_BIT_TEST(STATUS, 3)) {
-      RAM(STATUS) = BIT(OSINFO_VERSION) | BIT(OSINFO_64DD);
+      RAM_SET(STATUS, BIT(OSINFO_VERSION) | BIT(OSINFO_64DD));
     } else {
-      RAM(STATUS) = BIT(OSINFO_VERSION);
+      RAM_SET(STATUS, BIT(OSINFO_VERSION));
     }
   } else {
     signalError();
@@ -207,7 +152,7 @@ void start(void) {
   u8 a = RAM(STATUS);
   RAM_BIT_RESET(STATUS, STATUS_CHALLENGE);
   RAM_BIT_RESET(STATUS, STATUS_RUNNING);
-  RAM(OSINFO) = a;
+  RAM_SET(OSINFO, a);
 
   reset = 0;
 
@@ -220,28 +165,37 @@ void start(void) {
 
 // 01:12
 void bootTimerInit(u8 address) {
-  RAM(address + 0) = 0xf;
-  RAM(address + 1) = 0xb;
+  COVER(0x01, 0x12);
+  RAM_SET(address + 0, 0xf);
+  RAM_SET(address + 1, 0xb);
   memZero(address + 2);
 }
 
 // 01:16
 // zero memory from address to end of segment
 void memZero(u8 address) {
+  COVER(0x01, 0x16);
   do {
-    RAM(address) = 0;
+    RAM_SET(address, 0);
   } while (++address & 0xf);
 }
 
 // 01:1A
 // fill [0x40..0x45] with 8
 void joybusStatusInit(void) {
+  COVER(0x01, 0x1a);
   for (u8 address = JOYBUS_STATUS_END - 1; address >= JOYBUS_STATUS; --address)
-    RAM(address) = BIT(JOYBUS_STATUS_SKIP);
+    RAM_SET(address, BIT(JOYBUS_STATUS_SKIP));
 }
 
 // 01:20
+enum {
+  // one byte of a joybus transfer: two status polls and two nibbles
+  JOYBUS_BYTE_CYCLES = 4 * IO_CYCLES,
+};
+
 void cicWriteBit(bool value) {
+  COVER(0x01, 0x20);
   writeIO(PORT_CIC, (value ? CIC_DATA_W : 0) | CIC_CLOCK);
   SPIN(5);
   writeIO(PORT_CIC, CIC_DATA_W);
@@ -251,6 +205,7 @@ void cicWriteBit(bool value) {
 // 01:2A
 // read bit from CIC
 bool cicReadBit(void) {
+  COVER(0x01, 0x2a);
   writeIO(PORT_CIC, CIC_DATA_W | CIC_CLOCK);
   SPIN(5);
   bool c = readIO(PORT_CIC) & CIC_DATA_R;
@@ -269,8 +224,10 @@ bool cicReadBit(void) {
 // called on the first trigger, as the second one will happen while interrupts are
 // disabled.
 void interruptA(void) {
+  COVER(0x02, 0x00);
+  latencyBegin(LATENCY_READ4);
   SB = B;
-  RAM(SAVE_A) = A;
+  RAM_SET(SAVE_A, A);
 
   if (readIO(PORT_RCP_XFER) & RCP_XFER_READ) {
     if (readIO(PORT_RCP_XFER) & RCP_XFER_64B) {
@@ -278,6 +235,7 @@ void interruptA(void) {
       // A 64B read was issued by RCP. If the 6105 challenge is requested do that,
       // otherwise execute the joybus transfer that was last programmed.
       if (!RAM_BIT_TEST(PIF_CMD_L, PIF_CMD_L_CHALLENGE)) {
+        latencyKind(LATENCY_READ64);
         joybusTransfer();  // this will also call executeRCPTransfer() when it's done
         return;
       }
@@ -289,6 +247,7 @@ void interruptA(void) {
         // NOTE: interruptEpilogChallenge() actually does a "RTN" rather than "RTNI",
         // so it leaves interrupts disabled. We don't want other interrupts to happen
         // while we are waiting for the challenge to be run.
+        latencyKind(LATENCY_CHALLENGE);
         interruptEpilogChallenge();
         return;  
       }
@@ -300,6 +259,7 @@ void interruptA(void) {
   } else {
     // A write was issued by RCP (either Write4B or Write64B). In this case, let the
     // transfer run right away and then process the updated contents of PIF-RAM.
+    latencyKind(LATENCY_WRITE);
     executeRCPTransfer();
 
     // If the joybus command bit (0x1) is set, turn it off and parse the joybus packet
@@ -308,8 +268,7 @@ void interruptA(void) {
       RAM_BIT_RESET(PIF_CMD_L, PIF_CMD_L_JOYBUS);
 
       regSave();
-      joybusStatusInit();
-      joybusCommandParse();
+      joybusParse();
       regRestore();
       return;
     }
@@ -320,8 +279,10 @@ void interruptA(void) {
 
 // 02:04
 void interruptB(void) {
+  COVER(0x02, 0x04);
+  latencyBegin(LATENCY_RESET);
   SB = B;
-  RAM(SAVE_A) = A;
+  RAM_SET(SAVE_A, A);
   RAM_BIT_RESET(STATUS, STATUS_RUNNING);  // no more in running mode, we're going to reset
   writeIO(REG_INT_EN, INT_A_EN);          // disable interrupt B
   writeIO(PORT_RESET, RESET_CPU_IRQ);     // trigger pre-NMI on VR4300
@@ -331,6 +292,7 @@ void interruptB(void) {
 
 // 02:2C
 void regRestore(void) {
+  COVER(0x02, 0x2c);
   C = 1;
   if (!RAM_BIT_TEST(SAVE_C, 0))
     C = 0;
@@ -342,6 +304,7 @@ void regRestore(void) {
 
 // 02:3B
 void interruptEpilog(void) {
+  COVER(0x02, 0x3b);
   A = RAM(SAVE_A);
   B = SB;
   IME = 1;
@@ -352,6 +315,7 @@ void interruptEpilog(void) {
 // the transfer from RCP is paused waiting for an ACK from PIF. This function gives
 // the ACK (send the "start bit"), and then wait for the actual transfer to finish. 
 void executeRCPTransfer(void) {
+  COVER(0x03, 0x06);
   // Re-enable intA. This is *probably* the trigger for the hardware unit in charge of
   // RCP communication to send the ACK bit (aka "start bit") which makes the RCP transfer
   // actually begin. We don't know for sure, but it's the most probable explanation, as
@@ -367,10 +331,13 @@ void executeRCPTransfer(void) {
   if (RAM_BIT_TEST(STATUS, STATUS_RUNNING)) {
     writeIO(REG_INT_EN, INT_A_EN | INT_B_EN);   // reenable B (unless we're already resetting)
   }
+  latencyEndRCP();
 }
 
 // 03:0B
 void cicLoop(void) {
+  COVER(0x03, 0x0b);
+  phaseEnter(PHASE_CIC_LOOP);
   for (;;) {
     IME = 1;   // reenable interrupts (in case they were disabled, like during the challenge)
 
@@ -393,9 +360,13 @@ void cicLoop(void) {
 }
 
 // 03:16
-void cicCompare(void) {
-  cicWriteBit(0);
-  cicWriteBit(0);
+static inline void cicCompareRegion(bool pal) {
+  COVER(0x03, 0x16);
+  latencyBegin(LATENCY_COMPARE);
+  if (!hleCIC) {
+    cicWriteBit(0);
+    cicWriteBit(0);
+  }
   cicCompareRound(CIC_COMPARE_LO);
   cicCompareRound(CIC_COMPARE_LO);
   cicCompareRound(CIC_COMPARE_LO);
@@ -406,18 +377,42 @@ void cicCompare(void) {
   if (!offset)
     offset = 1;
 
-  for (; (offset & 0xf) != 0; offset += (regionPAL ? -1 : +1)) {
-    cicWriteBit(RAM_BIT_TEST(CIC_COMPARE_LO + offset, 0));
-    bool c = cicReadBit();
+  // the high-level CIC takes all of the PIF's bits at once
+  u16 answer = 0;
+  if (hleCIC) {
+    u16 sent = 0;
+    for (u8 o = offset; (o & 0xf) != 0; o += COMPARE_STEP(pal))
+      sent |= RAM_BIT_TEST(CIC_COMPARE_LO + o, 0) << (o & 0xf);
+    answer = cicHleCompare(offset, sent);
+  }
+
+  for (; (offset & 0xf) != 0; offset += COMPARE_STEP(pal)) {
+    bool c;
+    if (hleCIC) {
+      c = answer & BIT(offset & 0xf);
+    } else {
+      cicWriteBit(RAM_BIT_TEST(CIC_COMPARE_LO + offset, 0));
+      c = cicReadBit();
+    }
     if (c != RAM_BIT_TEST(CIC_COMPARE_HI + offset, 0)) {
       signalError();
     }
   }
+  latencyEnd(LATENCY_COMPARE);
+}
+
+void cicCompareNTSC(void) {
+  cicCompareRegion(0);
+}
+
+void cicComparePAL(void) {
+  cicCompareRegion(1);
 }
 
 // 03:39
 // disable interrupts and strobe the VR4300 NMI forever
 void signalError(void) {
+  COVER(0x03, 0x39);
   IME = 0;
   u8 a = 0;  // incoming value doesn't really matter, as we're continuously toggling all bits anyway
   do {
@@ -430,19 +425,24 @@ void signalError(void) {
 // 04:0E
 // swap internal and external memory
 void memSwapRanges(void) {
+  COVER(0x04, 0x0e);
   memSwap(OSINFO + 0xb0);        // swap [0x1b..0x1f] <-> [0xcb..0xcf]
   memSwap(PIF_CHECKSUM + 0xb0);  // swap [0x34..0x3f] <-> [0xe4..0xef]
 }
 
 // 04:14
 void memSwap(u8 address) {
+  COVER(0x04, 0x14);
   do {
-    SWAP(RAM(address), RAM(address - 0xb0));
+    u8 a = RAM(address);
+    RAM_SET(address, RAM(address - 0xb0));
+    RAM_SET(address - 0xb0, a);
   } while (++address & 0xf);
 }
 
 // 04:23
 void joybusHandleError(void) {
+  COVER(0x04, 0x23);
   writeIO(PORT_JOYBUS_CTRL, 0);
   writeIO(PORT_JOYBUS_CTRL, 1);
 
@@ -456,12 +456,13 @@ void joybusHandleError(void) {
   }
 
   sb = incrementPtr(sb + 1);
-  RAM(sb) += a;
+  RAM_SET(sb, RAM(sb) + a);
   writeIO(PORT_JOYBUS_ERROR, JOYBUS_ERROR_RESET);
 }
 
 // 05:00
 void boot(void) {
+  COVER(0x05, 0x00);
   IME = 0;
 
   memSwapRanges();  // copy OSINFO (including CIC seeds) from internal memory to external memory
@@ -470,6 +471,7 @@ void boot(void) {
   IME = 1;
 
   // wait for rom lockout bit of PIF status byte to become set
+  phaseEnter(PHASE_LOCKOUT);
   while (!RAM_BIT_TEST(PIF_CMD_U, PIF_CMD_U_LOCKOUT))
     sync();
 
@@ -482,6 +484,7 @@ void boot(void) {
   IME = 1;
 
   // wait for get checksum bit
+  phaseEnter(PHASE_GET_CHECKSUM);
   while (!RAM_BIT_TEST(PIF_CMD_U, PIF_CMD_U_GET_CHECKSUM))
     sync();
 
@@ -493,12 +496,13 @@ void boot(void) {
   IME = 1;
 
   // wait for check checksum bit
+  phaseEnter(PHASE_CHECK_CHECKSUM);
   while (!RAM_BIT_TEST(PIF_CMD_U, PIF_CMD_U_CHECK_CHECKSUM))
     sync();
 
   IME = 0;
 
-  RAM(PIF_CMD_U) = 0;
+  RAM_SET(PIF_CMD_U, 0);
   if (reset == 0)  // only run on cold boot, not on reset
     cicCompareInit();
 
@@ -506,7 +510,7 @@ void boot(void) {
   // halt the CPU if it doesn't match
   for (u8 i = 0; i < 0xc; ++i) {
     u8 a = RAM(PIF_CHECKSUM + i);
-    RAM(PIF_CHECKSUM + i) = 0;
+    RAM_SET(PIF_CHECKSUM + i, 0);
     if (a != RAM(CIC_CHECKSUM + i)) {
       signalError();
     }
@@ -535,6 +539,7 @@ void boot(void) {
 
   IME = 1;
 
+  phaseEnter(PHASE_TERMINATE);
   while (!RAM_BIT_TEST(PIF_CMD_L, PIF_CMD_L_TERMINATE)) {
     sync();
 
@@ -546,6 +551,7 @@ void boot(void) {
   memZero(PIF_CMD_U);
   writeIO(REG_INT_EN, INT_A_EN | INT_B_EN);
   RAM_BIT_SET(STATUS, STATUS_RUNNING);
+  external.dirty = EXTERNAL_ALL;  // boot wrote PIF_CMD and the swapped ranges
   IFB = 0;
 
   cicLoop();
@@ -553,22 +559,33 @@ void boot(void) {
 
 // 06:00
 void cicReset(void) {
-  cicWriteBit(1);
-  cicWriteBit(1);
-  writeIO(PORT_CIC, CIC_DATA_W | CIC_CLOCK);
-  memZero(RESET_TIMER);
-
-  for (;;) {
+  COVER(0x06, 0x00);
+  phaseEnter(PHASE_RESET);
+  if (hleCIC) {
+    // the CIC answers after its countdown, or never when halted
+    memZero(RESET_TIMER);
     RAM_BIT_SET(PIF_CMD_U, PIF_CMD_U_ACK);
-    if (!(readIO(PORT_CIC) & CIC_DATA_R))
-      break;
-
-    u8 b = RESET_TIMER_END - 1;
-    if (increment8(&b) && increment8(&b))
+    if (!cicHleReset())
       signalError();
-  }
+  } else {
+    cicWriteBit(1);
+    cicWriteBit(1);
+    writeIO(PORT_CIC, CIC_DATA_W | CIC_CLOCK);
+    memZero(RESET_TIMER);
 
-  writeIO(PORT_CIC, CIC_DATA_W);
+    for (;;) {
+      RAM_BIT_SET(PIF_CMD_U, PIF_CMD_U_ACK);
+      if (!(readIO(PORT_CIC) & CIC_DATA_R))
+        break;
+      SPIN(11);  // rest of the loop and IncrementByte, so the timeout outlasts the CIC's delay
+
+      u8 b = RESET_TIMER_END - 1;
+      if (increment8(&b) && increment8(&b))
+        signalError();
+    }
+
+    writeIO(PORT_CIC, CIC_DATA_W);
+  }
 
   while (!(readIO(PORT_RESET) & RESET_BUTTON)) // keep the reset on hold until the button is kept pressed
     ;
@@ -576,19 +593,21 @@ void cicReset(void) {
   IME = 0;
   writeIO(PORT_ROM, 0);  // disable ROM lockout
   writeIO(PORT_RESET, RESET_BUTTON | RESET_CPU_NMI);  // pulse NMI on VR4300, not sure why RESET_BUTTON is set here
+  latencyEnd(LATENCY_RESET);
   writeIO(PORT_RESET, RESET_BUTTON);
   reset = 1;
 }
 
 // 06:29
 bool increment8(u8* address) {
-  RAM(*address) += 1;
+  COVER(0x06, 0x29);
+  RAM_SET(*address, RAM(*address) + 1);
   if (RAM(*address)) {
     return false;
   }
   *address -= 1;
 
-  RAM(*address) += 1;
+  RAM_SET(*address, RAM(*address) + 1);
   if (RAM(*address)) {
     *address += 1;
     return false;
@@ -600,6 +619,7 @@ bool increment8(u8* address) {
 
 // 07:00
 void bootTimerCheck(void) {
+  COVER(0x07, 0x00);
   u8 b = BOOT_TIMER_END - 1;
   if (!increment8(&b) || !increment8(&b) || !increment8(&b)) {
     return;
@@ -611,6 +631,7 @@ void bootTimerCheck(void) {
 // 07:09
 // Epilog of the interrupt for the challenge command.
 void interruptEpilogChallenge(void) {
+  COVER(0x07, 0x09);
   RAM_BIT_RESET(PIF_CMD_L, PIF_CMD_L_CHALLENGE);  // turn off challenge bit in command byte
   RAM_BIT_SET(STATUS, STATUS_CHALLENGE);  // tell the main loop that will need to do the challenge
   A = RAM(SAVE_A);
@@ -622,6 +643,7 @@ void interruptEpilogChallenge(void) {
 
 // 07:13
 void joybusTransfer(void) {
+  COVER(0x07, 0x13);
   regSave();
 
   // Go through the 5 channels in reverse order, and do the actual
@@ -641,6 +663,7 @@ void joybusTransfer(void) {
 
 // 07:1F
 void joybusTransferChannel(u8 n) {
+  COVER(0x07, 0x1f);
   writeIO(PORT_JOYBUS_CHANNEL, n);
 
   if (RAM_BIT_TEST(JOYBUS_STATUS + n, JOYBUS_STATUS_RESET)) {
@@ -657,10 +680,15 @@ void joybusTransferChannel(u8 n) {
 
   joybusCopyRecvCount(JOYBUS_RECV_COUNT_U, &sb);
 
+  if (transactions && transactions->joybusSend) {
+    joybusTransferMessage(sb);
+    return;
+  }
+
   for (;;) {
-    RAM(JOYBUS_SEND_COUNT_L) -= 1;
+    RAM_SET(JOYBUS_SEND_COUNT_L, RAM(JOYBUS_SEND_COUNT_L) - 1);
     if (RAM(JOYBUS_SEND_COUNT_L) == 0xf) {
-      RAM(JOYBUS_SEND_COUNT_U) -= 1;
+      RAM_SET(JOYBUS_SEND_COUNT_U, RAM(JOYBUS_SEND_COUNT_U) - 1);
       if (RAM(JOYBUS_SEND_COUNT_U) == 0xf)
         break;
     }
@@ -682,9 +710,9 @@ void joybusTransferChannel(u8 n) {
   joybusWait();
 
   for (;;) {
-    RAM(JOYBUS_RECV_COUNT_L) -= 1;
+    RAM_SET(JOYBUS_RECV_COUNT_L, RAM(JOYBUS_RECV_COUNT_L) - 1);
     if (RAM(JOYBUS_RECV_COUNT_L) == 0xf) {
-      RAM(JOYBUS_RECV_COUNT_U) -= 1;
+      RAM_SET(JOYBUS_RECV_COUNT_U, RAM(JOYBUS_RECV_COUNT_U) - 1);
       if (RAM(JOYBUS_RECV_COUNT_U) == 0xf)
         break;
     }
@@ -695,8 +723,8 @@ void joybusTransferChannel(u8 n) {
         return;
       }
     } while (!(readIO(PORT_JOYBUS_STATUS) & JOYBUS_STATUS_CLOCK));
-    RAM(sb + 0) = readIO(PORT_JOYBUS_READ);
-    RAM(sb + 1) = readIO(PORT_JOYBUS_READ);
+    RAM_SET(sb + 0, readIO(PORT_JOYBUS_READ));
+    RAM_SET(sb + 1, readIO(PORT_JOYBUS_READ));
     sb += 2;
     if (!sb)
       sb = RAM_EXTERNAL;
@@ -707,6 +735,7 @@ void joybusTransferChannel(u8 n) {
 
 // 09:00
 void joybusWait(void) {
+  COVER(0x09, 0x00);
   if (!RAM_BIT_TEST(PIF_CMD_L, BIT(2))) {
     joybusWriteStopBit();
   } else {
@@ -720,11 +749,16 @@ void joybusWait(void) {
 
 // 09:09
 void joybusWriteStopBit(void) {
-  writeIO(PORT_JOYBUS_CTRL, JOYBUS_CTRL_WRITESTOPBIT);
+  COVER(0x09, 0x09);
+  if (transactions && transactions->joybusSend)
+    cycles += IO_CYCLES;  // ends the message joybusTransferMessage() sends
+  else
+    writeIO(PORT_JOYBUS_CTRL, JOYBUS_CTRL_WRITESTOPBIT);
 }
 
 // 09:0D
 void spin256(void) {
+  COVER(0x09, 0x0d);
   u8 a = 0;
   do {
     SPIN(16);
@@ -733,6 +767,7 @@ void spin256(void) {
 
 // 09:16
 bool joybusCopySendCount(u8 b, u8* sb) {
+  COVER(0x09, 0x16);
   if (RAM_BIT_TEST(*sb, 3)) {
     return true;
   }
@@ -748,6 +783,7 @@ bool joybusCopySendCount(u8 b, u8* sb) {
 
 // 09:1F
 void joybusCopyRecvCount(u8 b, u8* sb) {
+  COVER(0x09, 0x1f);
   RAM_BIT_RESET(*sb, 3);
   RAM_BIT_RESET(*sb, 2);
 
@@ -756,8 +792,9 @@ void joybusCopyRecvCount(u8 b, u8* sb) {
 
 // 09:22
 void joybusCopyByte(u8 b, u8* sb) {
-  RAM(b + 0) = RAM(*sb + 0);
-  RAM(b + 1) = RAM(*sb + 1);
+  COVER(0x09, 0x22);
+  RAM_SET(b + 0, RAM(*sb + 0));
+  RAM_SET(b + 1, RAM(*sb + 1));
   *sb = incrementPtr(*sb + 1);
 }
 
@@ -766,6 +803,7 @@ void joybusCopyByte(u8 b, u8* sb) {
 // are actually performed here. The commands are parsed and the pointer
 // to the start of the frame of each channel is written to JOYBUS_ADDR_U/L[channel].
 void joybusCommandParse(void) {
+  COVER(0x09, 0x2d);
   u8 b = RAM_EXTERNAL;
   u8 n = 0;
 
@@ -817,8 +855,8 @@ void joybusCommandParse(void) {
         ++n;
     } else {
       // variable length commands
-      RAM(JOYBUS_ADDR_U + n) = b >> 4;
-      RAM(JOYBUS_ADDR_L + n) = b & 0xf;
+      RAM_SET(JOYBUS_ADDR_U + n, b >> 4);
+      RAM_SET(JOYBUS_ADDR_L + n, b & 0xf);
       RAM_BIT_RESET(JOYBUS_STATUS + n, JOYBUS_STATUS_SKIP);
       ++n;
 
@@ -834,13 +872,14 @@ void joybusCommandParse(void) {
 
 // 0B:00
 bool joybusCommandAdvance(u8* address, u8 channel) {
+  COVER(0x0b, 0x00);
   u8 b = *address;
   u8 n = channel;
 
   u8 sendU = RAM(b + 0) & 3;
   u8 sendL = RAM(b + 1);
-  RAM(JOYBUS_ADDR_U + n) = sendU;   // NOTE: this is just used as scratch space (it will be overwritten later)
-  RAM(JOYBUS_ADDR_L + n) = sendL;   // NOTE: this is just used as scratch space (it will be overwritten later)
+  RAM_SET(JOYBUS_ADDR_U + n, sendU);   // NOTE: this is just used as scratch space (it will be overwritten later)
+  RAM_SET(JOYBUS_ADDR_L + n, sendL);   // NOTE: this is just used as scratch space (it will be overwritten later)
   b += 2;
   if (!b)
     return true;
@@ -850,8 +889,8 @@ bool joybusCommandAdvance(u8* address, u8 channel) {
   u8 count = (sendU << 4) | sendL;
   count += (recvU << 4) | recvL;
   count += count;
-  RAM(JOYBUS_ADDR_L + n) = count & 0xf;   // NOTE: this is just used as scratch space (it will be overwritten later)
-  RAM(JOYBUS_ADDR_U + n) = count >> 4;    // NOTE: this is just used as scratch space (it will be overwritten later)
+  RAM_SET(JOYBUS_ADDR_L + n, count & 0xf);   // NOTE: this is just used as scratch space (it will be overwritten later)
+  RAM_SET(JOYBUS_ADDR_U + n, count >> 4);    // NOTE: this is just used as scratch space (it will be overwritten later)
 
   u16 next = b + count + 2;
   if (next >= 0x100)
@@ -864,7 +903,17 @@ bool joybusCommandAdvance(u8* address, u8 channel) {
 // 0C:00
 // read nibble from CIC into [address]
 void cicReadNibble(u8 address) {
-  RAM(address) = 0xf;
+  COVER(0x0c, 0x00);
+  if (hleCIC) {
+    RAM_SET(address, cicHleReadNibble());
+    return;
+  }
+  if (transactions && transactions->cicReadNibble) {
+    cycles += 4 * CIC_READ_BIT_CYCLES;
+    RAM_SET(address, transactions->cicReadNibble(transactions->user) & 0xf);
+    return;
+  }
+  RAM_SET(address, 0xf);
   if (!cicReadBit())
     RAM_BIT_RESET(address, 3);
   if (!cicReadBit())
@@ -877,6 +926,16 @@ void cicReadNibble(u8 address) {
 
 // 0C:10
 void cicWriteNibble(u8 address) {
+  COVER(0x0c, 0x10);
+  if (hleCIC) {
+    cicHleWriteNibble(RAM(address));
+    return;
+  }
+  if (transactions && transactions->cicWriteNibble) {
+    cycles += 4 * CIC_WRITE_BIT_CYCLES;
+    transactions->cicWriteNibble(transactions->user, RAM(address));
+    return;
+  }
   cicWriteBit(RAM_BIT_TEST(address, 3));
   cicWriteBit(RAM_BIT_TEST(address, 2));
   cicWriteBit(RAM_BIT_TEST(address, 1));
@@ -885,6 +944,7 @@ void cicWriteNibble(u8 address) {
 
 // 0C:26
 void joybusResetChannel(void) {
+  COVER(0x0c, 0x26);
   while (!(readIO(PORT_JOYBUS_STATUS) & JOYBUS_STATUS_CLOCK))
     writeIO(PORT_JOYBUS_ERROR, JOYBUS_ERROR_RESET);
 
@@ -898,13 +958,19 @@ void joybusResetChannel(void) {
 // 0C:32
 // read byte from adjacent memory segments
 u8 readByte(u8 address) {
+  COVER(0x0c, 0x32);
   return (RAM(address) << 4) | RAM(address ^ 0x10);
 }
 
 // 0D:00
 void cicChallenge(void) {
-  cicWriteBit(1);
-  cicWriteBit(0);
+  COVER(0x0d, 0x00);
+  if (hleCIC) {
+    cicHleChallenge();
+  } else {
+    cicWriteBit(1);
+    cicWriteBit(0);
+  }
   cicReadNibble(CIC_CHALLENGE_TIMER_U);
   cicReadNibble(CIC_CHALLENGE_TIMER_L);
   cicChallengeTransfer(CIC_CHALLENGE_COUNT_OUT);
@@ -912,8 +978,12 @@ void cicChallenge(void) {
   u8 b = CIC_CHALLENGE_TIMER_L;
   while (!increment8(&b))
     ;
-  cicReadBit();  // return value discarded
+  if (hleCIC)
+    cicHleReadBit();  // return value discarded
+  else
+    cicReadBit();  // return value discarded
   cicChallengeTransfer(CIC_CHALLENGE_COUNT_IN);
+  external.dirty = EXTERNAL_ALL;
 
   // Now that the challenge is complete and the data is in PIF-RAM, runs the RCP transfer
   // that was left suspended since interruptA() triggered. This will actually transfer the
@@ -924,11 +994,12 @@ void cicChallenge(void) {
 
 // 0D:1B
 void cicChallengeTransfer(u8 counter_ptr) {
+  COVER(0x0d, 0x1b);
   // Do the transfer. The counter is decremented by 1 for each byte transferred,
   // so assuming it starts from 0, it runs the loop 15 times (=> 30 nibbles, 15 bytes)
   // and leaves it at 0 again for next transfer.
   for (u8 b = CIC_CHALLENGE_LO; RAM(counter_ptr) != 0; b += 2) {
-    RAM(counter_ptr) -= 1;
+    RAM_SET(counter_ptr, RAM(counter_ptr) - 1);
     if (counter_ptr != CIC_CHALLENGE_COUNT_OUT) {
       cicReadNibble(b + 0);
       cicReadNibble(b + 1);
@@ -941,12 +1012,14 @@ void cicChallengeTransfer(u8 counter_ptr) {
 
 // 0D:31
 void regInitSB(void) {
+  COVER(0x0d, 0x31);
   SB = SAVE_A;
 }
 
 // 0D:35
 // increment address and wrap to 0x80 on overflow
 u8 incrementPtr(u8 address) {
+  COVER(0x0d, 0x35);
   if (++address == 0)
     address = RAM_EXTERNAL;
   return address;
@@ -954,6 +1027,7 @@ u8 incrementPtr(u8 address) {
 
 // 0E:00
 void cicCompareInit(void) {
+  COVER(0x0e, 0x00);
   // Set the RESET flag in OSINFO in internal memory. In fact, the previous value
   // have been already copied to external memory and read by the CPU. If the conole
   // is reset in the future, this value will be copied to external memory, including
@@ -969,9 +1043,14 @@ void cicCompareInit(void) {
   // the exact time of the pulse depends on the hardware RNG in PIF, the CIC will stop
   // its psuedo-RNG at a random time.
   // The CIC uses that RNG to create the scramble key put at the start of CIC_CHECKSUM_BUF.
-  writeIO(PORT_CIC, CIC_DATA_W | CIC_CLOCK);
-  spin256();
-  writeIO(PORT_CIC, CIC_DATA_W);
+  if (hleCIC) {
+    spin256();
+    cicHlePulse();
+  } else {
+    writeIO(PORT_CIC, CIC_DATA_W | CIC_CLOCK);
+    spin256();
+    writeIO(PORT_CIC, CIC_DATA_W);
+  }
 
   for (u8 address = CIC_CHECKSUM_BUF; address < CIC_CHECKSUM_END; ++address)
     cicReadNibble(address);
@@ -987,59 +1066,30 @@ void cicCompareInit(void) {
 // 0E:15
 // decode CIC seed or checksum (one round)
 void cicDescramble(u8 address) {
+  COVER(0x0e, 0x15);
   u8 a = 0xf;
   do {
     u8 b = RAM(address);
-    RAM(address) -= a + 1;
+    RAM_SET(address, RAM(address) - (a + 1));
     a = b;
   } while (++address & 0xf);
 }
 
 // 0E:1B
 void cicCompareRound(u8 address) {
-  for (u8 x = RAM(address + 0xf); x < 0x10; --x) {
-    u8 a = x;
-    u8 b = address + 1;
-    a += RAM(b) + 1;
-    RAM(b) = a;
-    ++b;
-    a += RAM(b) + 1;
-    a = ~a;
-    SWAP(a, RAM(b));
-    ++b;
-    bool Cy = (a & 0xf) + RAM(b) + 1 >= 0x10;
-    a += RAM(b) + 1;
-    if (!Cy) {
-      SWAP(a, RAM(b));
-      ++b;
-    }
-    a += RAM(b);
-    RAM(b) = a;
-    ++b;
-    a += RAM(b);
-    SWAP(a, RAM(b));
-    ++b;
-    Cy = (a & 0xf) + 8 >= 0x10;
-    a += 8;
-    if (!Cy)
-      a += RAM(b);
-    SWAP(a, RAM(b));
-    ++b;
-    do {
-      a += RAM(b) + 1;
-      RAM(b) = a;
-    } while (++b & 0xf);
-  }
+  COVER(0x0e, 0x1b);
+  compareRound(&ram[address]);
 }
 
 // 0F:00
 void cicCompareExpandSeed(void) {
-  RAM(CIC_COMPARE_LO) = 0;
+  COVER(0x0f, 0x00);
+  RAM_SET(CIC_COMPARE_LO, 0);
   for (u8 offset = 2; offset < 0x10; ++offset) {
     u8 byte = (regionPAL ? romPAL : romNTSC)[RAM(CIC_COMPARE_LO)];
-    RAM(CIC_COMPARE_LO) += 1;
-    RAM(CIC_COMPARE_LO + offset) = byte & 0xf;
-    RAM(CIC_COMPARE_HI + offset) = byte >> 4;
+    RAM_SET(CIC_COMPARE_LO, RAM(CIC_COMPARE_LO) + 1);
+    RAM_SET(CIC_COMPARE_LO + offset, byte & 0xf);
+    RAM_SET(CIC_COMPARE_HI + offset, byte >> 4);
   }
   cicWriteNibble(CIC_COMPARE_LO + 1);
   cicWriteNibble(CIC_COMPARE_HI + 1);
@@ -1048,6 +1098,7 @@ void cicCompareExpandSeed(void) {
 
 // 0F:1B
 void cicCompareCreateSeed(void) {
+  COVER(0x0f, 0x1b);
   writeIO(PORT_RNG, RNG_START);
 
   // Keep incrementing CIC_COMPARE_LO+9 until the RNG bit is 0.
@@ -1061,18 +1112,19 @@ void cicCompareCreateSeed(void) {
 
   writeIO(PORT_RNG, 0);
 
-  RAM(CIC_COMPARE_LO + 1) = RAM(CIC_COMPARE_LO + 8);
-  RAM(CIC_COMPARE_HI + 1) = RAM(CIC_COMPARE_LO + 9);
-  RAM(CIC_COMPARE_LO + 8) = 0;  // X is stored here but it's guaranteed to be 0
-  RAM(CIC_COMPARE_LO + 9) = 0;
+  RAM_SET(CIC_COMPARE_LO + 1, RAM(CIC_COMPARE_LO + 8));
+  RAM_SET(CIC_COMPARE_HI + 1, RAM(CIC_COMPARE_LO + 9));
+  RAM_SET(CIC_COMPARE_LO + 8, 0);  // X is stored here but it's guaranteed to be 0
+  RAM_SET(CIC_COMPARE_LO + 9, 0);
 }
 
 // 0F:2F
 // save SB, X, C
 void regSave(void) {
-  RAM(SAVE_SBM) = SBM;
-  RAM(SAVE_SBL) = SBL;
-  RAM(SAVE_X) = X;
+  COVER(0x0f, 0x2f);
+  RAM_SET(SAVE_SBM, SBM);
+  RAM_SET(SAVE_SBL, SBL);
+  RAM_SET(SAVE_X, X);
   RAM_BIT_SET(SAVE_C, 0);
   if (C == 0)
     RAM_BIT_RESET(SAVE_C, 0);
@@ -1081,13 +1133,26 @@ void regSave(void) {
 
 // end PIF ROM
 
-FILE* input;
+#endif  // CMODEL_ROM
 
+// Move to another firmware phase, returning the one left.
+u8 phaseEnter(u8 to) {
+  u8 from = phase;
+  if (phaseChange && to != from)
+    phaseChange(from, to);
+  phase = to;
+  return from;
+}
+
+// Dispatch pending interrupts like the SM5 core does between instructions.
+// Harnesses call this at sync() points.
 void checkInterrupt(void) {
   if (IFA && (RE & BIT(0)) && IME) {
     IFA = 0;
     IME = 0;
+    u8 from = phaseEnter(PHASE_INTERRUPT_A);
     interruptA();
+    phaseEnter(from);
   }
   if (IFB && (RE & BIT(2)) && IME) {
     IFB = 0;
@@ -1096,8 +1161,258 @@ void checkInterrupt(void) {
   }
 }
 
+#ifndef CMODEL_ROM
+
+void latencyBegin(u8 kind) {
+  if (latency) {
+    latency->start[kind] = cycles;
+    latency->pending |= BIT(kind);
+  }
+}
+
+void latencyEnd(u8 kind) {
+  if (latency && (latency->pending & BIT(kind))) {
+    latency->pending &= ~BIT(kind);
+    histRecord(&latency->h[kind], cycles - latency->start[kind]);
+  }
+}
+
+// interruptA() times every transfer as a Read4B until it knows better
+void latencyKind(u8 kind) {
+  if (latency && (latency->pending & BIT(LATENCY_READ4))) {
+    latency->pending ^= BIT(LATENCY_READ4) | BIT(kind);
+    latency->start[kind] = latency->start[LATENCY_READ4];
+  }
+}
+
+void latencyEndRCP(void) {
+  for (u8 kind = LATENCY_READ4; kind <= LATENCY_CHALLENGE; ++kind)
+    latencyEnd(kind);
+}
+
+// joybusStatusInit() and joybusCommandParse() for interruptA(). The parse
+// reads only what the RCP wrote: joybus transfers write into the rr bytes and
+// the top bits of RX, which it skips. So in the main loop it is left out when
+// no RCP write changed a block since the last one, as when a game polls with
+// the same command block every frame. During boot it always runs.
+void joybusParse(void) {
+  bool running = RAM_BIT_TEST(STATUS, STATUS_RUNNING);
+  if (running && !external.dirty)
+    return;
+  joybusStatusInit();
+  joybusCommandParse();
+  if (running)
+    external.dirty = 0;
+}
+
+// The rest of joybusTransferChannel() as two transactions, see
+// cmodel_pif.h: the frame's TX bytes from sb, then its RX bytes back into
+// PIF-RAM after them. Scratch RAM and cycles end up as after the port loops.
+void joybusTransferMessage(u8 sb) {
+  u8 buf[64];
+  u8 send = RAM(JOYBUS_SEND_COUNT_U) << 4 | RAM(JOYBUS_SEND_COUNT_L);
+  u8 recv = RAM(JOYBUS_RECV_COUNT_U) << 4 | RAM(JOYBUS_RECV_COUNT_L);
+
+  for (u8 i = 0; i < send; ++i) {
+    buf[i] = RAM(sb + 0) << 4 | RAM(sb + 1);
+    sb += 2;
+    if (!sb)
+      sb = RAM_EXTERNAL;
+  }
+  RAM_SET(JOYBUS_SEND_COUNT_U, 0xf);
+  RAM_SET(JOYBUS_SEND_COUNT_L, 0xf);
+  cycles += send * JOYBUS_BYTE_CYCLES;
+
+  joybusWait();
+  transactions->joybusSend(transactions->user, buf, send);
+
+  int got = transactions->joybusRecv(transactions->user, buf, recv);
+  u8 n = got < 0 ? 0 : got < recv ? got : recv;
+  for (u8 i = 0; i < n; ++i) {
+    RAM_SET(sb + 0, buf[i] >> 4);
+    RAM_SET(sb + 1, buf[i] & 0xf);
+    sb += 2;
+    if (!sb)
+      sb = RAM_EXTERNAL;
+  }
+  cycles += n * JOYBUS_BYTE_CYCLES;
+
+  // the count as the loop leaves it, decremented once more on a short answer
+  u8 left = recv - n - 1;
+  RAM_SET(JOYBUS_RECV_COUNT_U, left >> 4);
+  RAM_SET(JOYBUS_RECV_COUNT_L, left & 0xf);
+  if (n < recv) {
+    cycles += IO_CYCLES;  // the status poll that finds the line idle
+    joybusHandleError();
+    return;
+  }
+
+  writeIO(PORT_JOYBUS_CTRL, 1);
+}
+
+#endif  // CMODEL_ROM
+
+// Everything below is the trace replay harness. Build with -DCMODEL_LIB to
+// link the model against a different one.
+#ifndef CMODEL_LIB
+
+FILE* input;
+bool quiet = 0;
+vcd wave;
+
+// ports watched with -r and -w, bit n for port n
+u16 watchReadPorts;
+u16 watchWritePorts;
+void watchPort(const char* kind, u8 port, u8 value);
+
+const char* journalPath = NULL;
+
+// -P counts host events for the model, so the harness pauses the counters
+// while it reads the trace or waits for the host.
+const char* phasePath = NULL;
+perfGroup phasePerf;
+
+void harnessEnter(void) {
+  if (phasePath)
+    perfPause(&phasePerf);
+}
+
+void harnessLeave(void) {
+  if (phasePath)
+    perfResume(&phasePerf);
+}
+
+// Expectations can be embedded in the trace between regular tokens. They
+// are checked as soon as the model reaches them, so a long trace stops at
+// the first mismatch without having to diff the printed output:
+//   =w <port> <value>     the next writeIO must be exactly this
+//   =ram <addr> <nibbles> RAM starting at addr must contain these nibbles,
+//                         written as a string of hex digits ('.' = any).
+//                         Use =ram 80 to check PIF-RAM, e.g. after r64.
+enum {
+  EXPECT_FAILED = 5,
+};
+
+void echo(const char* format, ...) {
+  if (quiet)
+    return;
+
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+}
+
+void expectFailed(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  printf("expect failed: ");
+  vprintf(format, args);
+  printf("\n");
+  va_end(args);
+  exit(EXPECT_FAILED);
+}
+
+// Server mode (-s name): instead of reading a trace, the model is driven by
+// another process through the shared-memory rings in ring.h. Port reads and
+// commands become requests the host answers; writes and PIF-RAM are posted.
+// ringclient.c replays a trace this way.
+ringShared* server;
+const char* serverName;
+bool serverPoll;
+
+void serverPost(u8 kind, u8 port, u8 value) {
+  ringMsg msg = {.kind = kind, .port = port, .value = value};
+  ringPut(server, &server->out, &msg);
+}
+
+// exit, telling the host first when serving
+void quit(int code) {
+  if (server)
+    serverPost(RING_EXIT, 0, code);
+  exit(code);
+}
+
+u8 serverValue(u8 kind, u8 port) {
+  serverPost(kind, port, 0);
+
+  ringMsg msg;
+  ringGet(server, &server->in, &msg);
+  if (msg.kind != RING_VALUE) {
+    printf("expected a value from the host, got message %d\n", msg.kind);
+    quit(4);
+  }
+  return msg.value;
+}
+
+void serverRAM(void) {
+  ringMsg msg = {.kind = RING_RAM};
+  for (int i = 0; i < 64; ++i)
+    msg.data[i] = RAM(RAM_EXTERNAL + i * 2) << 4 | RAM(RAM_EXTERNAL + i * 2 + 1);
+  ringPut(server, &server->out, &msg);
+}
+
+bool serverCommand(void) {
+  serverPost(RING_COMMAND, 0, 0);
+
+  ringMsg msg;
+  ringGet(server, &server->in, &msg);
+
+  switch (msg.kind) {
+    case RING_W4:
+      echo("  w4 %x", msg.port);
+      for (int i = 0; i < 8; ++i) {
+        u8 value = i & 1 ? msg.data[i / 2] & 0xf : msg.data[i / 2] >> 4;
+        echo(" %x", value);
+        externalWrite(msg.port * 2 + i, value);
+      }
+      echo("\n");
+      IFA = 1;
+      break;
+    case RING_W64:
+      echo("  w64");
+      for (int i = 0; i < 0x80; ++i) {
+        u8 value = i & 1 ? msg.data[i / 2] & 0xf : msg.data[i / 2] >> 4;
+        echo(" %x", value);
+        externalWrite(i, value);
+      }
+      echo("\n");
+      IFA = 1;
+      break;
+    case RING_R64:
+      echo("  r64\n");
+      IFA = 1;
+      break;
+    case RING_RESET:
+      echo("  reset\n");
+      IFB = 1;
+      break;
+    case RING_PASS:
+      echo("  pass\n");
+      return true;
+    case RING_QUIT:
+      echo("  q\n");
+      quit(0);
+      break;
+    default:
+      printf("\nunrecognized\n");
+      quit(4);
+  }
+
+  return false;
+}
+
+void serverClose(void) {
+  ringDetach(server);
+  ringUnlink(serverName);
+}
+
 void halt(void) {
   // todo: maybe simulate actual DMA transfer and second intA?
+  if (server)
+    serverRAM();
+  if (watch.armed)
+    watchScan(WATCH_HARNESS);
 }
 
 void skipComments(void) {
@@ -1109,10 +1424,10 @@ void skipComments(void) {
   } while (num > 0);
 }
 
-int scanValue(void) {
+int scanHex(void) {
   skipComments();
 
-  int value;
+  unsigned value;
   if (1 != fscanf(input, "%x", &value)) {
     printf("scanf error\n");
     exit(3);
@@ -1120,31 +1435,170 @@ int scanValue(void) {
   return value;
 }
 
+void expectRAM(void) {
+  int address = scanHex();
+  char nibbles[257];
+  if (1 != fscanf(input, " %256[0-9a-fA-F.]", nibbles)) {
+    printf("scanf error\n");
+    exit(3);
+  }
+
+  for (int i = 0; nibbles[i]; ++i) {
+    if (nibbles[i] == '.')
+      continue;
+
+    int value = nibbles[i] <= '9' ? nibbles[i] - '0' : (nibbles[i] | 0x20) - 'a' + 10;
+    if (RAM(address + i) != value)
+      expectFailed("ram %02x is %x, expected %x", (address + i) & 0xff, RAM(address + i), value);
+  }
+}
+
+// Check all expectations at the current trace position. When called for a
+// write (port >= 0) an "=w" is consumed and compared; any other caller
+// must not find one, since the model wasn't going to write there.
+void expect(int port, int value) {
+  for (;;) {
+    skipComments();
+
+    int next = fgetc(input);
+    if (next != '=') {
+      ungetc(next, input);
+      return;
+    }
+
+    char kind[8];
+    if (1 != fscanf(input, "%7s", kind)) {
+      printf("scanf error\n");
+      exit(3);
+    }
+
+    if (!strcmp(kind, "w")) {
+      int expectPort = scanHex();
+      int expectValue = scanHex();
+      if (port < 0)
+        expectFailed("w %x %x, but model is reading", expectPort, expectValue);
+      if (port != expectPort || value != expectValue)
+        expectFailed("w %x %x, expected w %x %x", port, value, expectPort, expectValue);
+      return;
+    } else if (!strcmp(kind, "ram")) {
+      expectRAM();
+    } else {
+      printf("unrecognized expectation =%s\n", kind);
+      exit(4);
+    }
+  }
+}
+
+int scanValue(void) {
+  expect(-1, 0);
+  return scanHex();
+}
+
+// Waveform of all modeled ports, one signal per port holding the last value
+// read or written there. The CIC port is split into its data/clock lines.
+int waveSignal[0x10];
+int waveCicDataW;
+int waveCicClock;
+int waveCicDataR;
+
+void waveClose(void) {
+  vcdClose(&wave);
+}
+
+void waveOpen(const char* path) {
+  static const struct {
+    u8 port;
+    const char* name;
+  } ports[] = {
+      {PORT_JOYBUS_WRITE, "joybus_write"},
+      {PORT_JOYBUS_READ, "joybus_read"},
+      {PORT_JOYBUS_CTRL, "joybus_ctrl"},
+      {PORT_JOYBUS_STATUS, "joybus_status"},
+      {PORT_JOYBUS_ERROR, "joybus_error"},
+      {PORT_ROM, "rom"},
+      {PORT_RCP_XFER, "rcp_xfer"},
+      {PORT_RESET, "reset"},
+      {PORT_RNG, "rng"},
+      {PORT_JOYBUS_CHANNEL, "joybus_channel"},
+      {REG_INT_EN, "int_en"},
+  };
+
+  // one time unit per modeled cycle, shown at a nominal 1 MHz
+  if (!vcdOpen(&wave, path, "1 us", "pif")) {
+    printf("cannot open %s\n", path);
+    exit(4);
+  }
+
+  for (int i = 0; i < 0x10; ++i)
+    waveSignal[i] = -1;
+  for (size_t i = 0; i < sizeof(ports) / sizeof(ports[0]); ++i)
+    waveSignal[ports[i].port] = vcdSignal(&wave, ports[i].name, 4);
+  waveCicDataW = vcdSignal(&wave, "cic_data_w", 1);
+  waveCicClock = vcdSignal(&wave, "cic_clock", 1);
+  waveCicDataR = vcdSignal(&wave, "cic_data_r", 1);
+
+  vcdBegin(&wave);
+  atexit(waveClose);
+}
+
+void wavePort(u8 port, u8 value, bool read) {
+  if (port == PORT_CIC) {
+    if (read) {
+      vcdChange(&wave, waveCicDataR, cycles, !!(value & CIC_DATA_R));
+    } else {
+      vcdChange(&wave, waveCicDataW, cycles, !!(value & CIC_DATA_W));
+      vcdChange(&wave, waveCicClock, cycles, !!(value & CIC_CLOCK));
+    }
+  } else if (waveSignal[port & 0xf] >= 0) {
+    vcdChange(&wave, waveSignal[port & 0xf], cycles, value & 0xf);
+  }
+}
+
 u8 readIO(u8 port) {
-  printf("r %x\n", port);
-  int value = scanValue();
-  printf("  %x\n", value);
+  cycles += IO_CYCLES;
+  harnessEnter();
+  echo("r %x\n", port);
+  int value = server ? serverValue(RING_READ, port) : scanValue();
+  echo("  %x\n", value);
+  if (watchReadPorts & BIT(port & 0xf))
+    watchPort("r", port, value);
+  if (journalPath)
+    journalPort(0, port, value);
+  if (wave.f)
+    wavePort(port, value, true);
+  harnessLeave();
   return value & 0xf;
 }
 
 void writeIO(u8 port, u8 value) {
+  cycles += IO_CYCLES;
   if (port == 0xe) {
     RE = value;
   }
-  printf("w %x %x\n", port, value);
+  harnessEnter();
+  echo("w %x %x\n", port, value);
+  if (watchWritePorts & BIT(port & 0xf))
+    watchPort("w", port, value);
+  if (journalPath)
+    journalPort(1, port, value);
+  if (wave.f)
+    wavePort(port, value, false);
+  if (server)
+    serverPost(RING_WRITE, port, value);
+  else
+    expect(port, value);
+  harnessLeave();
 }
 
 void readRegion(void) {
-  printf("r region\n");
-  int value = scanValue();
-  printf("  %x\n", value);
+  echo("r region\n");
+  int value = server ? serverValue(RING_REGION, 0) : scanValue();
+  echo("  %x\n", value);
   regionPAL = value;
 }
 
-bool readCommand(void) {
-  printf("r command\n");
-
-  skipComments();
+bool scanCommand(void) {
+  expect(-1, 0);
 
   char cmd[16];
   if (1 != fscanf(input, "%15s", cmd)) {
@@ -1152,38 +1606,38 @@ bool readCommand(void) {
     exit(3);
   }
 
-  printf("  %s", cmd);
+  echo("  %s", cmd);
 
   if (!strcmp(cmd, "w4")) {
     int address = scanValue();
-    printf(" %x", address);
+    echo(" %x", address);
     for (int i = 0; i < 8; ++i) {
       int value = scanValue();
-      printf(" %x", value);
-      RAM(RAM_EXTERNAL + address * 2 + i) = value;
+      echo(" %x", value);
+      externalWrite(address * 2 + i, value);
     }
-    printf("\n");
+    echo("\n");
     IFA = 1;
   } else if (!strcmp(cmd, "w64")) {
     for (int i = 0; i < 0x80; ++i) {
       int value = scanValue();
-      printf(" %x", value);
-      RAM(RAM_EXTERNAL + i) = value;
+      echo(" %x", value);
+      externalWrite(i, value);
     }
-    printf("\n");
+    echo("\n");
     IFA = 1;
   } else if (!strcmp(cmd, "r64")) {
-    printf("\n");
+    echo("\n");
     IFA = 1;
   } else if (!strcmp(cmd, "reset")) {
-    printf("\n");
+    echo("\n");
     IFB = 1;
   } else if (!strcmp(cmd, "pass")) {
-    printf("\n");
+    echo("\n");
     return true;
   } else if (!strcmp(cmd, "q")) {
-    printf("\n");
-    exit(0);
+    echo("\n");
+    quit(0);
   } else {
     printf("\nunrecognized\n");
     exit(4);
@@ -1192,27 +1646,367 @@ bool readCommand(void) {
   return false;
 }
 
+bool readCommand(void) {
+  harnessEnter();
+  echo("r command\n");
+  bool pass = server ? serverCommand() : scanCommand();
+  harnessLeave();
+  return pass;
+}
+
 void sync(void) {
+  // the model's writes so far are its own, the next ones the RCP's
+  if (watch.armed)
+    watchScan(WATCH_HARNESS);
   while (!readCommand())
     checkInterrupt();
 }
 
 void fatalError(void) {
   printf("fatal error\n");
-  exit(1);
+  quit(1);
 }
 
 void notImpl(u8 pu, u8 pl) {
   printf("not impl %x:%02x\n", pu, pl);
-  exit(2);
+  quit(2);
+}
+
+const char* latencyPath = NULL;
+latencyStats traceLatency;
+
+// percentiles of the latencies timed over the run, at exit
+void writeLatency(void) {
+  FILE* f = fopen(latencyPath, "w");
+  if (!f)
+    return;
+  histPrintHeader(f);
+  for (int i = 0; i < LATENCY_KINDS; ++i)
+    histPrint(f, latencyNames[i], &traceLatency.h[i]);
+  fclose(f);
+}
+
+// Watchpoints (-r, -w). A port is given by its cmodel_pif.h name or as
+// port<n>. RAM is a name from cmodel_pif.h, optionally +offset, or a hex
+// address; a name with an _END partner (JOYBUS_STATUS) covers the range up
+// to it, and a:b covers a up to b.
+#define NAMED(n) {#n, n}
+
+typedef struct {
+  const char* name;
+  u8 value;
+} namedValue;
+
+const namedValue ramNames[] = {
+    NAMED(JOYBUS_ADDR_L),       NAMED(JOYBUS_ADDR_U),       NAMED(CIC_CHALLENGE_TIMER_U),
+    NAMED(CIC_CHALLENGE_TIMER_L), NAMED(RESET_TIMER),       NAMED(RESET_TIMER_END),
+    NAMED(CIC_SEED_BUF),        NAMED(OSINFO),              NAMED(CIC_SEED),
+    NAMED(CIC_SEED_END),        NAMED(CIC_CHECKSUM_BUF),    NAMED(JOYBUS_SEND_COUNT_U),
+    NAMED(JOYBUS_SEND_COUNT_L), NAMED(CIC_CHECKSUM),        NAMED(CIC_CHECKSUM_END),
+    NAMED(JOYBUS_RECV_COUNT_U), NAMED(JOYBUS_RECV_COUNT_L), NAMED(PIF_CHECKSUM),
+    NAMED(PIF_CHECKSUM_END),    NAMED(JOYBUS_STATUS),       NAMED(JOYBUS_STATUS_END),
+    NAMED(SAVE_SBL),            NAMED(BOOT_TIMER),          NAMED(BOOT_TIMER_END),
+    NAMED(SAVE_A),              NAMED(SAVE_SBM),            NAMED(SAVE_X),
+    NAMED(SAVE_C),              NAMED(STATUS),              NAMED(CIC_COMPARE_LO),
+    NAMED(CIC_COMPARE_LO_END),  NAMED(CIC_COMPARE_HI),      NAMED(CIC_COMPARE_HI_END),
+    NAMED(RAM_EXTERNAL),        NAMED(CIC_CHALLENGE_COUNT_OUT), NAMED(CIC_CHALLENGE_COUNT_IN),
+    NAMED(CIC_CHALLENGE_LO),    NAMED(CIC_CHALLENGE_HI),    NAMED(PIF_CMD_U),
+    NAMED(PIF_CMD_L),
+};
+
+const namedValue portNames[] = {
+    NAMED(PORT_JOYBUS_WRITE),  NAMED(PORT_JOYBUS_READ), NAMED(PORT_JOYBUS_CTRL),
+    NAMED(PORT_JOYBUS_STATUS), NAMED(PORT_JOYBUS_ERROR), NAMED(PORT_CIC),
+    NAMED(PORT_ROM),           NAMED(PORT_RCP_XFER),    NAMED(PORT_RESET),
+    NAMED(PORT_RNG),           NAMED(PORT_JOYBUS_CHANNEL), NAMED(REG_INT_EN),
+};
+
+bool findNamed(const namedValue* names, size_t count, const char* name, unsigned* value) {
+  for (size_t i = 0; i < count; ++i) {
+    if (!strcmp(names[i].name, name)) {
+      *value = names[i].value;
+      return true;
+    }
+  }
+  return false;
+}
+
+// name or hex number, with an optional +offset
+bool watchValue(const namedValue* names, size_t count, const char* spec, unsigned* value) {
+  char name[64];
+  unsigned offset = 0;
+  const char* plus = strchr(spec, '+');
+  size_t len = plus ? (size_t)(plus - spec) : strlen(spec);
+  if (len >= sizeof(name) || (plus && 1 != sscanf(plus + 1, "%x", &offset)))
+    return false;
+  memcpy(name, spec, len);
+  name[len] = 0;
+
+  char* end;
+  *value = strtoul(name, &end, 16);
+  if (!len || *end) {
+    if (!findNamed(names, count, name, value))
+      return false;
+  }
+  *value += offset;
+  return true;
+}
+
+// the RAM name at or below address, for reports
+void ramName(u8 address, char* text) {
+  const namedValue* best = NULL;
+  for (size_t i = 0; i < sizeof(ramNames) / sizeof(ramNames[0]); ++i) {
+    const namedValue* n = &ramNames[i];
+    if (n->value <= address && !strstr(n->name, "_END") && (!best || n->value > best->value))
+      best = n;
+  }
+  if (best->value == address)
+    sprintf(text, "%s", best->name);
+  else
+    sprintf(text, "%s+%x", best->name, address - best->value);
+}
+
+void watchPC(u16 pc, char* text) {
+  if (pc == WATCH_HARNESS)
+    sprintf(text, "harness");
+  else
+    sprintf(text, "%02x:%02x", pc >> 6, pc & 0x3f);
+}
+
+// A write seen where it happens is in one routine; one through a pointer is
+// seen at the next routine entry, so it is between two.
+void watchHit(u8 address, u8 from, u8 to, u16 before, u16 after) {
+  char name[64], a[16], b[16];
+  ramName(address, name);
+  watchPC(before, a);
+  watchPC(after, b);
+  if (before == after)
+    printf("watch %s (%02x) %x -> %x in %s, cycle %llu\n", name, address, from, to, a,
+           (unsigned long long)cycles);
+  else
+    printf("watch %s (%02x) %x -> %x after %s before %s, cycle %llu\n", name, address, from, to, a, b,
+           (unsigned long long)cycles);
+}
+
+void watchRead(u8 address, u8 value, u16 pc) {
+  char name[64], a[16];
+  ramName(address, name);
+  watchPC(pc, a);
+  printf("watch r %s (%02x) %x in %s, cycle %llu\n", name, address, value, a, (unsigned long long)cycles);
+}
+
+void watchPort(const char* kind, u8 port, u8 value) {
+  const char* name = "port";
+  for (size_t i = 0; i < sizeof(portNames) / sizeof(portNames[0]); ++i) {
+    if (portNames[i].value == port)
+      name = portNames[i].name;
+  }
+  printf("watch %s %s (%x) %x, cycle %llu\n", kind, name, port, value, (unsigned long long)cycles);
+}
+
+void watchArm(const char* spec, bool write) {
+  unsigned first, last;
+  bool port = findNamed(portNames, sizeof(portNames) / sizeof(portNames[0]), spec, &first) ||
+              1 == sscanf(spec, "port%x", &first);
+  if (port) {
+    if (first > 0xf) {
+      printf("bad port %s\n", spec);
+      exit(4);
+    }
+    if (write)
+      watchWritePorts |= BIT(first);
+    else
+      watchReadPorts |= BIT(first);
+    return;
+  }
+#ifndef WATCH_READS
+  if (!write) {
+    printf("-r %s: RAM read watchpoints need cmodel_watch\n", spec);
+    exit(4);
+  }
+#endif
+
+  char name[64];
+  const char* colon = strchr(spec, ':');
+  size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+  snprintf(name, sizeof(name), "%.*s", (int)len, spec);
+  size_t count = sizeof(ramNames) / sizeof(ramNames[0]);
+  if (!watchValue(ramNames, count, name, &first)) {
+    printf("unknown watch %s\n", spec);
+    exit(4);
+  }
+  last = first + 1;
+  if (colon) {
+    if (!watchValue(ramNames, count, colon + 1, &last)) {
+      printf("unknown watch %s\n", spec);
+      exit(4);
+    }
+  } else {
+    char end[80];
+    snprintf(end, sizeof(end), "%s_END", name);
+    findNamed(ramNames, count, end, &last);
+  }
+  if (first > 0xff || last > 0x100 || last <= first) {
+    printf("bad watch range %s\n", spec);
+    exit(4);
+  }
+
+  u64* mask = write ? watch.mask : watch.readMask;
+  for (unsigned a = first; a < last; ++a)
+    mask[a / 64] |= 1ull << (a % 64);
+  watch.hit = watchHit;
+  watch.read = watchRead;
+  memcpy(watch.last, ram, sizeof(watch.last));
+  watch.armed = 1;
+}
+
+typedef struct {
+  u64 entries;
+  u64 cycles;  // modeled
+  uint64_t perf[PERF_COUNTERS];
+} phaseTotal;
+
+phaseTotal phaseTotals[PHASE_KINDS];
+uint64_t phaseLast[PERF_COUNTERS];
+u64 phaseCycles;
+
+// charge what the counters moved since the last change to phase from
+void phaseCount(u8 from) {
+  uint64_t now[PERF_COUNTERS];
+  perfRead(&phasePerf, now);
+  for (int i = 0; i < PERF_COUNTERS; ++i) {
+    phaseTotals[from].perf[i] += now[i] - phaseLast[i];
+    phaseLast[i] = now[i];
+  }
+  phaseTotals[from].cycles += cycles - phaseCycles;
+  phaseCycles = cycles;
+}
+
+void phaseCounted(u8 from, u8 to) {
+  phaseCount(from);
+  if (from != PHASE_INTERRUPT_A)  // not a return to the interrupted phase
+    ++phaseTotals[to].entries;
+}
+
+// host counters by firmware phase, at exit; - for counters the host lacks
+void writePhases(void) {
+  phaseCount(phase);
+  perfClose(&phasePerf);
+  FILE* f = fopen(phasePath, "w");
+  if (!f)
+    return;
+
+  fprintf(f, "# %-14s %10s %12s", "phase", "entries", "model");
+  for (int i = 0; i < PERF_COUNTERS; ++i)
+    fprintf(f, " %14s", perfNames[i]);
+  fprintf(f, " %6s\n", "ipc");
+  for (int n = 0; n < PHASE_KINDS; ++n) {
+    const phaseTotal* t = &phaseTotals[n];
+    fprintf(f, "  %-14s %10llu %12llu", phaseNames[n], (unsigned long long)t->entries,
+            (unsigned long long)t->cycles);
+    for (int i = 0; i < PERF_COUNTERS; ++i) {
+      if (phasePerf.fd[i] < 0 && !t->perf[i])
+        fprintf(f, " %14s", "-");
+      else
+        fprintf(f, " %14llu", (unsigned long long)t->perf[i]);
+    }
+    if (t->perf[PERF_CYCLES])
+      fprintf(f, " %6.2f\n", (double)t->perf[PERF_INSTRUCTIONS] / t->perf[PERF_CYCLES]);
+    else
+      fprintf(f, " %6s\n", "-");
+  }
+  fclose(f);
 }
 
 int main(int argc, char* argv[]) {
-  if (argc > 1) {
-    input = fopen(argv[1], "r");
+  int opt;
+  while ((opt = getopt(argc, argv, "qc:v:s:pl:P:C:r:w:j:")) != -1) {
+    switch (opt) {
+      case 'q':
+        quiet = 1;
+        break;
+      case 'c':
+        coveragePath = optarg;
+        atexit(writeCoverage);
+        break;
+      case 'v':
+        waveOpen(optarg);
+        break;
+      case 's':
+        serverName = optarg;
+        break;
+      case 'p':
+        serverPoll = 1;
+        break;
+      case 'l':
+        latencyPath = optarg;
+        latency = &traceLatency;
+        atexit(writeLatency);
+        break;
+      case 'P':
+#ifdef CMODEL_ROM
+        printf("no firmware phases with the recompiled ROM\n");
+        exit(4);
+#else
+        if (!perfOpen(&phasePerf)) {
+          printf("cannot open perf counters: %s\n", strerror(errno));
+          exit(4);
+        }
+        phasePath = optarg;
+        phaseChange = phaseCounted;
+        phaseTotals[phase].entries = 1;
+        atexit(writePhases);
+        break;
+#endif
+      case 'r':
+      case 'w':
+        watchArm(optarg, opt == 'w');
+        break;
+      case 'j':
+        journalPath = optarg;
+        break;
+      case 'C':
+#ifdef CMODEL_ROM
+        printf("no high-level CIC with the recompiled ROM\n");
+        exit(4);
+#else
+        // the trace then holds no CIC port traffic
+        hleCIC = cicHleCreate(atoi(optarg));
+        if (!hleCIC) {
+          printf("unknown cic %s\n", optarg);
+          exit(4);
+        }
+        break;
+#endif
+      default:
+        printf("usage: %s [-q] [-c coverage-file] [-v vcd-file] [-l latency-file] [-P perf-file] [-s shm-name [-p]] [-C cic]\n"
+               "       [-r watch] [-w watch] [-j journal-file] [trace]\n",
+               argv[0]);
+        exit(4);
+    }
+  }
+
+  if (serverName) {
+    server = ringCreate(serverName, serverPoll);
+    if (!server) {
+      printf("cannot create %s\n", serverName);
+      exit(4);
+    }
+    atexit(serverClose);
+  } else if (optind < argc) {
+    input = fopen(argv[optind], "r");
   } else {
     input = stdin;
   }
+  if (journalPath) {
+    if (!journalOpen(journalPath)) {
+      printf("cannot create %s\n", journalPath);
+      exit(4);
+    }
+    atexit(journalClose);
+  }
   readRegion();
   start();
 }
+
+#endif  // CMODEL_LIB
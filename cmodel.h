@@ -3,6 +3,8 @@
 
 typedef uint8_t u8;
 typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
 
 typedef struct {
   u8 l : 4;
@@ -28,8 +30,14 @@ typedef struct {
   r4 re;
 } rfile;
 
-rfile r;
-r4 ram[256];
+// Model state is per thread when built with -DMODEL_TLS=_Thread_local, so
+// several models can run side by side on their own threads (see cosim.c).
+#ifndef MODEL_TLS
+#define MODEL_TLS
+#endif
+
+extern MODEL_TLS rfile r;
+extern MODEL_TLS r4 ram[256];
 
 #define A r.a.l
 #define X r.x.l
@@ -45,12 +53,106 @@ r4 ram[256];
 #define IFB r.ifb
 #define RE r.re.l
 
-#define RAM(i) ram[(i)&0xff].l
+// Execution counts per ROM address ($pu:pl). Each modeled routine counts its
+// own entry; the harness writes the non-zero counts out with -c.
+extern MODEL_TLS u32 romHits[0x1000];
+
+// cover.c, for the harnesses: at exit, merge romHits into the file at
+// coveragePath, one "pu:pl count" line per executed address.
+extern const char* coveragePath;
+void writeCoverage(void);
+
+// Watchpoints on RAM nibbles. While armed, RAM_SET() goes through
+// ramWrite(): a write changing a nibble set in mask tells hit the address,
+// old and new value, and the ROM address ($pu:pl) of the routine making it,
+// as before and after. COVER() also compares the masked nibbles with their
+// last values, for the few kernels writing RAM through pointers
+// (compareRound()): hit then gets the ROM addresses around the write.
+// scanned, if set, is called after every scan (see journal.h). Harnesses can
+// scan too, passing WATCH_HARNESS. Disarmed, a run costs one test per RAM
+// write and routine entry.
+//
+// Read watchpoints (readMask, read) would add a test to every RAM read, so
+// only a -DWATCH_READS build has them: there RAM() goes through ramRead().
+typedef struct {
+  bool armed;
+  u64 mask[4];
+  u64 readMask[4];
+  r4 last[256];
+  u16 pc;  // where the last scan was
+  void (*hit)(u8 address, u8 from, u8 to, u16 before, u16 after);
+  void (*read)(u8 address, u8 value, u16 pc);
+  void (*scanned)(u16 pc);
+} watchState;
+
+enum {
+  WATCH_HARNESS = 0xffff,
+};
+
+extern MODEL_TLS watchState watch;
+
+static inline bool watchBit(const u64* mask, u8 a) {
+  return mask[a / 64] >> (a % 64) & 1;
+}
+
+#ifdef WATCH_READS
+static inline u8 ramRead(u8 a) {
+  if (watchBit(watch.readMask, a))
+    watch.read(a, ram[a].l, watch.pc);
+  return ram[a].l;
+}
+#endif
+
+static inline void ramWrite(u8 a, u8 value) {
+  bool watched = watchBit(watch.mask, a);
+  u8 from = ram[a].l;
+  if (watched && from != watch.last[a].l)  // written through a pointer since
+    watch.hit(a, watch.last[a].l, from, watch.pc, watch.pc);
+  ram[a].l = value;
+  watch.last[a].l = ram[a].l;
+  if (watched && ram[a].l != from)
+    watch.hit(a, from, ram[a].l, watch.pc, watch.pc);
+}
+
+// RAM() reads a nibble, RAM_SET() writes one, keeping its low 4 bits.
+#ifdef WATCH_READS
+#define RAM(i) (watch.armed ? ramRead((i)&0xff) : ram[(i)&0xff].l)
+#else
+#define RAM(i) (ram[(i)&0xff].l)
+#endif
+#define RAM_SET(i, v) (watch.armed ? ramWrite((i)&0xff, (v)) : (void)(ram[(i)&0xff].l = (v)))
+
+// RAM(i) += n, returning the new nibble
+static inline u8 ramAdd(u8 a, u8 n) {
+  RAM_SET(a, RAM(a) + n);
+  return RAM(a);
+}
+
+static inline void watchScan(u16 pc) {
+  // nibbles are stored alone in their bytes, so RAM compares as a whole
+  if (__builtin_memcmp(ram, watch.last, sizeof(watch.last))) {
+    for (int w = 0; w < 4; ++w) {
+      for (u64 bits = watch.mask[w]; bits; bits &= bits - 1) {
+        u8 a = w * 64 + __builtin_ctzll(bits);
+        if (ram[a].l != watch.last[a].l) {
+          watch.hit(a, watch.last[a].l, ram[a].l, watch.pc, pc);
+          watch.last[a].l = ram[a].l;
+        }
+      }
+    }
+  }
+  watch.pc = pc;
+  if (watch.scanned)
+    watch.scanned(pc);
+}
+
+#define COVER(pu, pl) \
+  (++romHits[(pu) << 6 | (pl)], watch.armed ? watchScan((pu) << 6 | (pl)) : (void)0)
 
 #define BIT(i) (1 << (i))
 
-#define RAM_BIT_RESET(a, b) (RAM(a) &= ~BIT(b))
-#define RAM_BIT_SET(a, b) (RAM(a) |= BIT(b))
+#define RAM_BIT_RESET(a, b) RAM_SET(a, RAM(a) & ~BIT(b))
+#define RAM_BIT_SET(a, b) RAM_SET(a, RAM(a) | BIT(b))
 #define RAM_BIT_TEST(a, b) (RAM(a) & BIT(b))
 
 #define SWAP(a, b) \
@@ -60,7 +162,24 @@ r4 ram[256];
     b = c;         \
   } while (0)
 
-#define SPIN(n)
+// SWAP() with RAM nibble i
+#define RAM_SWAP(a, i) \
+  do {                 \
+    u8 c = a;          \
+    a = RAM(i);        \
+    RAM_SET(i, c);     \
+  } while (0)
+
+// Modeled time in SM5 cycles. SPIN(n) and port accesses advance it; the rest
+// of the model is free. Harnesses charge IO_CYCLES per readIO/writeIO, for
+// the LBLX selecting the port plus the IN/OUT itself.
+extern MODEL_TLS u64 cycles;
+
+enum {
+  IO_CYCLES = 2,
+};
+
+#define SPIN(n) (cycles += (n))
 
 u8 readIO(u8 port);
 void writeIO(u8 port, u8 value);
@@ -1,47 +1,40 @@
 #include "cmodel.h"
+#include "cmodel_cic.h"
+#ifndef CMODEL_ROM
+#include "cmodel_compare.h"
+#endif
+#include "journal.h"
 
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-bool regionPAL = 0;
-bool challenge = 0;
-const u8* romSecret = NULL;
+MODEL_TLS rfile r;
+MODEL_TLS r4 ram[256];
+MODEL_TLS u32 romHits[0x1000];
+MODEL_TLS watchState watch;
+MODEL_TLS u64 cycles;
 
-const u8 romNTSC[] = {
-    0x19, 0x4a, 0xf1, 0x88, 0xb5, 0x5a, 0x71,
-    0xc3, 0xde, 0x61, 0x10, 0xed, 0x9e, 0x8c,
-};
-
-const u8 romPAL[] = {
-    0x14, 0x2f, 0x35, 0xf1, 0x82, 0x21, 0x77,
-    0x11, 0x99, 0x88, 0x15, 0x17, 0x55, 0xca,
-};
-
-const u8 rom6101[] = {
-    0x3f, 0x3f, 0x45, 0xcc, 0x73, 0xee, 0x31, 0x7a,
-};
-
-const u8 rom7102[] = {
-    0x3f, 0x3f, 0x44, 0x16, 0x0e, 0xc5, 0xd9, 0xaf,
-};
+MODEL_TLS bool regionPAL = 0;
+MODEL_TLS bool challenge = 0;
+MODEL_TLS const u8* romSecret = NULL;
 
-const u8 rom6102[] = {
-    0x3f, 0x3f, 0xa5, 0x36, 0xc0, 0xf1, 0xd8, 0x59,
-};
+// TSF: bit of the secret ROM at address (0..0x3f, wrapping)
+bool secretBit(u8 address) {
+  return romSecret[(address >> 3) & 7] & BIT(7 - (address & 7));
+}
 
-const u8 rom6103[] = {
-    0x78, 0x78, 0x58, 0x6f, 0xd4, 0x70, 0x98, 0x67,
-};
+void start(void);
 
-const u8 rom6105[] = {
-    0x91, 0x91, 0x86, 0x18, 0xa4, 0x5b, 0xc2, 0xd3,
-};
+// With -DCMODEL_ROM the routines below come from the recompiled ROM image
+// instead (see recompiler.py), and only the secrets and harness are built here.
+#ifndef CMODEL_ROM
 
-const u8 rom6106[] = {
-    0x85, 0x85, 0x2b, 0xba, 0xd4, 0xe6, 0xeb, 0x74,
-};
+// the compare branch of cicLoop() for the region, picked in initCIC()
+MODEL_TLS void (*cicCompare)(void);
 
-void start(void);
 void signalError(void);
 void writeBit0(void);
 void writeBit(bool a);
@@ -59,6 +52,8 @@ void loadChecksum(void);
 void loadSecret(u8 b, u8 sb);
 void cicReset(void);
 void cicLoop(void);
+void cicCompareNTSC(void);
+void cicComparePAL(void);
 void cicCompareRound(u8 address);
 void start2(void);
 void prefixChecksum(void);
@@ -69,6 +64,7 @@ void cicChallengeExec6105(u8 a, u8 b);
 
 // 00:00
 void start(void) {
+  COVER(0x00, 0x00);
   writeIO(2, 1);
   if (readIO(2) & BIT(2)) {
     if (!readBitDelay()) {
@@ -102,17 +98,20 @@ void start(void) {
 
 // 01:02
 void signalError(void) {
+  COVER(0x01, 0x02);
   for (;;)
     fatalError();
 }
 
 // 01:04
 void writeBit0(void) {
+  COVER(0x01, 0x04);
   writeBit(0);
 }
 
 // 01:06
 void writeBit(bool a) {
+  COVER(0x01, 0x06);
   while (readIO(2) & BIT(1))
     ;
 
@@ -126,6 +125,7 @@ void writeBit(bool a) {
 
 // 01:12
 bool readBit(void) {
+  COVER(0x01, 0x12);
   writeIO(0xf, 0);
 
   while (readIO(2) & BIT(1))
@@ -136,6 +136,7 @@ bool readBit(void) {
 
 // 01:1B
 bool readBitTail(void) {
+  COVER(0x01, 0x1b);
   bool c = readIO(2) & BIT(0);
 
   writeIO(0xf, 1);
@@ -148,7 +149,8 @@ bool readBitTail(void) {
 
 // 01:26
 bool loadSecretBit(u8* sb) {
-  bool c = romSecret[(*sb >> 3) & 7] & BIT(7 - (*sb & 7));
+  COVER(0x01, 0x26);
+  bool c = secretBit(*sb);
 
   if (!++*sb)
     *sb = 0xf0;
@@ -158,6 +160,7 @@ bool loadSecretBit(u8* sb) {
 
 // 01:32
 bool readBitDelay(void) {
+  COVER(0x01, 0x32);
   writeIO(0xf, 0);
 
   while (readIO(2) & BIT(1))
@@ -170,7 +173,8 @@ bool readBitDelay(void) {
 
 // 02:00
 void readNibble(u8 b) {
-  RAM(b) = 0xf;
+  COVER(0x02, 0x00);
+  RAM_SET(b, 0xf);
   if (!readBit())
     RAM_BIT_RESET(b, 3);
   if (!readBit())
@@ -183,6 +187,7 @@ void readNibble(u8 b) {
 
 // 02:0F
 void writeNibble(u8 b) {
+  COVER(0x02, 0x0f);
   writeBit(RAM_BIT_TEST(b, 3));
   writeBit(RAM_BIT_TEST(b, 2));
   writeBit(RAM_BIT_TEST(b, 1));
@@ -191,6 +196,7 @@ void writeNibble(u8 b) {
 
 // 02:20
 void cicEncodeChecksum(u8 b) {
+  COVER(0x02, 0x20);
   cicEncode(b);
   cicEncode(b);
   cicEncode(b);
@@ -199,32 +205,37 @@ void cicEncodeChecksum(u8 b) {
 
 // 02:2B
 void cicEncode(u8 b) {
+  COVER(0x02, 0x2b);
   for (; (b & 0xf) != 0xf; ++b)
-    RAM(b + 1) += RAM(b) + 1;
+    RAM_SET(b + 1, RAM(b + 1) + RAM(b) + 1);
 }
 
 // 02:2F
 void cicEncodeSeed(void) {
-  RAM(0x0a) = 0xb;
-  RAM(0x0b) = 5;
+  COVER(0x02, 0x2f);
+  RAM_SET(0x0a, 0xb);
+  RAM_SET(0x0b, 5);
   cicEncode(0x0a);
   cicEncode(0x0a);
 }
 
 // 03:00
 void loadSeed(void) {
+  COVER(0x03, 0x00);
   loadSecret(0x0c, 0x40);
 }
 
 // 03:06
 void loadChecksum(void) {
+  COVER(0x03, 0x06);
   loadSecret(0x04, 0x50);
 }
 
 // 03:0B
 void loadSecret(u8 b, u8 sb) {
+  COVER(0x03, 0x0b);
   do {
-    RAM(b) = 0xf;
+    RAM_SET(b, 0xf);
     if (!loadSecretBit(&sb))
       RAM_BIT_RESET(b, 3);
     if (!loadSecretBit(&sb))
@@ -238,23 +249,25 @@ void loadSecret(u8 b, u8 sb) {
 
 // 03:1F
 void cicReset(void) {
-  RAM(0x00) = 0;
-  RAM(0x10) = 0;
+  COVER(0x03, 0x1f);
+  RAM_SET(0x00, 0);
+  RAM_SET(0x10, 0);
   u8 a = 0;
 
   do {
     for (u8 x = 0; x < 0x10; ++x)
       nop3();
-  } while ((++a & 0xf) || ++RAM(0x00) || ++RAM(0x10));
+  } while ((++a & 0xf) || ramAdd(0x00, 1) || ramAdd(0x10, 1));
 
   // undo final increment
-  RAM(0x10)--;
+  ramAdd(0x10, -1);
 
   writeBit0();
 }
 
 // 04:0E
 void cicLoop(void) {
+  COVER(0x04, 0x0e);
   for (;;) {
     if (readBit()) {
       if (!readBit())
@@ -265,77 +278,61 @@ void cicLoop(void) {
       if (readBit())
         signalError();
 
-      cicCompareRound(0x00);
-      cicCompareRound(0x00);
-      cicCompareRound(0x00);
-      cicCompareRound(0x10);
-      cicCompareRound(0x10);
-      cicCompareRound(0x10);
-
-      u8 b = RAM(0x17);
-      if (!b)
-        b = 1;
-
-      do {
-        bool c = readBit();
-        writeBit(RAM_BIT_TEST(0x10 + b, 0));
-        if (c != RAM_BIT_TEST(0x00 + b, 0))
-          signalError();
-
-        b += regionPAL ? -1 : +1;
-      } while (b & 0xf);
+      cicCompare();
     }
   }
 }
 
+// the compare branch of cicLoop()
+static inline void cicCompareRegion(bool pal) {
+  cicCompareRound(0x00);
+  cicCompareRound(0x00);
+  cicCompareRound(0x00);
+  cicCompareRound(0x10);
+  cicCompareRound(0x10);
+  cicCompareRound(0x10);
+
+  u8 b = RAM(0x17);
+  if (!b)
+    b = 1;
+
+  do {
+    bool c = readBit();
+    writeBit(RAM_BIT_TEST(0x10 + b, 0));
+    if (c != RAM_BIT_TEST(0x00 + b, 0))
+      signalError();
+
+    b += COMPARE_STEP(pal);
+  } while (b & 0xf);
+}
+
+void cicCompareNTSC(void) {
+  cicCompareRegion(0);
+}
+
+void cicComparePAL(void) {
+  cicCompareRegion(1);
+}
+
 // 05:00
 void cicCompareRound(u8 address) {
-  for (u8 x = RAM(address + 0xf); x < 0x10; --x) {
-    u8 a = x;
-    u8 b = address + 1;
-    a += RAM(b) + 1;
-    RAM(b) = a;
-    ++b;
-    a += RAM(b) + 1;
-    a = ~a;
-    SWAP(a, RAM(b));
-    ++b;
-    bool Cy = (a & 0xf) + RAM(b) + 1 >= 0x10;
-    a += RAM(b) + 1;
-    if (!Cy) {
-      SWAP(a, RAM(b));
-      ++b;
-    }
-    a += RAM(b);
-    RAM(b) = a;
-    ++b;
-    a += RAM(b);
-    SWAP(a, RAM(b));
-    ++b;
-    Cy = (a & 0xf) + 8 >= 0x10;
-    a += 8;
-    if (!Cy)
-      a += RAM(b);
-    SWAP(a, RAM(b));
-    ++b;
-    do {
-      a += RAM(b) + 1;
-      RAM(b) = a;
-    } while (++b & 0xf);
-  }
+  COVER(0x05, 0x00);
+  compareRound(&ram[address]);
 }
 
 // 06:00
 void start2(void) {
-  RAM(0x00) = 0;
-  RAM(0x11) = 0xb;
+  COVER(0x06, 0x00);
+  RAM_SET(0x00, 0);
+  RAM_SET(0x11, 0xb);
   u8 b = 0x02;
 
   do {
-    u8 a = RAM(0x00)++;
+    u8 a = RAM(0x00);
+    RAM_SET(0x00, a + 1);
     u8 byte = (regionPAL ? romPAL : romNTSC)[a];
-    RAM(b) = byte & 0xf;
-    RAM(b ^ 0x10) = byte >> 4;
+    RAM_SET(b, byte & 0xf);
+    RAM_SET(b ^ 0x10, byte >> 4);
   } while (++b & 0xf);
 
   readNibble(0x01);
@@ -346,6 +343,7 @@ void start2(void) {
 
 // 06:22
 void prefixChecksum(void) {
+  COVER(0x06, 0x22);
   u8 a = 0, x = 0;  // todo: incoming values?
   SWAP(a, x);
 
@@ -355,31 +353,33 @@ void prefixChecksum(void) {
       if (++a & 0xf) {
         SWAP(a, x);
       } else {
-        SWAP(a, RAM(0x02));
+        RAM_SWAP(a, 0x02);
         if (++a & 0xf)
-          SWAP(a, RAM(0x02));
+          RAM_SWAP(a, 0x02);
       }
     }
   }
 
   a += RAM(0x02);
-  RAM(0x00) = a;
-  RAM(0x01) = x;
+  RAM_SET(0x00, a);
+  RAM_SET(0x01, x);
 }
 
 // 06:37
 void nop3(void) {
-  // nop x 3
+  COVER(0x06, 0x37);
+  SPIN(3);  // nop x 3
 }
 
 // 07:00
 void cicChallenge(void) {
+  COVER(0x07, 0x00);
   u8 b = 0x20;
-  RAM(0x20) = 0xa;
+  RAM_SET(0x20, 0xa);
   writeNibble(b);
   writeNibble(b);
 
-  for (u8 x = 0; x < 0x20; ++x) {
+  for (u8 x = 0; x < CIC_CHALLENGE_NIBBLES; ++x) {
     readNibble(b);
     ++b;
   }
@@ -388,7 +388,7 @@ void cicChallenge(void) {
   b = 0x20;
   writeBit0();
 
-  for (u8 x = 0; x < 0x20; ++x) {
+  for (u8 x = 0; x < CIC_CHALLENGE_NIBBLES; ++x) {
     writeNibble(b);
     ++b;
   }
@@ -396,13 +396,14 @@ void cicChallenge(void) {
 
 // 07:2C
 void cicChallengeExec(void) {
+  COVER(0x07, 0x2c);
   u8 b = 0x20;
 
   if (challenge) {
     cicChallengeExec6105(5, b);
   } else {
-    for (u8 x = 0; x < 0x20; ++x) {
-      RAM(b) ^= 0xf;
+    for (u8 x = 0; x < CIC_CHALLENGE_NIBBLES; ++x) {
+      RAM_SET(b, RAM(b) ^ 0xf);
       ++b;
     }
   }
@@ -410,90 +411,98 @@ void cicChallengeExec(void) {
 
 // 09:00
 void cicChallengeExec6105(u8 a, u8 b) {
-  bool c = 1;
-
-  for (u8 x = 0; x < 0x20; ++x) {
-    u8 y = a + RAM(b);
-    if (!RAM_BIT_TEST(b, 0))
-      y += 8;
-    if (!(a & BIT(1)))
-      y += 4;
-    u8 z = y + y;
-    if (!c)
-      z += 7;
-    a = (y & 0xf) + (z & 0xf) + c;
-    c = a & 0x10;
-    a = ~a;
-    RAM(b) = a;
-    ++b;
-  }
+  COVER(0x09, 0x00);
+  challenge6105(&ram[b], a, CIC_CHALLENGE_NIBBLES);
 }
 
 // end CIC ROM
 
-FILE* input;
+#endif  // CMODEL_ROM
 
+// Select the secrets and region of a CIC part number.
 bool initCIC(int cic) {
   regionPAL = 0;
   challenge = 0;
   romSecret = NULL;
 
-  switch (cic) {
-    case 6101:
-      romSecret = rom6101;
-      break;
-    case 7102:
-      regionPAL = 1;
-      romSecret = rom7102;
-      break;
-    case 6102:
-      romSecret = rom6102;
-      break;
-    case 7101:
-      regionPAL = 1;
-      romSecret = rom6102;
-      break;
-    case 6103:
-      romSecret = rom6103;
-      break;
-    case 7103:
-      regionPAL = 1;
-      romSecret = rom6103;
-      break;
-    case 6105:
-      challenge = 1;
-      romSecret = rom6105;
-      break;
-    case 7105:
-      regionPAL = 1;
-      challenge = 1;
-      romSecret = rom6105;
-      break;
-    case 6106:
-      romSecret = rom6106;
-      break;
-    case 7106:
-      regionPAL = 1;
-      romSecret = rom6106;
-      break;
-    default:
-      return false;
-  }
+  const cicPart* part = findCicPart(cic);
+  if (!part)
+    return false;
+  regionPAL = part->pal;
+  challenge = part->challenge;
+  romSecret = part->secret;
 
+#ifndef CMODEL_ROM
+  cicCompare = regionPAL ? cicComparePAL : cicCompareNTSC;
+#endif
   return true;
 }
 
-int scanValue(void) {
+// Everything below is the trace replay harness. Build with -DCMODEL_LIB to
+// link the model against a different one.
+#ifndef CMODEL_LIB
+
+FILE* input;
+bool quiet = 0;
+const char* journalPath = NULL;
+
+enum {
+  EXPECT_FAILED = 5,
+};
+
+void echo(const char* format, ...) {
+  if (quiet)
+    return;
+
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+}
+
+void skipComments(void) {
   // remove comments before next token
   int num;
   do {
     num = 0;
-    fscanf(input, " #%n%*[^\n]", &num);
+    fscanf(input, " #%n%*[^\n] ", &num);
   } while (num > 0);
+}
+
+// As in cmodel, "=w <port> <value>" between tokens checks the next writeIO.
+// A read (port < 0) must not find one, since the model wasn't going to
+// write there.
+void expectWrite(int port, int value) {
+  skipComments();
+
+  int next = fgetc(input);
+  if (next != '=') {
+    ungetc(next, input);
+    return;
+  }
+
+  char kind[8];
+  unsigned expectPort, expectValue;
+  if (3 != fscanf(input, "%7s %x %x", kind, &expectPort, &expectValue) || strcmp(kind, "w")) {
+    printf("unrecognized expectation\n");
+    exit(4);
+  }
+  if (port < 0) {
+    printf("expect failed: w %x %x, but model is reading\n", expectPort, expectValue);
+    exit(EXPECT_FAILED);
+  }
+  if (port != (int)expectPort || value != (int)expectValue) {
+    printf("expect failed: w %x %x, expected w %x %x\n", port, value, expectPort, expectValue);
+    exit(EXPECT_FAILED);
+  }
+}
+
+int scanValue(void) {
+  expectWrite(-1, 0);
 
   int next = fgetc(input);
   if (next == 'q') {
-    printf("  %c\n", next);
+    echo("  %c\n", next);
     exit(0);
   }
   ungetc(next, input);
@@ -507,9 +516,9 @@ int scanValue(void) {
 }
 
 void readCIC(void) {
-  printf("r cic\n");
+  echo("r cic\n");
   int value = scanValue();
-  printf("  %x\n", value);
+  echo("  %x\n", value);
   if (!initCIC(value)) {
     printf("unknown cic\n");
     exit(4);
@@ -517,14 +526,21 @@ void readCIC(void) {
 }
 
 u8 readIO(u8 port) {
-  printf("r %x\n", port);
+  cycles += IO_CYCLES;
+  echo("r %x\n", port);
   int value = scanValue();
-  printf("  %x\n", value);
+  echo("  %x\n", value);
+  if (journalPath)
+    journalPort(0, port, value);
   return value & 0xf;
 }
 
 void writeIO(u8 port, u8 value) {
-  printf("w %x %x\n", port, value);
+  cycles += IO_CYCLES;
+  echo("w %x %x\n", port, value);
+  expectWrite(port, value);
+  if (journalPath)
+    journalPort(1, port, value);
 }
 
 void fatalError(void) {
@@ -533,11 +549,39 @@ void fatalError(void) {
 }
 
 int main(int argc, char* argv[]) {
-  if (argc > 1) {
-    input = fopen(argv[1], "r");
+  int opt;
+  while ((opt = getopt(argc, argv, "qc:j:")) != -1) {
+    switch (opt) {
+      case 'q':
+        quiet = 1;
+        break;
+      case 'c':
+        coveragePath = optarg;
+        atexit(writeCoverage);
+        break;
+      case 'j':
+        journalPath = optarg;
+        break;
+      default:
+        printf("usage: %s [-q] [-c coverage-file] [-j journal-file] [trace]\n", argv[0]);
+        exit(4);
+    }
+  }
+
+  if (optind < argc) {
+    input = fopen(argv[optind], "r");
   } else {
     input = stdin;
   }
   readCIC();
+  if (journalPath) {
+    if (!journalOpen(journalPath)) {
+      printf("cannot create %s\n", journalPath);
+      exit(4);
+    }
+    atexit(journalClose);
+  }
   start();
 }
+
+#endif  // CMODEL_LIB
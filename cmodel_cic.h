@@ -0,0 +1,78 @@
+// CIC parts and their secrets, shared by the CIC model and the PIF model's
+// high-level CIC. Include after cmodel.h.
+
+#include <stddef.h>
+
+// The secret ROM (TSF) of each part: the seed in bytes 0..1, the checksum
+// in 2..7.
+static const u8 rom6101[] = {
+    0x3f, 0x3f, 0x45, 0xcc, 0x73, 0xee, 0x31, 0x7a,
+};
+
+static const u8 rom7102[] = {
+    0x3f, 0x3f, 0x44, 0x16, 0x0e, 0xc5, 0xd9, 0xaf,
+};
+
+static const u8 rom6102[] = {
+    0x3f, 0x3f, 0xa5, 0x36, 0xc0, 0xf1, 0xd8, 0x59,
+};
+
+static const u8 rom6103[] = {
+    0x78, 0x78, 0x58, 0x6f, 0xd4, 0x70, 0x98, 0x67,
+};
+
+static const u8 rom6105[] = {
+    0x91, 0x91, 0x86, 0x18, 0xa4, 0x5b, 0xc2, 0xd3,
+};
+
+static const u8 rom6106[] = {
+    0x85, 0x85, 0x2b, 0xba, 0xd4, 0xe6, 0xeb, 0x74,
+};
+
+typedef struct {
+  int type;
+  bool pal;
+  bool challenge;  // answers the challenge with challenge6105()
+  const u8* secret;
+} cicPart;
+
+static const cicPart cicParts[] = {
+    {6101, 0, 0, rom6101}, {7102, 1, 0, rom7102}, {6102, 0, 0, rom6102}, {7101, 1, 0, rom6102},
+    {6103, 0, 0, rom6103}, {7103, 1, 0, rom6103}, {6105, 0, 1, rom6105}, {7105, 1, 1, rom6105},
+    {6106, 0, 0, rom6106}, {7106, 1, 0, rom6106},
+};
+
+// Nibbles of the challenge each way: 15 bytes, as the PIF sends them.
+enum {
+  CIC_CHALLENGE_NIBBLES = 0x1e,
+};
+
+// the part with this number, or NULL
+static inline const cicPart* findCicPart(int type) {
+  for (unsigned i = 0; i < sizeof(cicParts) / sizeof(cicParts[0]); ++i) {
+    if (cicParts[i].type == type)
+      return &cicParts[i];
+  }
+  return NULL;
+}
+
+// The 6105 answer to the challenge (CIC 09:00), in place on count nibbles:
+// the CIC model runs it on its RAM, the high-level CIC on what the PIF sent.
+static inline void challenge6105(r4* n, u8 a, u8 count) {
+  bool c = 1;
+
+  for (u8 x = 0; x < count; ++x) {
+    u8 y = a + n[x].l;
+    if (!(n[x].l & 1))
+      y += 8;
+    if (!(a & BIT(1)))
+      y += 4;
+    u8 z = y + y;
+    if (!c)
+      z += 7;
+    a = (y & 0xf) + (z & 0xf) + c;
+    c = a & 0x10;
+    a = ~a;
+    n[x].l = a;
+  }
+}
@@ -0,0 +1,102 @@
+// The CIC compare state machine, shared by both models and by the tools that
+// predict compare bits without running one. Include after cmodel.h.
+
+// The only non-code data in the PIF ROM, taken from 04:00. The CIC ROM has
+// the same table.
+static const u8 romNTSC[] = {
+    0x19, 0x4a, 0xf1, 0x88, 0xb5, 0x5a, 0x71,
+    0xc3, 0xde, 0x61, 0x10, 0xed, 0x9e, 0x8c,
+};
+static const u8 romPAL[] = {
+    0x14, 0x2f, 0x35, 0xf1, 0x82, 0x21, 0x77,
+    0x11, 0x99, 0x88, 0x15, 0x17, 0x55, 0xca,
+};
+
+// CIC_COMPARE_LO and CIC_COMPARE_HI
+typedef struct {
+  r4 lo[16];
+  r4 hi[16];
+} compareState;
+
+// One round of the compare pseudo-RNG on 16 nibbles, the same code in both
+// ROMs (PIF 0E:1B, CIC 05:00): the PIF runs it on CIC_COMPARE_LO/HI, the CIC
+// on RAM 00/10. It works on a plain copy, as the bitfield stores are slow.
+static inline void compareRound(r4* ram) {
+  u8 n[16];
+  for (int i = 0; i < 16; ++i)
+    n[i] = ram[i].l;
+
+  for (u8 x = n[0xf]; x < 0x10; --x) {
+    u8 a = x;
+    u8 b = 1;
+    a += n[b] + 1;
+    n[b] = a & 0xf;
+    ++b;
+    a += n[b] + 1;
+    a = ~a;
+    SWAP(a, n[b]);
+    n[b] &= 0xf;
+    ++b;
+    bool Cy = (a & 0xf) + n[b] + 1 >= 0x10;
+    a += n[b] + 1;
+    if (!Cy) {
+      SWAP(a, n[b]);
+      n[b] &= 0xf;
+      ++b;
+    }
+    a += n[b];
+    n[b] = a & 0xf;
+    ++b;
+    a += n[b];
+    SWAP(a, n[b]);
+    n[b] &= 0xf;
+    ++b;
+    Cy = (a & 0xf) + 8 >= 0x10;
+    a += 8;
+    if (!Cy)
+      a += n[b];
+    SWAP(a, n[b]);
+    n[b] &= 0xf;
+    ++b;
+    do {
+      a += n[b] + 1;
+      n[b] = a & 0xf;
+    } while (++b & 0xf);
+  }
+
+  for (int i = 0; i < 16; ++i)
+    ram[i].l = n[i];
+}
+
+// direction of the compare bit exchange
+#define COMPARE_STEP(pal) ((pal) ? -1 : +1)
+
+// cicCompareCreateSeed() and cicCompareExpandSeed(), seed being the 8-bit RNG
+// value (CIC_COMPARE_LO+8/+9)
+static inline void compareSeed(compareState* s, u8 seed, bool pal) {
+  for (int i = 0; i < 16; ++i)
+    s->lo[i].l = s->hi[i].l = 0;
+  s->lo[1].l = seed >> 4;
+  s->hi[1].l = seed;
+  for (u8 offset = 2; offset < 0x10; ++offset) {
+    u8 byte = (pal ? romPAL : romNTSC)[s->lo[0].l++];
+    s->lo[offset].l = byte;
+    s->hi[offset].l = byte >> 4;
+  }
+}
+
+// the rounds at the start of cicCompare()
+static inline void compareRounds(compareState* s) {
+  compareRound(s->lo);
+  compareRound(s->lo);
+  compareRound(s->lo);
+  compareRound(s->hi);
+  compareRound(s->hi);
+  compareRound(s->hi);
+}
+
+// first nibble exchanged by cicCompare(); the exchange runs up to 0xf (NTSC)
+// or down to 1 (PAL)
+static inline u8 compareOffset(const compareState* s) {
+  return s->hi[7].l ? s->hi[7].l : 1;
+}
@@ -0,0 +1,241 @@
+// PIF ports and internal RAM map, shared by the model and its harnesses.
+// Include after cmodel.h.
+
+#include "hist.h"
+
+enum {
+  PORT_JOYBUS_WRITE = 0,
+  PORT_JOYBUS_READ = 1,
+  PORT_JOYBUS_CTRL = 2,
+  PORT_JOYBUS_STATUS = 3,
+  PORT_JOYBUS_ERROR = 4,
+  PORT_CIC = 5,
+  PORT_ROM = 6,
+  PORT_RCP_XFER = 7,
+  PORT_RESET = 8,
+  PORT_RNG = 9,    // Used as a RNG, maybe it's an ADC?
+  PORT_JOYBUS_CHANNEL = 0xa,
+  REG_INT_EN = 0xe,
+
+  JOYBUS_STATUS_CLOCK = BIT(3),
+
+  JOYBUS_CTRL_WRITESTOPBIT = BIT(1),
+
+  JOYBUS_ERROR_RESET = 0,
+  JOYBUS_ERROR_NOANSWER = BIT(3),
+
+  INT_A_EN = BIT(0),
+  INT_B_EN = BIT(2),
+
+  ROM_LOCKOUT = BIT(0),
+
+  CIC_DATA_W = BIT(0),
+  CIC_CLOCK = BIT(1),
+  CIC_DATA_R = BIT(3),
+
+  RCP_XFER_READ = BIT(3),
+  RCP_XFER_64B = BIT(2),
+
+  RESET_CPU_IRQ = BIT(1),
+  RESET_CPU_NMI = BIT(0),
+  RESET_BUTTON = BIT(3),
+
+  RNG_START = BIT(0),
+  RNG_DATA = BIT(3),
+};
+
+enum {
+  JOYBUS_ADDR_L = 0x00,     // pointer to the start of the frame in external RAM for each joybus channel (low nibble)
+  JOYBUS_ADDR_U = 0x10,     // pointer to the start of the frame in external RAM for each joybus channel (high nibble)
+  CIC_CHALLENGE_TIMER_U = 0x0a,
+  CIC_CHALLENGE_TIMER_L = 0x0b,
+  RESET_TIMER = 0x0c,
+  RESET_TIMER_END = 0x10,
+  CIC_SEED_BUF = 0x1a,
+  CIC_SEED = 0x1c,
+  CIC_SEED_END = 0x20,
+  OSINFO = 0x1b,
+  OSINFO_RESET = 1,
+  OSINFO_VERSION = 2,
+  OSINFO_64DD = 3,
+  CIC_CHECKSUM_BUF = 0x20,
+  CIC_CHECKSUM = 0x24,
+  CIC_CHECKSUM_END = 0x30,
+  JOYBUS_SEND_COUNT_U = 0x22,
+  JOYBUS_SEND_COUNT_L = 0x23,
+  JOYBUS_SENDERR_NO_DEVICE = 8,
+  JOYBUS_SENDERR_TIMEOUT = 4,
+  PIF_CHECKSUM = 0x34,
+  PIF_CHECKSUM_END = 0x40,
+  JOYBUS_RECV_COUNT_U = 0x32,
+  JOYBUS_RECV_COUNT_L = 0x33,
+  JOYBUS_STATUS = 0x40,
+  JOYBUS_STATUS_RESET = 0,
+  JOYBUS_STATUS_SKIP = 3,
+  JOYBUS_STATUS_END = 0x46,
+  SAVE_SBL = 0x47,
+  BOOT_TIMER = 0x4a,
+  BOOT_TIMER_END = 0x50,
+  SAVE_A = 0x56,
+  SAVE_SBM = 0x57,
+  SAVE_X = 0x58,
+  SAVE_C = 0x59,
+  STATUS = 0x5e,
+  STATUS_CHALLENGE = 1,
+  STATUS_RUNNING = 3,
+  CIC_COMPARE_LO = 0x60,
+  CIC_COMPARE_LO_END = 0x70,
+  CIC_COMPARE_HI = 0x70,
+  CIC_COMPARE_HI_END = 0x80,
+  RAM_EXTERNAL = 0x80,
+  CIC_CHALLENGE_COUNT_OUT = 0xdd,
+  CIC_CHALLENGE_COUNT_IN = 0xdf,
+  CIC_CHALLENGE_LO = 0xe0,
+  CIC_CHALLENGE_HI = 0xf0,
+  PIF_CMD_U = 0xfe,
+  PIF_CMD_U_LOCKOUT = 0,
+  PIF_CMD_U_GET_CHECKSUM = 1,
+  PIF_CMD_U_CHECK_CHECKSUM = 2,
+  PIF_CMD_U_ACK = 3,
+  PIF_CMD_L = 0xff,
+  PIF_CMD_L_JOYBUS = 0,
+  PIF_CMD_L_CHALLENGE = 1,
+  PIF_CMD_L_2 = 2,
+  PIF_CMD_L_TERMINATE = 3,
+};
+
+// Latencies the model times in cycles, when a harness points latency at a
+// latencyStats:
+// - RCP transfers by kind, from interruptA() entry to the end of
+//   executeRCPTransfer(). The 64B read includes the joybus transfer, the
+//   challenge its wait for the main loop. Write4B and Write64B are one kind,
+//   as the ROM never reads which one it got.
+// - compare: one cicCompare() exchange.
+// - reset: interruptB() entry to the NMI pulse in cicReset().
+enum {
+  LATENCY_READ4,
+  LATENCY_READ64,
+  LATENCY_WRITE,
+  LATENCY_CHALLENGE,
+  LATENCY_COMPARE,
+  LATENCY_RESET,
+  LATENCY_KINDS,
+};
+
+static const char* const latencyNames[] = {
+    "read4", "read64", "write", "challenge", "compare", "reset",
+};
+
+typedef struct {
+  u64 start[LATENCY_KINDS];
+  u8 pending;  // BIT(kind) while timing it
+  hist h[LATENCY_KINDS];
+} latencyStats;
+
+// What the RCP last wrote to external PIF-RAM, one nibble per entry, and the
+// 4-byte blocks (bit n: bytes 4n..4n+3) where a write changed it since the
+// model last parsed the joybus commands. Harnesses store every RCP write
+// through externalWrite(). The model's own writes there (joybus responses,
+// the challenge, boot) don't touch the image.
+typedef struct {
+  u8 image[0x80];
+  u16 dirty;
+} externalWrites;
+
+extern MODEL_TLS externalWrites external;
+
+enum {
+  EXTERNAL_ALL = 0xffff,
+};
+
+static inline void externalWrite(u8 nibble, u8 value) {
+  nibble &= 0x7f;
+  value &= 0xf;
+  RAM_SET(RAM_EXTERNAL + nibble, value);
+  if (external.image[nibble] != value) {
+    external.image[nibble] = value;
+    external.dirty |= BIT(nibble >> 3);
+  }
+}
+
+// High-level CIC. When a harness points hleCIC at one, the model's CIC
+// routines hand it whole nibbles and messages instead of clocking bits
+// through PORT_CIC, which is then never touched. It plays the CIC ROM's side
+// from the part's secrets (cmodel_cic.h), except that the checksum goes out
+// behind a zero key where a real CIC times the PIF's clock pulse; the PIF
+// keeps that key in internal scratch RAM only. Traffic the CIC would not
+// expect halts it, as a real one stops in its error loop, and the PIF reads
+// ones from then on. In cic_hle.c, and not available with -DCMODEL_ROM.
+typedef struct cicHLE cicHLE;
+
+extern MODEL_TLS cicHLE* hleCIC;
+
+// NULL for an unknown part number
+cicHLE* cicHleCreate(int type);
+void cicHleDestroy(cicHLE* c);
+// FNV-1a of its state, for harnesses telling runs apart
+u64 cicHleHash(const cicHLE* c);
+
+// The model's side: each call stands in for the CIC port traffic of a
+// cmodel.c routine and charges the cycles it would have taken.
+enum {
+  // cycles of cicWriteBit() and cicReadBit(), also charged for the
+  // transactions below
+  CIC_WRITE_BIT_CYCLES = 2 * IO_CYCLES + 9,
+  CIC_READ_BIT_CYCLES = 3 * IO_CYCLES + 9,
+};
+
+u8 cicHleReadNibble(void);
+void cicHleWriteNibble(u8 value);
+void cicHlePulse(void);
+bool cicHleReadBit(void);
+u16 cicHleCompare(u8 first, u16 sent);
+void cicHleChallenge(void);
+bool cicHleReset(void);
+
+// Transaction-level I/O. When a harness points transactions at one, the
+// model hands it whole CIC nibbles and joybus messages, one call each,
+// instead of clocking them through the ports, and charges the cycles of the
+// port traffic they replace. A NULL hook leaves its traffic on the ports, as
+// a peer on the wires (cosim's CIC) needs the bits. Channel select, the
+// joybus resets and error handling, and the CIC compare, clock pulse and
+// reset stay on the ports. A high-level CIC takes precedence. Not available
+// with -DCMODEL_ROM.
+typedef struct {
+  void* user;
+  u8 (*cicReadNibble)(void* user);
+  void (*cicWriteNibble)(void* user, u8 value);
+  // The TX bytes of the selected channel's frame, stop bit included. Set
+  // both joybus hooks or neither.
+  void (*joybusSend)(void* user, const u8* buf, int n);
+  // Up to n bytes of the answer: how many came, or -1 if no device answered.
+  // PORT_JOYBUS_ERROR reads as it would after the same transfer on the ports.
+  int (*joybusRecv)(void* user, u8* buf, int n);
+} ioTransactions;
+
+extern MODEL_TLS const ioTransactions* transactions;
+
+// Firmware phases, for harnesses that attribute host costs to them: the
+// start() handshake, the four boot() waits (the compare init and checksum
+// check belong to the third), the main loop with its compares and the
+// challenge, interruptA() with the RCP transfers and joybus handling, and
+// cicReset(). The model calls phaseChange, when set, as it moves from one to
+// the next. interruptA() returns to the phase it interrupted.
+enum {
+  PHASE_START,
+  PHASE_LOCKOUT,
+  PHASE_GET_CHECKSUM,
+  PHASE_CHECK_CHECKSUM,
+  PHASE_TERMINATE,
+  PHASE_CIC_LOOP,
+  PHASE_INTERRUPT_A,
+  PHASE_RESET,
+  PHASE_KINDS,
+};
+
+static const char* const phaseNames[] = {
+    "start", "lockout", "get-checksum", "check-checksum", "terminate", "cic-loop", "interrupt-a", "reset",
+};
+
+extern MODEL_TLS u8 phase;
+extern MODEL_TLS void (*phaseChange)(u8 from, u8 to);
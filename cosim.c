@@ -0,0 +1,839 @@
+#include "cic.h"
+#include "pif.h"
+
+#include "cmodel.h"
+#include "cmodel_cic.h"
+#include "cmodel_pif.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// PIF/CIC co-simulation with each chip on its own thread: the PIF through
+// libpif (driven by a boot script, then left in its compare loop), the CIC
+// through libcic.
+//
+// The two chips only share the CIC port lines. Each direction is a lock-free
+// wire carrying line changes stamped with the writer's cycle count, plus the
+// writer's published time: everything it did up to then is in the wire.
+// Reading a line at local time t needs the other chip to be past t. Chips
+// publish their time once per quantum (-q), so as long as the other side is
+// ahead a read costs no synchronisation at all. When the quantum doesn't
+// cover a read, i.e. running on would reorder it against an edge the other
+// chip may still produce, the reader publishes its own time and waits:
+// per-edge synchronisation, which is what -q 1 does everywhere. The result
+// doesn't depend on the quantum, which -v checks.
+//
+// With -j N, 1..N consoles are run at once (two threads each) and the
+// aggregate throughput is reported for each count.
+//
+// -o name records one run as a trace for each model, name.txt for cmodel and
+// name_cic.txt for cmodel_cic, streamed out as the run goes. Both replay on
+// their own: every port write of either chip is embedded as an =w check.
+//
+// -s file replaces the default run (boot, then -c cycles of compare) with a
+// script of CPU-side commands, one per line:
+//   boot                  lockout, checksum words, check, terminate
+//   w4 <addr> <nibbles>   as in cmodel traces
+//   w64 <nibbles>
+//   r4 <addr>
+//   r64
+//   reset
+//   step <cycles>         let the PIF run
+// Lines starting with # are comments.
+//
+// -l file writes the PIF's latency percentiles (pif_latency()) for the
+// single-console run: -o, -S, or the first -j run.
+//
+// -S seconds soaks one console in gameplay traffic instead: boot, then a
+// controller poll (w64 + r64) every frame at 60 Hz (50 Hz PAL) with a pad on
+// channel 0, and a reset press every -p seconds, all while the compare loop
+// runs. Seconds are simulated, at a nominal 1 MHz PIF clock. Once a simulated
+// minute it reports throughput, memory and trace size (with -o), so drift in
+// any of them shows up long before a multi-hour run ends.
+//
+// -M file plays a controller movie through the joybus instead of the -S pad:
+// each frame's polls answer with the movie's states, and the r64 must return
+// exactly the PIF-RAM a real PIF leaves for them. The soak ends with the
+// movie. A movie is an 8-byte header, "N64M", a byte with bit n set for a
+// controller in port n and three zero bytes, then per frame, for each port
+// present, the 4 bytes its poll answers: buttons (2 bytes), stick x and y.
+// It is mapped and read front to back, dropping the pages behind, so any
+// length plays in the same memory. With -H the model's CIC keeps the whole
+// run on one core.
+//
+// -H runs the PIF alone, with the model's high-level CIC of the part
+// (pif_set_cic()) instead of the CIC thread. -x cross-checks the two: the
+// run (default, -s or -S) goes once co-simulated and once with -H, and
+// everything the CPU side got back from the PIF must match, down to whether
+// it froze. That is the "cpu" digest each run reports. With -H, -o records
+// name.txt only, which replays with cmodel -C.
+
+enum {
+  EVENTS = 256,
+
+  SOAK_HZ = 1000000,
+  SOAK_REPORT = 60,  // seconds between reports
+
+  MOVIE_HEADER = 8,
+  MOVIE_WINDOW = 1 << 20,  // bytes played between dropping pages
+};
+
+typedef struct {
+  const uint8_t* data;
+  size_t size;
+  uint8_t ports;  // bit n: a controller in port n
+  int frameSize;
+  uint64_t frames;
+} movie;
+
+typedef struct {
+  _Alignas(64) _Atomic uint64_t time;
+  _Alignas(64) _Atomic uint32_t head;
+  _Alignas(64) _Atomic uint32_t tail;
+  struct {
+    uint64_t time;
+    uint8_t value;
+  } events[EVENTS];
+} wire;
+
+// one chip's end of the two links
+typedef struct {
+  wire* out;
+  wire* in;
+  uint64_t nextPublish;
+  uint8_t local;   // lines this chip drives
+  uint8_t remote;  // lines the other chip drives, as of the last read
+  uint64_t waits;
+  uint64_t hash;   // over this chip's line changes
+} side;
+
+typedef struct {
+  int type;
+  const cicPart* part;
+  uint64_t runCycles;
+  uint64_t quantum;
+  wire toCIC;
+  wire toPIF;
+  side pif;
+  side cic;
+  pif* ctx;
+  atomic_bool done;
+  bool frozen;
+  bool cicFailed;
+  uint64_t pifCycles;
+  uint64_t cicCycles;
+  FILE* script;
+  bool scriptError;
+  FILE* pifTrace;
+  FILE* cicTrace;
+  double soakSeconds;
+  double resetPeriod;
+  uint32_t pads[4];  // buttons and stick each controller reports
+  uint8_t padPorts;  // bit n: a controller on channel n
+  const movie* movie;
+  uint64_t frame;  // movie frames played
+  size_t dropped;  // movie bytes whose pages are dropped
+  bool hle;
+  uint64_t cpu;  // over what the pif_* calls returned
+  uint64_t polls;
+  uint64_t badPolls;
+  uint64_t resets;
+  FILE* latencyOut;
+} console;
+
+long cpus;
+FILE* script;
+double soakSeconds;
+double resetPeriod = 300;
+movie film;
+FILE* latencyOut;
+bool hle;
+
+void relax(void) {
+  if (cpus > 1) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+  } else {
+    sched_yield();
+  }
+}
+
+void publish(side* s, uint64_t t) {
+  atomic_store_explicit(&s->out->time, t, memory_order_release);
+}
+
+// apply the other chip's line changes up to time t
+void drain(side* s, uint64_t t) {
+  wire* in = s->in;
+  uint32_t tail = atomic_load_explicit(&in->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&in->head, memory_order_acquire);
+  while (tail != head && in->events[tail % EVENTS].time <= t) {
+    s->remote = in->events[tail % EVENTS].value;
+    ++tail;
+  }
+  atomic_store_explicit(&in->tail, tail, memory_order_release);
+}
+
+void tick(console* c, side* s, uint64_t t) {
+  if (t >= s->nextPublish) {
+    publish(s, t);
+    s->nextPublish = t + c->quantum;
+  }
+}
+
+// The other chip's lines at local time t. Returns false if the run ended
+// while waiting.
+bool sample(console* c, side* s, uint64_t t) {
+  if (atomic_load_explicit(&s->in->time, memory_order_acquire) < t) {
+    // all our changes up to t are posted, so the other side may pass t
+    publish(s, t);
+    s->nextPublish = t + c->quantum;
+    ++s->waits;
+    while (atomic_load_explicit(&s->in->time, memory_order_acquire) < t) {
+      if (atomic_load(&c->done))
+        return false;
+      drain(s, t);
+      relax();
+    }
+  }
+
+  drain(s, t);
+  tick(c, s, t);
+  return true;
+}
+
+void post(console* c, side* s, uint64_t t, uint8_t value) {
+  if (value == s->local) {
+    tick(c, s, t);
+    return;
+  }
+  s->local = value;
+  s->hash = (s->hash ^ (t << 8 | value)) * 0x100000001b3;
+
+  wire* out = s->out;
+  uint32_t head = atomic_load_explicit(&out->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&out->tail, memory_order_acquire) == EVENTS) {
+    publish(s, t - 1);
+    while (head - atomic_load_explicit(&out->tail, memory_order_acquire) == EVENTS) {
+      if (atomic_load(&c->done))
+        return;
+      relax();
+    }
+  }
+
+  out->events[head % EVENTS].time = t;
+  out->events[head % EVENTS].value = value;
+  atomic_store_explicit(&out->head, head + 1, memory_order_release);
+  tick(c, s, t);
+}
+
+uint8_t pifRead(void* user, uint8_t port) {
+  console* c = user;
+  if (port == PORT_RESET)
+    return RESET_BUTTON;
+  if (port != PORT_CIC)
+    return 0;
+
+  // the data line is open drain, low when either chip pulls it low
+  sample(c, &c->pif, pif_cycles(c->ctx));
+  return (c->pif.local & c->pif.remote & 1) ? CIC_DATA_R : 0;
+}
+
+void pifWrite(void* user, uint8_t port, uint8_t value) {
+  console* c = user;
+  if (port == PORT_CIC)
+    post(c, &c->pif, pif_cycles(c->ctx), value & (CIC_DATA_W | CIC_CLOCK));
+}
+
+uint8_t cicRead(void* user, uint8_t port) {
+  console* c = user;
+  if (port != 2)
+    return 0;
+
+  if (!sample(c, &c->cic, cic_cycles()) || atomic_load(&c->done))
+    cic_stop();
+
+  // the PIF's clock output reaches the CIC inverted
+  uint8_t pifLines = c->cic.remote;
+  uint8_t data = pifLines & c->cic.local & 1;
+  uint8_t clock = !(pifLines & CIC_CLOCK);
+  return data | clock << 1;
+}
+
+void cicWrite(void* user, uint8_t port, uint8_t value) {
+  console* c = user;
+  if (port == 2)
+    post(c, &c->cic, cic_cycles(), value & 1);
+}
+
+void* cicThread(void* arg) {
+  console* c = arg;
+  cic_devices dev = {.user = c, .readPort = cicRead, .writePort = cicWrite};
+  cic_trace(c->cicTrace);
+  if (!cic_run(c->type, &dev))
+    c->cicFailed = 1;
+
+  // never hold the PIF up once the CIC is gone
+  c->cicCycles = cic_cycles();
+  publish(&c->cic, UINT64_MAX);
+  return NULL;
+}
+
+void observe(console* c, bool ok, const uint8_t* data, int len) {
+  c->cpu = (c->cpu ^ ok) * 0x100000001b3;
+  for (int i = 0; i < len; ++i)
+    c->cpu = (c->cpu ^ data[i]) * 0x100000001b3;
+}
+
+void step(console* c, uint64_t cycles) {
+  pif_step(c->ctx, cycles);
+  publish(&c->pif, pif_cycles(c->ctx));
+}
+
+void pifCommand(console* c, uint8_t command) {
+  uint8_t word[4] = {0, 0, 0, command};
+  observe(c, pif_write(c->ctx, 0x3c, word), NULL, 0);
+  step(c, 1);
+}
+
+// the CPU side of a boot, as in input.txt
+void boot(console* c) {
+  // the checksum the CPU hands over, as the CIC sends it from its secret
+  const uint8_t* sum = c->part->secret + 2;
+  uint8_t hi[4] = {0, 0, sum[0], sum[1]};
+  uint8_t lo[4] = {sum[2], sum[3], sum[4], sum[5]};
+
+  pifCommand(c, 0x10);  // ROM lockout
+  uint8_t seed[4];
+  observe(c, pif_read(c->ctx, 0x24, seed), seed, 4);  // as IPL2 does
+  observe(c, pif_write(c->ctx, 0x30, hi), NULL, 0);
+  observe(c, pif_write(c->ctx, 0x34, lo), NULL, 0);
+  pifCommand(c, 0x20);  // get checksum
+  pifCommand(c, 0x40);  // check checksum
+  pifCommand(c, 0x08);  // terminate boot
+}
+
+// Let the PIF run for this many cycles, publishing once per quantum. Never
+// aiming past the end makes the run stop at the same point whatever the
+// quantum.
+void runFor(console* c, uint64_t cycles) {
+  uint64_t end = pif_cycles(c->ctx) + cycles;
+  while (pif_cycles(c->ctx) < end && !pif_frozen(c->ctx)) {
+    uint64_t left = end - pif_cycles(c->ctx);
+    step(c, left < c->quantum ? left : c->quantum);
+  }
+}
+
+bool scanHex(FILE* f, unsigned* value) {
+  return 1 == fscanf(f, "%x", value);
+}
+
+// pairs of nibbles, as cmodel traces write bytes
+bool scanBytes(FILE* f, uint8_t* data, int count) {
+  for (int i = 0; i < count; ++i) {
+    unsigned hi, lo;
+    if (!scanHex(f, &hi) || !scanHex(f, &lo))
+      return false;
+    data[i] = hi << 4 | (lo & 0xf);
+  }
+  return true;
+}
+
+bool runScript(console* c) {
+  rewind(c->script);
+  char cmd[16];
+  while (1 == fscanf(c->script, "%15s", cmd)) {
+    unsigned value;
+    uint8_t data[64];
+    if (cmd[0] == '#') {
+      fscanf(c->script, "%*[^\n]");
+    } else if (!strcmp(cmd, "boot")) {
+      boot(c);
+    } else if (!strcmp(cmd, "w4")) {
+      if (!scanHex(c->script, &value) || !scanBytes(c->script, data, 4))
+        return false;
+      observe(c, pif_write(c->ctx, value, data), NULL, 0);
+    } else if (!strcmp(cmd, "w64")) {
+      if (!scanBytes(c->script, data, 64))
+        return false;
+      observe(c, pif_write64(c->ctx, data), NULL, 0);
+    } else if (!strcmp(cmd, "r4")) {
+      if (!scanHex(c->script, &value))
+        return false;
+      bool ok = pif_read(c->ctx, value, data);
+      observe(c, ok, data, 4);
+    } else if (!strcmp(cmd, "r64")) {
+      bool ok = pif_read64(c->ctx, data);
+      observe(c, ok, data, 64);
+    } else if (!strcmp(cmd, "reset")) {
+      pif_reset(c->ctx);
+    } else if (!strcmp(cmd, "step")) {
+      if (1 != fscanf(c->script, "%u", &value))
+        return false;
+      runFor(c, value);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+// standard controllers on the pad ports, nothing on the others
+int padJoybus(void* user, int channel, const uint8_t* tx, int txLen, uint8_t* rx) {
+  console* c = user;
+  if (channel > 3 || !(c->padPorts & 1 << channel) || txLen < 1)
+    return -1;
+
+  switch (tx[0]) {
+    case 0x00:
+    case 0xff:
+      rx[0] = 0x05;
+      rx[1] = 0x00;
+      rx[2] = 0x02;  // no pak
+      return 3;
+    case 0x01:
+      for (int i = 0; i < 4; ++i)
+        rx[i] = c->pads[channel] >> (24 - 8 * i);
+      return 4;
+    default:
+      return -1;
+  }
+}
+
+// what osContStartReadData() sends: a poll frame per channel
+void pollBlock(uint8_t* block) {
+  memset(block, 0, 64);
+  for (int n = 0; n < 4; ++n) {
+    uint8_t frame[8] = {0xff, 0x01, 0x04, 0x01, 0xff, 0xff, 0xff, 0xff};
+    memcpy(block + 8 * n, frame, 8);
+  }
+  block[32] = 0xfe;
+  block[63] = 0x01;  // run the joybus
+}
+
+// the next movie frame's states, dropping the pages played so far
+void moviePads(console* c) {
+  const movie* m = c->movie;
+  size_t offset = MOVIE_HEADER + c->frame++ * m->frameSize;
+  const uint8_t* state = m->data + offset;
+  for (int n = 0; n < 4; ++n) {
+    if (m->ports & 1 << n) {
+      c->pads[n] = (uint32_t)state[0] << 24 | state[1] << 16 | state[2] << 8 | state[3];
+      state += 4;
+    }
+  }
+
+  if (offset - c->dropped >= MOVIE_WINDOW) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t end = offset / page * page;
+    madvise((void*)(m->data + c->dropped), end - c->dropped, MADV_DONTNEED);
+    c->dropped = end;
+  }
+}
+
+// The poll block as the PIF returns it: the pad states in the frames of the
+// pad ports, the no-device bit in the others', and the command byte cleared.
+void pollResult(const console* c, uint8_t* block) {
+  pollBlock(block);
+  block[63] = 0;
+  for (int n = 0; n < 4; ++n) {
+    uint8_t* frame = block + 8 * n;
+    if (c->padPorts & 1 << n) {
+      for (int i = 0; i < 4; ++i)
+        frame[4 + i] = c->pads[n] >> (24 - 8 * i);
+    } else {
+      frame[2] |= 0x80;
+    }
+  }
+}
+
+// one frame's controller read, checking it comes back as the pads
+void poll(console* c) {
+  uint8_t block[64];
+  uint8_t expected[64];
+  if (c->movie) {
+    moviePads(c);
+  } else {
+    c->pads[0] ^= c->pads[0] << 13;
+    c->pads[0] ^= c->pads[0] >> 17;
+    c->pads[0] ^= c->pads[0] << 5;
+  }
+
+  pollBlock(block);
+  bool ok = pif_write64(c->ctx, block) && pif_read64(c->ctx, block);
+  observe(c, ok, block, 64);
+  pollResult(c, expected);
+  ok &= !memcmp(block, expected, 64);
+  if (!ok && !c->badPolls) {
+    printf("bad poll %llu:", (unsigned long long)c->polls);
+    for (int i = 0; i < 64; ++i) {
+      if (block[i] != expected[i])
+        printf(" %02x %02x, expected %02x", i, block[i], expected[i]);
+    }
+    printf("\n");
+  }
+  ++c->polls;
+  c->badPolls += !ok;
+}
+
+double now(void);
+
+// resident set size in MB
+double rss(void) {
+  FILE* f = fopen("/proc/self/statm", "r");
+  unsigned long size, resident = 0;
+  if (f) {
+    if (2 != fscanf(f, "%lu %lu", &size, &resident))
+      resident = 0;
+    fclose(f);
+  }
+  return resident * (double)sysconf(_SC_PAGESIZE) / (1 << 20);
+}
+
+double traceMB(const console* c) {
+  if (!c->pifTrace)
+    return 0;
+  long size = ftell(c->pifTrace) + (c->cicTrace ? ftell(c->cicTrace) : 0);
+  return size / (double)(1 << 20);
+}
+
+void soakReport(const console* c, double simulated, double wall) {
+  printf("soak %.0f s: %.2f simulated s/s, %llu polls (%llu bad), %llu resets, rss %.1f MB", simulated,
+         simulated / wall, (unsigned long long)c->polls, (unsigned long long)c->badPolls,
+         (unsigned long long)c->resets, rss());
+  if (c->pifTrace)
+    printf(", trace %.1f MB (%.2f MB/min)", traceMB(c), traceMB(c) * 60 / simulated);
+  if (c->movie)
+    printf(", frame %llu of %llu, %.0f frames/s", (unsigned long long)c->frame,
+           (unsigned long long)c->movie->frames, c->frame / wall);
+  printf("\n");
+  fflush(stdout);
+}
+
+// Frames at the region's rate: a poll at the start of each, a reset press
+// (then half a second for the CPU to come back and boot again) when due.
+// A movie runs to its last frame instead of for -S seconds.
+void runSoak(console* c) {
+  uint64_t frame = SOAK_HZ / (c->part->pal ? 50 : 60);
+  uint64_t end = c->soakSeconds * SOAK_HZ;
+  uint64_t resetPeriod = c->resetPeriod * SOAK_HZ;
+  uint64_t nextReset = resetPeriod;
+  uint64_t nextReport = (uint64_t)SOAK_REPORT * SOAK_HZ;
+  double start = now();
+
+  boot(c);
+  c->pads[0] = 0x12345678;
+  while ((c->movie ? c->frame < c->movie->frames : pif_cycles(c->ctx) < end) && !pif_frozen(c->ctx)) {
+    uint64_t t = pif_cycles(c->ctx);
+    if (resetPeriod && t >= nextReset) {
+      pif_reset(c->ctx);
+      runFor(c, SOAK_HZ / 2);
+      boot(c);
+      ++c->resets;
+      nextReset += resetPeriod;
+    } else {
+      poll(c);
+      runFor(c, frame - t % frame);
+    }
+
+    if (pif_cycles(c->ctx) >= nextReport) {
+      soakReport(c, pif_cycles(c->ctx) / (double)SOAK_HZ, now() - start);
+      nextReport += (uint64_t)SOAK_REPORT * SOAK_HZ;
+    }
+  }
+  soakReport(c, pif_cycles(c->ctx) / (double)SOAK_HZ, now() - start);
+}
+
+// the CPU side, then the PIF's compare loop
+void* pifThread(void* arg) {
+  console* c = arg;
+  pif_devices dev = {.user = c, .readPort = pifRead, .writePort = pifWrite};
+  if (c->soakSeconds > 0 || c->movie)
+    dev.joybus = padJoybus;
+  c->ctx = pif_create(&dev, c->part->pal);
+  if (c->hle)
+    pif_set_cic(c->ctx, c->type);
+  if (c->pifTrace)
+    pif_trace(c->ctx, c->pifTrace);
+
+  if (c->script) {
+    c->scriptError = !runScript(c);
+  } else if (c->soakSeconds > 0 || c->movie) {
+    runSoak(c);
+  } else {
+    boot(c);
+    if (pif_cycles(c->ctx) < c->runCycles)
+      runFor(c, c->runCycles - pif_cycles(c->ctx));
+  }
+
+  c->frozen = pif_frozen(c->ctx);
+  observe(c, c->frozen, NULL, 0);
+  c->pifCycles = pif_cycles(c->ctx);
+  if (c->latencyOut)
+    pif_latency(c->ctx, c->latencyOut);
+  atomic_store(&c->done, 1);
+  publish(&c->pif, UINT64_MAX);
+  pif_destroy(c->ctx);
+  return NULL;
+}
+
+void initConsole(console* c, int type, uint64_t runCycles, uint64_t quantum) {
+  memset(c, 0, sizeof(*c));
+  c->type = type;
+  c->part = findCicPart(type);
+  c->runCycles = runCycles;
+  c->quantum = quantum;
+  c->script = script;
+  c->soakSeconds = soakSeconds;
+  c->resetPeriod = resetPeriod;
+  c->hle = hle;
+  c->padPorts = 1;
+  if (film.data) {
+    c->movie = &film;
+    c->padPorts = film.ports;
+  }
+  c->pif.out = &c->toCIC;
+  c->pif.in = &c->toPIF;
+  c->cic.out = &c->toPIF;
+  c->cic.in = &c->toCIC;
+  c->pif.local = c->cic.remote = CIC_DATA_W;
+  c->cic.local = c->pif.remote = 1;
+}
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// run n consoles at once, return the wall time
+double run(console* consoles, int n) {
+  pthread_t threads[2 * n];
+  double start = now();
+  int count = 0;
+  for (int i = 0; i < n; ++i) {
+    if (!consoles[i].hle)
+      pthread_create(&threads[count++], NULL, cicThread, &consoles[i]);
+    pthread_create(&threads[count++], NULL, pifThread, &consoles[i]);
+  }
+  for (int i = 0; i < count; ++i)
+    pthread_join(threads[i], NULL);
+  return now() - start;
+}
+
+void loadMovie(const char* path) {
+  FILE* f = fopen(path, "rb");
+  struct stat st;
+  if (!f || fstat(fileno(f), &st)) {
+    printf("cannot open %s\n", path);
+    exit(4);
+  }
+  film.size = st.st_size;
+  film.data = film.size ? mmap(NULL, film.size, PROT_READ, MAP_PRIVATE, fileno(f), 0) : MAP_FAILED;
+  fclose(f);
+  if (film.data == MAP_FAILED || film.size < MOVIE_HEADER || memcmp(film.data, "N64M", 4) ||
+      !film.data[4] || film.data[4] > 0xf || film.data[5] || film.data[6] || film.data[7]) {
+    printf("%s is not a movie\n", path);
+    exit(4);
+  }
+  madvise((void*)film.data, film.size, MADV_SEQUENTIAL);
+
+  film.ports = film.data[4];
+  film.frameSize = 4 * __builtin_popcount(film.ports);
+  film.frames = (film.size - MOVIE_HEADER) / film.frameSize;
+  if ((film.size - MOVIE_HEADER) % film.frameSize) {
+    printf("%s ends inside a frame\n", path);
+    exit(4);
+  }
+}
+
+bool failedRun(const console* c) {
+  return c->frozen || c->cicFailed || c->scriptError || c->badPolls;
+}
+
+void report(const console* c) {
+  printf("cic %d%s: pif %llu cycles, cic %llu cycles, waits %llu/%llu, %s, digest %016llx, cpu %016llx\n",
+         c->type, c->hle ? " hle" : "",
+         (unsigned long long)c->pifCycles, (unsigned long long)c->cicCycles,
+         (unsigned long long)c->pif.waits, (unsigned long long)c->cic.waits,
+         c->scriptError ? "bad script" : c->frozen ? "PIF froze" : c->cicFailed ? "CIC failed" :
+         c->badPolls ? "bad polls" : "ok",
+         (unsigned long long)(c->pif.hash ^ c->cic.hash), (unsigned long long)c->cpu);
+}
+
+int main(int argc, char* argv[]) {
+  int type = 6102;
+  uint64_t runCycles = 1000000;
+  uint64_t quantum = 256;
+  int jobs = 1;
+  bool verify = 0;
+  bool crossCheck = 0;
+  const char* traceName = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:c:q:j:vo:s:S:M:p:l:Hx")) != -1) {
+    switch (opt) {
+      case 't':
+        type = atoi(optarg);
+        break;
+      case 'c':
+        runCycles = strtoull(optarg, NULL, 0);
+        break;
+      case 'q':
+        quantum = strtoull(optarg, NULL, 0);
+        break;
+      case 'j':
+        jobs = atoi(optarg);
+        break;
+      case 'v':
+        verify = 1;
+        break;
+      case 'o':
+        traceName = optarg;
+        break;
+      case 's':
+        script = fopen(optarg, "r");
+        if (!script) {
+          printf("cannot open %s\n", optarg);
+          exit(4);
+        }
+        break;
+      case 'S':
+        soakSeconds = atof(optarg);
+        break;
+      case 'M':
+        loadMovie(optarg);
+        break;
+      case 'p':
+        resetPeriod = atof(optarg);
+        break;
+      case 'l':
+        latencyOut = fopen(optarg, "w");
+        if (!latencyOut) {
+          printf("cannot create %s\n", optarg);
+          exit(4);
+        }
+        break;
+      case 'H':
+        hle = 1;
+        break;
+      case 'x':
+        crossCheck = 1;
+        break;
+      default:
+        printf("usage: %s [-t cic] [-c pif-cycles] [-q quantum] [-j consoles] [-v] [-o trace-name] "
+               "[-s script] [-S soak-seconds] [-M movie] [-p reset-period] [-l latency-file] [-H] [-x]\n",
+               argv[0]);
+        exit(4);
+    }
+  }
+  if (!findCicPart(type) || quantum < 1 || jobs < 1 || soakSeconds < 0 || resetPeriod < 0) {
+    printf("bad arguments\n");
+    exit(4);
+  }
+  cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  console* consoles = malloc(sizeof(console) * jobs);
+  bool failed = 0;
+
+  if (crossCheck) {
+    initConsole(&consoles[0], type, runCycles, quantum);
+    consoles[0].hle = 0;
+    run(consoles, 1);
+    report(&consoles[0]);
+    uint64_t cpu = consoles[0].cpu;
+    failed |= failedRun(&consoles[0]);
+
+    initConsole(&consoles[0], type, runCycles, quantum);
+    consoles[0].hle = 1;
+    run(consoles, 1);
+    report(&consoles[0]);
+    failed |= failedRun(&consoles[0]);
+    if (consoles[0].cpu != cpu) {
+      printf("high-level CIC differs from co-simulation\n");
+      failed = 1;
+    }
+    free(consoles);
+    return failed;
+  }
+
+  if (traceName || soakSeconds > 0 || film.data) {
+    char path[4096];
+    initConsole(&consoles[0], type, runCycles, quantum);
+    consoles[0].latencyOut = latencyOut;
+    if (traceName) {
+      snprintf(path, sizeof(path), "%s.txt", traceName);
+      consoles[0].pifTrace = fopen(path, "w");
+      if (!hle) {
+        snprintf(path, sizeof(path), "%s_cic.txt", traceName);
+        consoles[0].cicTrace = fopen(path, "w");
+      }
+      if (!consoles[0].pifTrace || (!hle && !consoles[0].cicTrace)) {
+        printf("cannot create %s\n", path);
+        exit(4);
+      }
+    }
+
+    run(consoles, 1);
+    report(&consoles[0]);
+    if (traceName) {
+      fclose(consoles[0].pifTrace);
+      if (consoles[0].cicTrace)
+        fclose(consoles[0].cicTrace);
+    }
+    failed = failedRun(&consoles[0]);
+    free(consoles);
+    return failed;
+  }
+
+  if (verify) {
+    initConsole(&consoles[0], type, runCycles, 1);
+    run(consoles, 1);
+    report(&consoles[0]);
+    uint64_t digest = consoles[0].pif.hash ^ consoles[0].cic.hash;
+    failed |= failedRun(&consoles[0]);
+
+    initConsole(&consoles[0], type, runCycles, quantum);
+    run(consoles, 1);
+    report(&consoles[0]);
+    if ((consoles[0].pif.hash ^ consoles[0].cic.hash) != digest) {
+      printf("quantum %llu differs from per-edge sync\n", (unsigned long long)quantum);
+      failed = 1;
+    }
+  }
+
+  double base = 0;
+  for (int n = 1; n <= jobs; ++n) {
+    for (int i = 0; i < n; ++i)
+      initConsole(&consoles[i], type, runCycles, quantum);
+    if (n == 1)
+      consoles[0].latencyOut = latencyOut;
+    double seconds = run(consoles, n);
+
+    uint64_t total = 0;
+    for (int i = 0; i < n; ++i) {
+      total += consoles[i].pifCycles;
+      failed |= failedRun(&consoles[i]);
+    }
+    if (n == 1)
+      report(&consoles[0]);
+
+    double rate = total / seconds;
+    if (n == 1)
+      base = rate;
+    printf("%d console%s, %d threads: %.2f M PIF cycles/s, %.2fx\n", n, n > 1 ? "s" : "", hle ? n : 2 * n,
+           rate / 1e6, rate / base);
+  }
+
+  free(consoles);
+  return failed;
+}
@@ -0,0 +1,26 @@
+#include "cmodel.h"
+
+#include <stdio.h>
+
+const char* coveragePath = NULL;
+
+// Merge romHits into the coverage file so a whole trace corpus accumulates in
+// one place: one "pu:pl count" line per executed address.
+void writeCoverage(void) {
+  FILE* f = fopen(coveragePath, "r");
+  if (f) {
+    unsigned pu, pl, count;
+    while (3 == fscanf(f, "%x:%x %u", &pu, &pl, &count))
+      romHits[(pu & 0x3f) << 6 | (pl & 0x3f)] += count;
+    fclose(f);
+  }
+
+  f = fopen(coveragePath, "w");
+  if (!f)
+    return;
+  for (int i = 0; i < 0x1000; ++i) {
+    if (romHits[i])
+      fprintf(f, "%02x:%02x %u\n", i >> 6, i & 0x3f, romHits[i]);
+  }
+  fclose(f);
+}
@@ -0,0 +1,629 @@
+#include "cmodel.h"
+#include "cmodel_pif.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+// Coverage-guided in-process fuzzer for the PIF model (cmodel.c).
+//
+// The model is booted once by replaying a regular trace (-b). When that trace
+// ends at a command ("q", end of file, or the command limit given with -n),
+// the model state and its stack are snapshotted. Every execution restores the
+// snapshot and runs the model on a binary input instead of a text trace:
+//   - each command consumes one byte, taken modulo 5:
+//       0: w4, then one byte (low nibble = word address) and 4 data bytes
+//       1: w64, then 64 data bytes
+//       2: r64
+//       3: reset
+//       4: pass
+//   - each readIO consumes one byte (low nibble)
+// An execution ends when the input runs out or the model calls fatalError().
+//
+// cmodel.c is compiled with -fsanitize-coverage=trace-pc; edges are hashed
+// into a small map and bucketed like AFL does. Inputs reaching new edges are
+// kept in the corpus and, with -o, written out. Workers started with -j share
+// the coverage map, so they don't keep rediscovering each other's edges.
+
+extern MODEL_TLS bool reset;
+extern MODEL_TLS bool regionPAL;
+void start(void);
+void checkInterrupt(void);
+
+enum {
+  MAP_SIZE = 1 << 13,
+  STACK_SIZE = 1 << 16,
+  MAX_INPUT = 256,
+  MAX_CORPUS = 4096,
+};
+
+enum {
+  CMD_W4,
+  CMD_W64,
+  CMD_R64,
+  CMD_RESET,
+  CMD_PASS,
+  CMD_COUNT,
+};
+
+u8 hits[MAP_SIZE] __attribute__((aligned(8)));
+u8* virgin;  // shared between workers
+uintptr_t prevLocation;
+
+void __sanitizer_cov_trace_pc(void) {
+  uintptr_t location = (uintptr_t)__builtin_return_address(0);
+  location = ((uint32_t)location * 2654435761u) >> (32 - 13);
+  hits[location ^ prevLocation]++;
+  prevLocation = location >> 1;
+}
+
+ucontext_t fuzzContext;
+ucontext_t modelContext;
+u8 modelStack[STACK_SIZE];
+
+// Everything needed to resume the model at the end of the boot trace. Only
+// the live part of the model stack is saved.
+struct {
+  rfile r;
+  r4 ram[256];
+  externalWrites external;
+  bool reset;
+  bool regionPAL;
+  ucontext_t context;
+  uintptr_t stackLow;
+  u8 stack[STACK_SIZE];
+} snapshot;
+
+FILE* bootTrace;
+int bootCommands = -1;
+bool booting = 1;
+bool echoing = 0;
+
+const u8* data;
+size_t size;
+size_t pos;
+bool errored;
+
+uint64_t rngState = 0x2545f4914f6cdd1d;
+
+uint64_t rng(void) {
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 7;
+  rngState ^= rngState << 17;
+  return rngState;
+}
+
+// end the current execution; the model context is never resumed from here
+void finish(void) {
+  swapcontext(&modelContext, &fuzzContext);
+}
+
+u8 nextByte(void) {
+  if (pos == size)
+    finish();
+  return data[pos++];
+}
+
+void skipComments(void) {
+  int num;
+  do {
+    num = 0;
+    fscanf(bootTrace, " #%n%*[^\n] ", &num);
+  } while (num > 0);
+
+  // expectations only matter to cmodel; skip "=kind arg arg"
+  int next = fgetc(bootTrace);
+  if (next == '=') {
+    fscanf(bootTrace, "%*s %*s %*s");
+    skipComments();
+  } else {
+    ungetc(next, bootTrace);
+  }
+}
+
+int bootValue(void) {
+  skipComments();
+
+  unsigned value;
+  if (1 != fscanf(bootTrace, "%x", &value)) {
+    printf("boot trace ended while the model was reading a port\n");
+    exit(3);
+  }
+  return value;
+}
+
+bool fuzzCommand(void);
+
+bool bootCommand(void) {
+  skipComments();
+
+  char cmd[16];
+  if (!bootCommands-- || 1 != fscanf(bootTrace, "%15s", cmd) || !strcmp(cmd, "q")) {
+    // end of boot trace: hand the model over to the fuzzer
+    volatile u8 marker = 0;
+    snapshot.stackLow = (uintptr_t)&marker - 1024;
+    booting = 0;
+    finish();
+    return fuzzCommand();
+  }
+
+  if (!strcmp(cmd, "w4")) {
+    int address = bootValue();
+    for (int i = 0; i < 8; ++i)
+      externalWrite(address * 2 + i, bootValue());
+    IFA = 1;
+  } else if (!strcmp(cmd, "w64")) {
+    for (int i = 0; i < 0x80; ++i)
+      externalWrite(i, bootValue());
+    IFA = 1;
+  } else if (!strcmp(cmd, "r64")) {
+    IFA = 1;
+  } else if (!strcmp(cmd, "reset")) {
+    IFB = 1;
+  } else if (!strcmp(cmd, "pass")) {
+    return true;
+  } else {
+    printf("unrecognized boot command %s\n", cmd);
+    exit(4);
+  }
+
+  return false;
+}
+
+bool fuzzCommand(void) {
+  u8 cmd = nextByte() % CMD_COUNT;
+
+  switch (cmd) {
+    case CMD_W4: {
+      u8 address = (nextByte() & 0xf) * 4;
+      if (echoing)
+        printf("w4 %x", address);
+      for (int i = 0; i < 4; ++i) {
+        u8 byte = nextByte();
+        externalWrite(address * 2 + i * 2 + 0, byte >> 4);
+        externalWrite(address * 2 + i * 2 + 1, byte & 0xf);
+        if (echoing)
+          printf(" %x %x", byte >> 4, byte & 0xf);
+      }
+      IFA = 1;
+      break;
+    }
+    case CMD_W64:
+      if (echoing)
+        printf("w64");
+      for (int i = 0; i < 0x40; ++i) {
+        u8 byte = nextByte();
+        externalWrite(i * 2 + 0, byte >> 4);
+        externalWrite(i * 2 + 1, byte & 0xf);
+        if (echoing)
+          printf("%s%x %x", i % 16 ? " " : "\n", byte >> 4, byte & 0xf);
+      }
+      IFA = 1;
+      break;
+    case CMD_R64:
+      if (echoing)
+        printf("r64");
+      IFA = 1;
+      break;
+    case CMD_RESET:
+      if (echoing)
+        printf("reset");
+      IFB = 1;
+      break;
+    case CMD_PASS:
+      if (echoing)
+        printf("pass\n");
+      return true;
+  }
+
+  if (echoing)
+    printf("\n");
+  return false;
+}
+
+bool readCommand(void) {
+  return booting ? bootCommand() : fuzzCommand();
+}
+
+u8 readIO(u8 port) {
+  (void)port;
+
+  if (booting)
+    return bootValue() & 0xf;
+
+  u8 value = nextByte() & 0xf;
+  if (echoing)
+    printf("%x\n", value);
+  return value;
+}
+
+void writeIO(u8 port, u8 value) {
+  if (port == 0xe)
+    RE = value;
+
+  if (echoing && !booting)
+    printf("=w %x %x\n", port, value);
+}
+
+void halt(void) {
+}
+
+void sync(void) {
+  while (!readCommand())
+    checkInterrupt();
+}
+
+void fatalError(void) {
+  if (booting) {
+    printf("fatal error during boot trace\n");
+    exit(1);
+  }
+
+  errored = 1;
+  finish();
+}
+
+void notImpl(u8 pu, u8 pl) {
+  printf("not impl %x:%02x\n", pu, pl);
+  exit(2);
+}
+
+void takeSnapshot(void) {
+  snapshot.r = r;
+  memcpy(snapshot.ram, ram, sizeof(ram));
+  snapshot.external = external;
+  snapshot.reset = reset;
+  snapshot.regionPAL = regionPAL;
+  snapshot.context = modelContext;
+
+  uintptr_t low = (uintptr_t)modelStack;
+  if (snapshot.stackLow < low)
+    snapshot.stackLow = low;
+  size_t offset = snapshot.stackLow - low;
+  memcpy(snapshot.stack + offset, modelStack + offset, STACK_SIZE - offset);
+}
+
+void restoreSnapshot(void) {
+  r = snapshot.r;
+  memcpy(ram, snapshot.ram, sizeof(ram));
+  external = snapshot.external;
+  reset = snapshot.reset;
+  regionPAL = snapshot.regionPAL;
+  modelContext = snapshot.context;
+
+  size_t offset = snapshot.stackLow - (uintptr_t)modelStack;
+  memcpy(modelStack + offset, snapshot.stack + offset, STACK_SIZE - offset);
+}
+
+// AFL hit count buckets
+u8 bucket(u8 count) {
+  if (count <= 3)
+    return count ? BIT(count - 1) : 0;
+  if (count <= 7)
+    return BIT(3);
+  if (count <= 15)
+    return BIT(4);
+  if (count <= 31)
+    return BIT(5);
+  if (count <= 127)
+    return BIT(6);
+  return BIT(7);
+}
+
+// run one input from the snapshot, return true if it reached new coverage
+bool run(const u8* input, size_t n) {
+  memset(hits, 0, sizeof(hits));
+  prevLocation = 0;
+  data = input;
+  size = n;
+  pos = 0;
+  errored = 0;
+
+  restoreSnapshot();
+  swapcontext(&fuzzContext, &modelContext);
+
+  // the map is sparse, so skip it a word at a time
+  bool found = false;
+  const uint64_t* words = (const uint64_t*)hits;
+  for (int w = 0; w < MAP_SIZE / 8; ++w) {
+    if (!words[w])
+      continue;
+    for (int i = w * 8; i < w * 8 + 8; ++i) {
+      u8 b = bucket(hits[i]);
+      if (virgin[i] & b) {
+        __atomic_fetch_and(&virgin[i], ~b, __ATOMIC_RELAXED);
+        found = true;
+      }
+    }
+  }
+  return found;
+}
+
+typedef struct {
+  u16 size;
+  u8 data[MAX_INPUT];
+} entry;
+
+entry* corpus;
+int corpusSize;
+
+// TX bytes with special meaning to joybusCommandParse(), and sizes around
+// the limits of the 0x3f mask and of the 64-byte block
+const u8 interesting[] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x08, 0x1f, 0x20, 0x3e, 0x3f,
+    0x40, 0x7f, 0x80, 0xbf, 0xc0, 0xfc, 0xfd, 0xfe, 0xff,
+};
+
+u8 randomInteresting(void) {
+  return interesting[rng() % sizeof(interesting)];
+}
+
+// append a w64 built out of TX/RX frames followed by an r64, so that
+// joybusCommandParse() and joybusTransferChannel() see plausible layouts
+size_t insertJoybusBlock(u8* buf, size_t n) {
+  if (n + 2 + 0x40 > MAX_INPUT)
+    return n;
+
+  size_t at = rng() % (n + 1);
+  memmove(buf + at + 2 + 0x40, buf + at, n - at);
+
+  // bytes the frames skip stay zero, so the block depends on the seed only
+  u8* block = buf + at;
+  memset(block, 0, 2 + 0x40);
+  block[0] = CMD_W64;
+  for (int i = 1; i <= 0x40;) {
+    u8 tx = randomInteresting();
+    block[i++] = tx;
+    if (tx == 0x00 || tx >= 0xfd || i > 0x40)
+      continue;
+    block[i++] = rng() % 2 ? randomInteresting() : rng() % 0x10;
+    i += rng() % 8;
+  }
+  block[0x40] |= rng() % 2;  // joybus command bit
+  block[0x41] = CMD_R64;
+
+  return n + 2 + 0x40;
+}
+
+size_t mutate(u8* buf, size_t n) {
+  int rounds = 1 + rng() % 4;
+
+  while (rounds--) {
+    switch (rng() % 8) {
+      case 0:
+        if (n)
+          buf[rng() % n] ^= BIT(rng() % 8);
+        break;
+      case 1:
+        if (n)
+          buf[rng() % n] = randomInteresting();
+        break;
+      case 2:
+        if (n)
+          buf[rng() % n] = rng();
+        break;
+      case 3:
+        if (n < MAX_INPUT) {
+          size_t at = rng() % (n + 1);
+          memmove(buf + at + 1, buf + at, n - at);
+          buf[at] = rng() % CMD_COUNT;
+          n++;
+        }
+        break;
+      case 4:
+        if (n > 1) {
+          size_t at = rng() % n;
+          size_t len = 1 + rng() % (n - at);
+          memmove(buf + at, buf + at + len, n - at - len);
+          n -= len;
+        }
+        break;
+      case 5:
+        if (n && n < MAX_INPUT) {
+          size_t at = rng() % n;
+          size_t len = 1 + rng() % (n - at);
+          if (len > MAX_INPUT - n)
+            len = MAX_INPUT - n;
+          size_t to = rng() % (n + 1);
+          memmove(buf + to + len, buf + to, n - to);
+          memmove(buf + to, buf + (at >= to ? at + len : at), len);
+          n += len;
+        }
+        break;
+      case 6:
+        n = insertJoybusBlock(buf, n);
+        break;
+      case 7: {
+        const entry* other = &corpus[rng() % corpusSize];
+        size_t at = rng() % (n + 1);
+        size_t from = rng() % (other->size + 1);
+        size_t len = other->size - from;
+        if (at + len > MAX_INPUT)
+          len = MAX_INPUT - at;
+        memcpy(buf + at, other->data + from, len);
+        n = at + len;
+        break;
+      }
+    }
+  }
+
+  return n;
+}
+
+void save(const char* dir, int worker, int id, const u8* buf, size_t n) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/w%d-%06d%s", dir, worker, id, errored ? "-error" : "");
+  FILE* f = fopen(path, "wb");
+  if (!f)
+    return;
+  fwrite(buf, 1, n, f);
+  fclose(f);
+}
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void addToCorpus(const u8* buf, size_t n) {
+  if (corpusSize == MAX_CORPUS)
+    return;
+  corpus[corpusSize].size = n;
+  memcpy(corpus[corpusSize].data, buf, n);
+  corpusSize++;
+}
+
+void fuzz(int worker, const char* outDir, double seconds, uint64_t* execs) {
+  corpus = malloc(sizeof(entry) * MAX_CORPUS);
+  corpusSize = 0;
+
+  u8 buf[MAX_INPUT];
+  size_t n = insertJoybusBlock(buf, 0);
+  run(buf, n);
+  addToCorpus(buf, n);
+
+  double begin = now();
+  for (uint64_t i = 0;; ++i) {
+    const entry* parent = &corpus[rng() % corpusSize];
+    memcpy(buf, parent->data, parent->size);
+    n = mutate(buf, parent->size);
+
+    if (run(buf, n)) {
+      addToCorpus(buf, n);
+      if (outDir)
+        save(outDir, worker, corpusSize, buf, n);
+    }
+
+    if (!(i & 0xfff)) {
+      __atomic_store_n(execs, i, __ATOMIC_RELAXED);
+      if (seconds > 0 && now() - begin > seconds)
+        break;
+    }
+  }
+}
+
+// replay the boot trace on the model stack and snapshot where it ends
+bool bootModel(void) {
+  regionPAL = bootValue();
+
+  getcontext(&modelContext);
+  modelContext.uc_stack.ss_sp = modelStack;
+  modelContext.uc_stack.ss_size = sizeof(modelStack);
+  modelContext.uc_link = NULL;
+  makecontext(&modelContext, start, 0);
+  swapcontext(&fuzzContext, &modelContext);
+  if (booting) {
+    printf("model stopped during boot trace\n");
+    return false;
+  }
+
+  takeSnapshot();
+  return true;
+}
+
+int edges(void) {
+  int count = 0;
+  for (int i = 0; i < MAP_SIZE; ++i)
+    count += virgin[i] != 0xff;
+  return count;
+}
+
+int main(int argc, char* argv[]) {
+  const char* bootPath = "input.txt";
+  const char* outDir = NULL;
+  const char* replayPath = NULL;
+  double seconds = 0;
+  int workers = 1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "b:n:o:r:t:j:s:")) != -1) {
+    switch (opt) {
+      case 'b':
+        bootPath = optarg;
+        break;
+      case 'n':
+        bootCommands = atoi(optarg);
+        break;
+      case 'o':
+        outDir = optarg;
+        break;
+      case 'r':
+        replayPath = optarg;
+        break;
+      case 't':
+        seconds = atof(optarg);
+        break;
+      case 'j':
+        workers = atoi(optarg);
+        break;
+      case 's':
+        rngState = strtoull(optarg, NULL, 0) | 1;
+        break;
+      default:
+        printf("usage: %s [-b boot-trace] [-n boot-commands] [-o out-dir] [-t seconds] [-j workers] [-s seed] [-r input]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  bootTrace = fopen(bootPath, "r");
+  if (!bootTrace) {
+    printf("cannot open %s\n", bootPath);
+    return 1;
+  }
+  if (!bootModel())
+    return 1;
+
+  virgin = mmap(NULL, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  memset(virgin, 0xff, MAP_SIZE);
+
+  if (replayPath) {
+    static u8 buf[MAX_INPUT];
+    FILE* f = fopen(replayPath, "rb");
+    if (!f) {
+      printf("cannot open %s\n", replayPath);
+      return 1;
+    }
+    size_t n = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+
+    echoing = 1;
+    run(buf, n);
+    printf("# %zu of %zu bytes used%s, %d edges\n", pos, n, errored ? ", fatal error" : "", edges());
+    return 0;
+  }
+
+  uint64_t* execs = mmap(NULL, sizeof(uint64_t) * workers, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  uint64_t seed = rngState;
+
+  for (int w = 0; w < workers; ++w) {
+    if (fork() == 0) {
+      rngState = seed + 0x9e3779b97f4a7c15ull * (w + 1);
+      fuzz(w, outDir, seconds, &execs[w]);
+      exit(0);
+    }
+  }
+
+  double begin = now();
+  int running = workers;
+  while (running) {
+    sleep(1);
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+      running--;
+
+    uint64_t total = 0;
+    for (int w = 0; w < workers; ++w)
+      total += __atomic_load_n(&execs[w], __ATOMIC_RELAXED);
+    double elapsed = now() - begin;
+    printf("%.0fs: %llu execs, %.0f/s, %d edges\n", elapsed, (unsigned long long)total, total / elapsed, edges());
+    fflush(stdout);
+  }
+
+  return 0;
+}
@@ -0,0 +1,48 @@
+#include "hist.h"
+
+// highest value that lands in bucket i
+uint64_t histBucketHigh(int i) {
+  if (i < 2 * HIST_SUB)
+    return i;
+  int k = i - 2 * HIST_SUB;
+  int shift = k / HIST_SUB + 1;
+  uint64_t m = k % HIST_SUB + HIST_SUB;
+  return ((m + 1) << shift) - 1;
+}
+
+uint64_t histPercentile(const hist* h, double p) {
+  if (!h->count)
+    return 0;
+  double exact = p / 100 * h->count;
+  uint64_t rank = exact;
+  if (rank < exact)
+    ++rank;
+  if (rank < 1)
+    rank = 1;
+  if (rank > h->count)
+    rank = h->count;
+
+  uint64_t seen = 0;
+  for (int i = 0; i < HIST_BUCKETS; ++i) {
+    seen += h->buckets[i];
+    if (seen >= rank) {
+      uint64_t high = histBucketHigh(i);
+      return high < h->max ? high : h->max;
+    }
+  }
+  return h->max;
+}
+
+void histPrintHeader(FILE* f) {
+  fprintf(f, "# %-10s %10s %10s %10s %10s %10s %10s %10s %10s\n", "cycles", "count", "min", "mean",
+          "p50", "p90", "p99", "p99.9", "max");
+}
+
+void histPrint(FILE* f, const char* name, const hist* h) {
+  fprintf(f, "  %-10s %10llu %10llu %10.1f %10llu %10llu %10llu %10llu %10llu\n", name,
+          (unsigned long long)h->count, (unsigned long long)h->min,
+          h->count ? (double)h->sum / h->count : 0.0,
+          (unsigned long long)histPercentile(h, 50), (unsigned long long)histPercentile(h, 90),
+          (unsigned long long)histPercentile(h, 99), (unsigned long long)histPercentile(h, 99.9),
+          (unsigned long long)h->max);
+}
@@ -0,0 +1,47 @@
+#include <stdint.h>
+#include <stdio.h>
+
+// Log-linear (HDR-style) histogram of cycle counts. Values below 64 get a
+// bucket each; above that every power of two is split into 32 buckets, so
+// any percentile is within 1/32 of a value that was recorded. Recording is
+// inline and never allocates, so the model can do it on every event.
+
+enum {
+  HIST_SUB_BITS = 5,
+  HIST_SUB = 1 << HIST_SUB_BITS,
+  HIST_BUCKETS = 2 * HIST_SUB + (64 - HIST_SUB_BITS - 1) * HIST_SUB,
+};
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t buckets[HIST_BUCKETS];
+} hist;
+
+static inline int histBucket(uint64_t value) {
+  if (value < 2 * HIST_SUB)
+    return value;
+  int e = 63 - __builtin_clzll(value);
+  return 2 * HIST_SUB + (e - HIST_SUB_BITS - 1) * HIST_SUB + (int)(value >> (e - HIST_SUB_BITS)) -
+         HIST_SUB;
+}
+
+static inline void histRecord(hist* h, uint64_t value) {
+  if (!h->count || value < h->min)
+    h->min = value;
+  if (value > h->max)
+    h->max = value;
+  ++h->count;
+  h->sum += value;
+  ++h->buckets[histBucket(value)];
+}
+
+// Highest value in the bucket holding percentile p (0..100), capped at max.
+uint64_t histPercentile(const hist* h, double p);
+
+// One line per histogram under a # header: count, min, mean, p50, p90, p99,
+// p99.9 and max.
+void histPrintHeader(FILE* f);
+void histPrint(FILE* f, const char* name, const hist* h);
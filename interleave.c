@@ -0,0 +1,820 @@
+#include "cmodel.h"
+#include "cmodel_pif.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Interrupt interleaving explorer for the PIF model (cmodel.c).
+//
+// The model runs the commands of a cmodel trace (w4, w64, r64, reset, pass)
+// at its sync() points, as cmodel does, but with its devices emulated here
+// instead of read back from the trace: a high-level CIC (-C), the joybus
+// hardware with a pad on channel 0 and nothing on the others, the RNG, and a
+// reset button that is released as soon as it is read. This is the baseline.
+//
+// On real hardware an RCP access or the reset button can land between any
+// two instructions, not only where the model syncs. At every boundary of the
+// baseline (each routine entry, as COVER() sees it, and each sync) where an
+// interrupt of a kind would be taken, the explorer forks: the copy raises it
+// there, and runs the rest of the scenario, while the baseline goes on.
+// Kinds (-k, comma separated, all by default):
+//   r4      a Read4B of the PIF command word (0x3c)
+//   r64     a Read64B, i.e. a joybus transfer or the 6105 challenge
+//   reset   the reset button; the branch ends at the NMI pulse
+// A request that arrives while IME is off waits for the next boundary where
+// it is on, so those boundaries are not branched, but count toward latency.
+// Requests are not taken while their RE bit is off or (RCP) while another
+// transfer is in flight. -j bounds the branches running at once.
+//
+// Each branch ends as one of:
+//   ok        as the baseline
+//   cut       the scenario ended less than -b cycles after the injection,
+//             before the request was serviced
+//   error     the model called signalError() (or hit unmodeled code)
+//   deadlock  no sync() for -b cycles or routine entries, a halt() with no
+//             transfer to wait for, a transfer not serviced for -b cycles
+//             (the scenario's next one waits for it), or the injected one
+//             never serviced
+//   corrupt   the scenario's own reads, or PIF-RAM at the end, differ from
+//             the baseline
+// The report groups branches by kind, outcome and the boundary they were
+// injected at, and gives the worst latency found per kind: from the arrival
+// of a request to its transfer done (its NMI for reset), including the wait
+// for IME. -v adds a line per branch.
+
+extern MODEL_TLS bool reset;
+extern MODEL_TLS bool regionPAL;
+void start(void);
+void checkInterrupt(void);
+
+enum {
+  KIND_READ4,
+  KIND_READ64,
+  KIND_RESET,
+  KINDS,
+};
+
+static const char* const kindNames[] = {"r4", "r64", "reset"};
+
+enum {
+  OUTCOME_OK,
+  OUTCOME_CUT,
+  OUTCOME_ERROR,
+  OUTCOME_DEADLOCK,
+  OUTCOME_CORRUPT,
+  OUTCOMES,
+};
+
+static const char* const outcomeNames[] = {"ok", "cut", "error", "deadlock", "corrupt"};
+
+enum {
+  CMD_W4,
+  CMD_W64,
+  CMD_R4,
+  CMD_R64,
+  CMD_RESET,
+  CMD_PASS,
+};
+
+enum {
+  READ4_ADDRESS = 0x3c,
+  JOYBUS_STATUS_READY = BIT(2),
+  DETAIL_TEXT = 48,
+};
+
+typedef struct {
+  u8 kind;
+  u8 address;
+  u8 data[64];
+} command;
+
+typedef struct {
+  u64 boundary;  // index in the baseline
+  u64 cycles;    // when injected
+  u64 wait;      // longest a request arriving before had to wait for it
+  u64 service;   // injection to transfer done (NMI for reset)
+  u64 reads;     // FNV-1a over the data of the scenario's own reads
+  u16 pc;
+  u16 waitPc;    // where that longest-waiting request arrived
+  u8 kind;
+  u8 phase;
+  u8 outcome;
+  bool serviced;
+  int rejoined;  // 1 + the command at whose sync() it met the baseline
+  char detail[DETAIL_TEXT];
+  u8 pifRam[64];
+} branchResult;
+
+command* commands;
+int commandCount;
+int nextCommand;
+
+u8 kinds = BIT(KIND_READ4) | BIT(KIND_READ64) | BIT(KIND_RESET);
+int jobs;
+u64 budget = 1 << 20;
+bool verbose;
+
+// shared with the branches, one slot each; slot 0 is the probe's
+branchResult* results;
+int maxBranches = 1 << 16;
+int branches;
+int running;
+
+// What this process is. The probe runs the baseline first, leaving the
+// state at each sync() for the branches: one that reaches a sync() in the
+// same state as the baseline would go on as it does, so it ends there.
+enum {
+  RUN_PROBE,
+  RUN_BASELINE,
+  RUN_BRANCH,
+};
+
+u8 run;
+branchResult* self;
+u64* syncStates;  // by the command sync() reads next, shared
+
+u64 boundaries;
+u16 pc;
+u16 prevPc;
+u64 syncCycles;
+u64 syncBoundaries;
+
+// masked window per kind: requests arriving since windowStart wait for the
+// next boundary that takes them
+bool accepting[KINDS];
+bool windowOpen[KINDS];
+u64 windowStart[KINDS];
+u16 windowPc[KINDS];
+
+// RCP transfer waiting for the model to reach halt()
+bool pending;
+bool pendingInjected;
+u64 pendingCycles;
+u8 xfer;
+u8 address;
+u8 length;
+u8 data[64];
+
+// joybus hardware, for the channel currently selected
+u8 channel;
+u8 tx[64];
+int txNibbles;
+u8 rx[64];
+int rxBytes;
+int rxNibbles;
+bool exchanged;
+bool noAnswer;
+
+u64 rngState = 0x2545f4914f6cdd1d;
+
+void mix(u64* h, u64 value) {
+  *h = (*h ^ value) * 0x100000001b3;
+}
+
+// End this run. The baseline reports; a branch leaves its slot behind.
+void report(void);
+
+void finish(u8 outcome, const char* detail) {
+  if (outcome == OUTCOME_OK && run == RUN_BRANCH && !self->serviced) {
+    bool waited = cycles - self->cycles > budget;
+    outcome = waited ? OUTCOME_DEADLOCK : OUTCOME_CUT;
+    detail = waited ? "injected request never serviced" : "scenario ended first";
+  }
+  self->outcome = outcome;
+  snprintf(self->detail, DETAIL_TEXT, "%s", detail);
+  for (int i = 0; i < 64; ++i)
+    self->pifRam[i] = RAM(RAM_EXTERNAL + i * 2) << 4 | RAM(RAM_EXTERNAL + i * 2 + 1);
+  if (run != RUN_BASELINE)
+    _exit(0);
+  report();
+}
+
+void deadlock(const char* why) {
+  char detail[DETAIL_TEXT];
+  snprintf(detail, sizeof(detail), "%s in %s", why, phaseNames[phase]);
+  finish(OUTCOME_DEADLOCK, detail);
+}
+
+void checkBudget(void) {
+  if (cycles - syncCycles > budget || boundaries - syncBoundaries > budget)
+    deadlock("no sync");
+}
+
+void joybusIdle(void) {
+  txNibbles = 0;
+  rxBytes = 0;
+  rxNibbles = 0;
+  exchanged = 0;
+}
+
+// a pad on channel 0 answering status and poll, nothing on the others
+void joybusExchange(void) {
+  rxBytes = -1;
+  if (channel == 0) {
+    static const u8 status[] = {0x05, 0x00, 0x01};
+    static const u8 poll[] = {0x00, 0x00, 0x12, 0x34};
+    if (txNibbles >= 2 && tx[0] == 0x01) {
+      rxBytes = sizeof(poll);
+      memcpy(rx, poll, sizeof(poll));
+    } else {
+      rxBytes = sizeof(status);
+      memcpy(rx, status, sizeof(status));
+    }
+  }
+  noAnswer = rxBytes < 0;
+  rxNibbles = 0;
+  exchanged = 1;
+}
+
+u8 readIO(u8 port) {
+  cycles += IO_CYCLES;
+  checkBudget();
+
+  switch (port) {
+    case PORT_JOYBUS_READ: {
+      if (!exchanged)
+        joybusExchange();  // no stop bit was sent
+      if (rxNibbles >= rxBytes * 2)
+        return 0;
+      u8 byte = rx[rxNibbles / 2];
+      return (rxNibbles++ & 1) ? byte & 0xf : byte >> 4;
+    }
+    case PORT_JOYBUS_STATUS:
+      if (exchanged && rxNibbles >= rxBytes * 2)
+        return JOYBUS_STATUS_CLOCK;
+      return JOYBUS_STATUS_CLOCK | JOYBUS_STATUS_READY;
+    case PORT_JOYBUS_ERROR:
+      return noAnswer ? JOYBUS_ERROR_NOANSWER : 0;
+    case PORT_JOYBUS_CHANNEL:
+      return channel;
+    case PORT_RCP_XFER:
+      return xfer;
+    case PORT_RESET:
+      return RESET_BUTTON;
+    case PORT_RNG:
+      rngState ^= rngState << 13;
+      rngState ^= rngState >> 7;
+      rngState ^= rngState << 17;
+      return (rngState & 0xf) ? 0 : RNG_DATA;
+    default:
+      return 0;
+  }
+}
+
+void writeIO(u8 port, u8 value) {
+  cycles += IO_CYCLES;
+  checkBudget();
+
+  switch (port) {
+    case REG_INT_EN:
+      RE = value;
+      break;
+    case PORT_JOYBUS_CHANNEL:
+      channel = value;
+      joybusIdle();
+      break;
+    case PORT_JOYBUS_WRITE:
+      if (txNibbles < 2 * (int)sizeof(tx)) {
+        if (txNibbles & 1)
+          tx[txNibbles / 2] |= value & 0xf;
+        else
+          tx[txNibbles / 2] = value << 4;
+        ++txNibbles;
+      }
+      break;
+    case PORT_JOYBUS_CTRL:
+      if (value == JOYBUS_CTRL_WRITESTOPBIT)
+        joybusExchange();
+      else
+        joybusIdle();
+      break;
+    case PORT_JOYBUS_ERROR:
+      noAnswer = 0;
+      break;
+    case PORT_RESET:
+      if (run == RUN_BRANCH && self->kind == KIND_RESET && value == (RESET_BUTTON | RESET_CPU_NMI)) {
+        self->service = cycles - self->cycles;
+        self->serviced = 1;
+        finish(OUTCOME_OK, "");
+      }
+      break;
+  }
+}
+
+// The RCP transfer runs while the model waits for the second interrupt.
+void halt(void) {
+  if (!pending)
+    deadlock("halt with no transfer");
+
+  u8 b = RAM_EXTERNAL + address * 2;
+  for (int i = 0; i < length; ++i) {
+    if (xfer & RCP_XFER_READ) {
+      data[i] = RAM(b + i * 2) << 4 | RAM(b + i * 2 + 1);
+      if (!pendingInjected)
+        mix(&self->reads, data[i]);
+    } else {
+      externalWrite(address * 2 + i * 2, data[i] >> 4);
+      externalWrite(address * 2 + i * 2 + 1, data[i] & 0xf);
+    }
+  }
+  if (pendingInjected) {
+    self->service = cycles - self->cycles;
+    self->serviced = 1;
+  }
+  pending = 0;
+  pendingInjected = 0;
+}
+
+void request(u8 kind, u8 at, u8 n, const u8* bytes, bool injected) {
+  pending = 1;
+  pendingCycles = cycles;
+  pendingInjected = injected;
+  xfer = kind;
+  address = at & 0x3f;
+  length = n;
+  if (bytes)
+    memcpy(data, bytes, n);
+  IFA = 1;
+}
+
+bool readCommand(void) {
+  if (nextCommand == commandCount)
+    finish(OUTCOME_OK, "");
+
+  // the RCP holds the next transfer until the last one is serviced
+  const command* c = &commands[nextCommand];
+  if (pending && c->kind != CMD_RESET && c->kind != CMD_PASS) {
+    if (cycles - pendingCycles > budget)
+      deadlock("transfer not serviced");
+    return true;
+  }
+  ++nextCommand;
+  switch (c->kind) {
+    case CMD_W4:
+      request(0, c->address, 4, c->data, 0);
+      break;
+    case CMD_W64:
+      request(RCP_XFER_64B, 0, 64, c->data, 0);
+      break;
+    case CMD_R4:
+      request(RCP_XFER_READ, READ4_ADDRESS, 4, NULL, 0);
+      break;
+    case CMD_R64:
+      request(RCP_XFER_READ | RCP_XFER_64B, 0, 64, NULL, 0);
+      break;
+    case CMD_RESET:
+      IFB = 1;
+      break;
+    case CMD_PASS:
+      return true;
+  }
+  return false;
+}
+
+// Everything the rest of the run depends on but the time. The call stack is
+// told apart by where sync() was called from and how deep.
+u64 syncState(void* caller, void* frame) {
+  u64 h = 0xcbf29ce484222325;
+  mix(&h, (uintptr_t)caller);
+  mix(&h, (uintptr_t)frame);
+  mix(&h, cicHleHash(hleCIC));
+  mix(&h, self->reads);
+  mix(&h, rngState);
+  mix(&h, reset << 8 | phase);
+  mix(&h, pending << 8 | xfer);
+  mix(&h, channel);
+  const u8* bytes[] = {(const u8*)&r, (const u8*)ram, (const u8*)&external};
+  const size_t sizes[] = {sizeof(r), sizeof(ram), sizeof(external)};
+  for (int i = 0; i < 3; ++i) {
+    for (size_t j = 0; j < sizes[i]; ++j)
+      mix(&h, bytes[i][j]);
+  }
+  return h;
+}
+
+void sync(void) {
+  watchScan(WATCH_HARNESS);
+  syncCycles = cycles;
+  syncBoundaries = boundaries;
+  if (run == RUN_PROBE) {
+    syncStates[nextCommand] = syncState(__builtin_return_address(0), __builtin_frame_address(0));
+  } else if (run == RUN_BRANCH && self->serviced && !pending &&
+             syncState(__builtin_return_address(0), __builtin_frame_address(0)) == syncStates[nextCommand]) {
+    self->rejoined = nextCommand + 1;
+    finish(OUTCOME_OK, "");
+  }
+  while (!readCommand())
+    checkInterrupt();
+}
+
+void fatalError(void) {
+  char detail[DETAIL_TEXT];
+  snprintf(detail, sizeof(detail), "signalError after %02x:%02x in %s", prevPc >> 6, prevPc & 0x3f,
+           phaseNames[phase]);
+  finish(OUTCOME_ERROR, detail);
+}
+
+void notImpl(u8 pu, u8 pl) {
+  char detail[DETAIL_TEXT];
+  snprintf(detail, sizeof(detail), "not impl %x:%02x", pu, pl);
+  finish(OUTCOME_ERROR, detail);
+}
+
+// In the copy: raise the interrupt here, where the baseline didn't.
+void inject(int slot, u8 kind) {
+  run = RUN_BRANCH;
+  self = &results[slot];
+  if (kind == KIND_RESET)
+    IFB = 1;
+  else
+    request(RCP_XFER_READ | (kind == KIND_READ64 ? RCP_XFER_64B : 0), READ4_ADDRESS,
+            kind == KIND_READ64 ? 64 : 4, NULL, 1);
+  checkInterrupt();
+}
+
+void branch(u8 kind) {
+  if (branches == maxBranches)
+    return;
+  while (running >= jobs) {
+    wait(NULL);
+    --running;
+  }
+
+  int slot = ++branches;
+  branchResult* b = &results[slot];
+  memset(b, 0, sizeof(*b));
+  b->boundary = boundaries;
+  b->cycles = cycles;
+  b->pc = pc;
+  b->kind = kind;
+  b->phase = phase;
+  b->reads = self->reads;
+  b->outcome = OUTCOME_DEADLOCK;
+  strcpy(b->detail, "branch did not finish");
+  if (windowOpen[kind]) {
+    b->wait = cycles - windowStart[kind];
+    b->waitPc = windowPc[kind];
+  } else {
+    b->waitPc = pc;
+  }
+
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    printf("cannot fork\n");
+    exit(3);
+  }
+  if (pid == 0) {
+    inject(slot, kind);
+    return;
+  }
+  ++running;
+}
+
+// Called at every boundary, from COVER() and sync().
+void boundary(u16 at) {
+  prevPc = pc;
+  pc = at;
+  ++boundaries;
+  checkBudget();
+  if (run != RUN_BASELINE)
+    return;
+
+  for (u8 kind = 0; kind < KINDS; ++kind) {
+    if (!(kinds & BIT(kind)))
+      continue;
+    bool enabled = RE & (kind == KIND_RESET ? INT_B_EN : INT_A_EN);
+    if (kind != KIND_RESET && pending)
+      enabled = 0;
+    if (!enabled) {
+      accepting[kind] = 0;
+      windowOpen[kind] = 0;
+    } else if (IME) {
+      branch(kind);
+      if (run == RUN_BRANCH)
+        return;
+      accepting[kind] = 1;
+      windowOpen[kind] = 0;
+    } else if (accepting[kind] && !windowOpen[kind]) {
+      windowOpen[kind] = 1;
+      windowStart[kind] = cycles;
+      windowPc[kind] = pc;
+    }
+  }
+}
+
+// padded, sync takes the width of a ROM address to keep columns
+void printPC(u16 at, bool pad) {
+  if (at == WATCH_HARNESS)
+    printf(pad ? "sync " : "sync");
+  else
+    printf("%02x:%02x", at >> 6, at & 0x3f);
+}
+
+int byGroup(const void* a, const void* b) {
+  const branchResult* x = a;
+  const branchResult* y = b;
+  if (x->kind != y->kind)
+    return x->kind - y->kind;
+  if (x->outcome != y->outcome)
+    return y->outcome - x->outcome;
+  if (x->pc != y->pc)
+    return x->pc - y->pc;
+  int d = strcmp(x->detail, y->detail);
+  if (d)
+    return d;
+  return x->boundary < y->boundary ? -1 : x->boundary > y->boundary;
+}
+
+bool sameGroup(const branchResult* x, const branchResult* y) {
+  return x->kind == y->kind && x->outcome == y->outcome && x->pc == y->pc && !strcmp(x->detail, y->detail);
+}
+
+void report(void) {
+  while (running) {
+    wait(NULL);
+    --running;
+  }
+
+  const branchResult* base = &results[0];
+
+  // outcomes against the baseline
+  for (int i = 1; i <= branches; ++i) {
+    branchResult* b = &results[i];
+    if (b->outcome != OUTCOME_OK || b->kind == KIND_RESET || b->rejoined)
+      continue;
+    if (b->reads != base->reads) {
+      b->outcome = OUTCOME_CORRUPT;
+      strcpy(b->detail, "scenario reads differ");
+    } else {
+      for (int j = 0; j < 64; ++j) {
+        if (b->pifRam[j] != base->pifRam[j]) {
+          b->outcome = OUTCOME_CORRUPT;
+          snprintf(b->detail, DETAIL_TEXT, "PIF-RAM %02x is %02x, not %02x", j, b->pifRam[j], base->pifRam[j]);
+          break;
+        }
+      }
+    }
+  }
+
+  if (verbose) {
+    for (int i = 1; i <= branches; ++i) {
+      const branchResult* b = &results[i];
+      printf("%-5s %8llu ", kindNames[b->kind], (unsigned long long)b->boundary);
+      printPC(b->pc, true);
+      printf(" %-14s cycle %-8llu %-8s service %llu%s%s\n", phaseNames[b->phase], (unsigned long long)b->cycles,
+             outcomeNames[b->outcome], (unsigned long long)b->service, b->detail[0] ? " " : "", b->detail);
+    }
+  }
+
+  printf("baseline: %llu boundaries, %d commands, %llu cycles, %d branches%s\n", (unsigned long long)boundaries,
+         commandCount, (unsigned long long)cycles, branches, branches == maxBranches ? " (limit reached)" : "");
+
+  int failed = 0;
+  for (u8 kind = 0; kind < KINDS; ++kind) {
+    if (!(kinds & BIT(kind)))
+      continue;
+    int counts[OUTCOMES] = {0};
+    const branchResult* worst = NULL;
+    for (int i = 1; i <= branches; ++i) {
+      const branchResult* b = &results[i];
+      if (b->kind != kind)
+        continue;
+      ++counts[b->outcome];
+      if (b->serviced && (!worst || b->wait + b->service > worst->wait + worst->service))
+        worst = b;
+    }
+    printf("%s:", kindNames[kind]);
+    for (int o = 0; o < OUTCOMES; ++o)
+      printf(" %d %s%s", counts[o], outcomeNames[o], o + 1 < OUTCOMES ? "," : "\n");
+    failed += counts[OUTCOME_ERROR] + counts[OUTCOME_DEADLOCK] + counts[OUTCOME_CORRUPT];
+    if (worst) {
+      printf("  worst latency %llu cycles: arriving at ", (unsigned long long)(worst->wait + worst->service));
+      printPC(worst->waitPc, false);
+      printf(", taken at ");
+      printPC(worst->pc, false);
+      printf(" (%s, cycle %llu), %llu waiting\n", phaseNames[worst->phase], (unsigned long long)worst->cycles,
+             (unsigned long long)worst->wait);
+    }
+  }
+
+  // the failures, one line per kind, outcome, boundary and detail
+  qsort(results + 1, branches, sizeof(branchResult), byGroup);
+  for (int i = 1; i <= branches;) {
+    const branchResult* b = &results[i];
+    int n = 1;
+    while (i + n <= branches && sameGroup(b, &results[i + n]))
+      ++n;
+    if (b->outcome >= OUTCOME_ERROR) {
+      printf("%-5s %-8s ", kindNames[b->kind], outcomeNames[b->outcome]);
+      printPC(b->pc, true);
+      printf(" x%-5d %s, first at boundary %llu (%s, cycle %llu)\n", n, b->detail,
+             (unsigned long long)b->boundary, phaseNames[b->phase], (unsigned long long)b->cycles);
+    }
+    i += n;
+  }
+
+  exit(failed ? 1 : 0);
+}
+
+// The commands of a cmodel trace, skipping port values and expectations.
+// An r64 whose first port value (PORT_RCP_XFER) has no 64B bit is a Read4B.
+FILE* input;
+
+bool scanToken(char* token) {
+  for (;;) {
+    if (1 != fscanf(input, "%31s", token))
+      return false;
+    if (token[0] != '#')
+      return true;
+    fscanf(input, "%*[^\n]");
+  }
+}
+
+unsigned scanValue(void) {
+  char token[32];
+  unsigned value;
+  if (!scanToken(token) || 1 != sscanf(token, "%x", &value)) {
+    printf("trace ended inside a command\n");
+    exit(4);
+  }
+  return value;
+}
+
+void loadTrace(const char* path, int limit) {
+  input = fopen(path, "r");
+  if (!input) {
+    printf("cannot open %s\n", path);
+    exit(4);
+  }
+
+  regionPAL = scanValue();
+  int capacity = 1024;
+  commands = malloc(capacity * sizeof(command));
+  int last = -1;  // the command before the next port value
+  char token[32];
+  while (scanToken(token) && commandCount != limit) {
+    if (commandCount == capacity) {
+      capacity *= 2;
+      commands = realloc(commands, capacity * sizeof(command));
+    }
+    if (!commands) {
+      printf("out of memory\n");
+      exit(3);
+    }
+
+    command* c = &commands[commandCount];
+    unsigned value;
+    if (!strcmp(token, "=w")) {
+      scanValue();
+      scanValue();
+      continue;
+    } else if (!strcmp(token, "=ram")) {
+      scanValue();
+      scanToken(token);
+      continue;
+    } else if (!strcmp(token, "w4")) {
+      c->kind = CMD_W4;
+      c->address = scanValue();
+      for (int i = 0; i < 4; ++i) {
+        u8 u = scanValue();
+        c->data[i] = u << 4 | (scanValue() & 0xf);
+      }
+    } else if (!strcmp(token, "w64")) {
+      c->kind = CMD_W64;
+      for (int i = 0; i < 64; ++i) {
+        u8 u = scanValue();
+        c->data[i] = u << 4 | (scanValue() & 0xf);
+      }
+    } else if (!strcmp(token, "r64")) {
+      c->kind = CMD_R64;
+    } else if (!strcmp(token, "reset")) {
+      c->kind = CMD_RESET;
+    } else if (!strcmp(token, "pass")) {
+      c->kind = CMD_PASS;
+    } else if (!strcmp(token, "q")) {
+      break;
+    } else if (1 == sscanf(token, "%x", &value)) {
+      if (last >= 0 && commands[last].kind == CMD_R64 && !(value & RCP_XFER_64B))
+        commands[last].kind = CMD_R4;
+      last = -1;
+      continue;
+    } else {
+      printf("unrecognized %s\n", token);
+      exit(4);
+    }
+    last = commandCount++;
+  }
+  fclose(input);
+}
+
+bool parseKinds(const char* text) {
+  kinds = 0;
+  char copy[64];
+  snprintf(copy, sizeof(copy), "%s", text);
+  for (char* name = strtok(copy, ","); name; name = strtok(NULL, ",")) {
+    u8 kind = 0;
+    while (kind < KINDS && strcmp(name, kindNames[kind]))
+      ++kind;
+    if (kind == KINDS)
+      return false;
+    kinds |= BIT(kind);
+  }
+  return kinds != 0;
+}
+
+int main(int argc, char* argv[]) {
+  int type = 6102;
+  int limit = -1;
+  jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+  int opt;
+  while ((opt = getopt(argc, argv, "C:k:j:n:b:m:v")) != -1) {
+    switch (opt) {
+      case 'C':
+        type = atoi(optarg);
+        break;
+      case 'k':
+        if (!parseKinds(optarg)) {
+          printf("unknown kinds %s\n", optarg);
+          exit(4);
+        }
+        break;
+      case 'j':
+        jobs = atoi(optarg);
+        break;
+      case 'n':
+        limit = atoi(optarg);
+        break;
+      case 'b':
+        budget = strtoull(optarg, NULL, 0);
+        break;
+      case 'm':
+        maxBranches = atoi(optarg);
+        break;
+      case 'v':
+        verbose = 1;
+        break;
+      default:
+        optind = argc;
+        break;
+    }
+  }
+  if (optind + 1 != argc || jobs < 1 || maxBranches < 1) {
+    printf("usage: %s [-C cic] [-k r4,r64,reset] [-j jobs] [-n commands] [-b budget] [-m max-branches] [-v] trace\n",
+           argv[0]);
+    exit(4);
+  }
+
+  loadTrace(argv[optind], limit);
+  hleCIC = cicHleCreate(type);
+  if (!hleCIC) {
+    printf("unknown cic %d\n", type);
+    exit(4);
+  }
+
+  results = mmap(NULL, sizeof(branchResult) * (maxBranches + 1), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                 -1, 0);
+  if (results == MAP_FAILED) {
+    printf("out of memory\n");
+    exit(3);
+  }
+  syncStates = mmap(NULL, sizeof(u64) * (commandCount + 1), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (syncStates == MAP_FAILED) {
+    printf("out of memory\n");
+    exit(3);
+  }
+  self = &results[0];
+  self->reads = 0xcbf29ce484222325;
+  self->outcome = OUTCOME_ERROR;
+  strcpy(self->detail, "crashed");
+
+  watch.armed = 1;
+  watch.scanned = boundary;
+  fflush(stdout);
+  pid_t probe = fork();
+  if (probe < 0) {
+    printf("cannot fork\n");
+    exit(3);
+  }
+  if (probe == 0)
+    start();
+  waitpid(probe, NULL, 0);
+  if (self->outcome != OUTCOME_OK) {
+    printf("baseline %s: %s\n", outcomeNames[self->outcome], self->detail);
+    exit(1);
+  }
+
+  // the baseline again, branching this time
+  static branchResult baseline;
+  baseline.reads = 0xcbf29ce484222325;
+  self = &baseline;
+  run = RUN_BASELINE;
+  start();
+  return 0;
+}
@@ -0,0 +1,100 @@
+#include "cmodel.h"
+#include "journal.h"
+
+#include <string.h>
+
+FILE* journal;
+u64 journalEvents;
+u64 journalCycles;
+rfile journalRegs;
+
+// the watchpoints armed before the journal, still reported
+void (*journalChain)(u8 address, u8 from, u8 to, u16 before, u16 after);
+u64 journalChainMask[4];
+
+void journalVarint(u64 value) {
+  while (value >= 0x80) {
+    putc((value & 0x7f) | 0x80, journal);
+    value >>= 7;
+  }
+  putc(value, journal);
+}
+
+void journalRam(u8 address, u8 from, u8 to, u16 before, u16 after) {
+  putc(JOURNAL_RAM, journal);
+  putc(address, journal);
+  putc(from << 4 | to, journal);
+  if (journalChain && (journalChainMask[address / 64] >> (address % 64) & 1))
+    journalChain(address, from, to, before, after);
+}
+
+void journalCheckpoint(void) {
+  putc(JOURNAL_CHECKPOINT, journal);
+  fwrite(&journalEvents, sizeof(journalEvents), 1, journal);
+  fwrite(&cycles, sizeof(cycles), 1, journal);
+  fwrite(&r, sizeof(r), 1, journal);
+  for (int i = 0; i < 256; i += 2)
+    putc(ram[i].l << 4 | ram[i + 1].l, journal);
+}
+
+void journalEvent(u16 pc) {
+  if (memcmp(&journalRegs, &r, sizeof(r))) {
+    putc(JOURNAL_REGS, journal);
+    fwrite(&journalRegs, sizeof(r), 1, journal);
+    fwrite(&r, sizeof(r), 1, journal);
+    journalRegs = r;
+  }
+
+  putc(JOURNAL_EVENT, journal);
+  putc(pc & 0xff, journal);
+  putc(pc >> 8, journal);
+  journalVarint(cycles - journalCycles);
+  journalCycles = cycles;
+  if (journalEvents % JOURNAL_CHECKPOINT_EVERY == 0)
+    journalCheckpoint();
+  ++journalEvents;
+}
+
+bool journalOpen(const char* path) {
+  journal = fopen(path, "wb");
+  if (!journal)
+    return false;
+  fwrite(JOURNAL_MAGIC, 4, 1, journal);
+
+  if (watch.armed) {
+    journalChain = watch.hit;
+    memcpy(journalChainMask, watch.mask, sizeof(watch.mask));
+  }
+  memset(watch.mask, 0xff, sizeof(watch.mask));
+  memcpy(watch.last, ram, sizeof(watch.last));
+  watch.hit = journalRam;
+  watch.scanned = journalEvent;
+  watch.pc = WATCH_HARNESS;
+  watch.armed = 1;
+
+  journalRegs = r;
+  journalCycles = cycles;
+  journalEvent(WATCH_HARNESS);
+  return true;
+}
+
+void journalPort(bool write, u8 port, u8 value) {
+  if (!journal)
+    return;
+  putc(JOURNAL_PORT, journal);
+  putc((port & 0xf) | (write ? JOURNAL_PORT_WRITE : 0), journal);
+  putc(value & 0xf, journal);
+}
+
+void journalClose(void) {
+  if (!journal)
+    return;
+  watchScan(WATCH_HARNESS);  // the last event's changes
+  fclose(journal);
+  journal = NULL;
+
+  memcpy(watch.mask, journalChainMask, sizeof(watch.mask));
+  watch.hit = journalChain;
+  watch.scanned = NULL;
+  watch.armed = journalChain != NULL;
+}
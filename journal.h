@@ -0,0 +1,39 @@
+#include <stdbool.h>
+#include <stdio.h>
+
+// Append-only journal of a model run, for rewind. Include after cmodel.h.
+//
+// An event is a routine entry (an instruction with the recompiled ROM) or
+// a harness sync point. The file is JOURNAL_MAGIC followed by records, each
+// a tag byte and its fields:
+//   JOURNAL_EVENT pc:2 cycles   pc as COVER() numbers it, or WATCH_HARNESS;
+//                               cycles since the last event, as a varint
+//   JOURNAL_RAM address change  a nibble changed, change = old << 4 | new
+//   JOURNAL_REGS old new        the register file changed (rfile each)
+//   JOURNAL_PORT port value     an access, port | JOURNAL_PORT_WRITE for writes
+//   JOURNAL_CHECKPOINT event:8 cycles:8 rfile ram:128
+//                               the whole state at the event before it,
+//                               RAM two nibbles per byte, every
+//                               JOURNAL_CHECKPOINT_EVERY events
+// The records after an event, up to the next one, are what it did. RAM and
+// register records carry the old values too, so a reader steps back by
+// undoing them, and jumps by way of the nearest checkpoint.
+
+#define JOURNAL_MAGIC "SMJ1"
+
+enum {
+  JOURNAL_EVENT = 1,
+  JOURNAL_RAM,
+  JOURNAL_REGS,
+  JOURNAL_PORT,
+  JOURNAL_CHECKPOINT,
+
+  JOURNAL_PORT_WRITE = BIT(4),
+  JOURNAL_CHECKPOINT_EVERY = 1 << 16,
+};
+
+// Start journaling to path, arming the watchpoints on all of RAM; -w
+// watchpoints armed before still report. False if path can't be created.
+bool journalOpen(const char* path);
+void journalPort(bool write, u8 port, u8 value);
+void journalClose(void);
@@ -0,0 +1,200 @@
+#include "joyenum.h"
+
+#include "cmodel.h"
+#include "cmodel_pif.h"
+
+#include <setjmp.h>
+#include <string.h>
+
+// Harness for one joyenum core, built once per PIF implementation with
+// -DJOYCORE=<entry point>. There is no boot: the PIF is put straight into
+// its main loop state and its interrupt handler is run for each transfer,
+// so only the joybus parse and transfer paths execute. The joybus hardware
+// is the one pif.c emulates, with fixed devices behind it.
+
+#ifndef JOYCORE
+#define JOYCORE joyModel
+#endif
+
+void interruptA(void);
+
+// Channel 0 answers 4 bytes like a pad, 1 a single byte, 2 has nothing
+// plugged in, 3 answers with nothing and 4 with 33 bytes, so each layout
+// meets short, long and missing answers.
+const int replyBytes[JOY_CHANNELS] = {4, 1, -1, 0, 33};
+
+MODEL_TLS jmp_buf exitRun;
+MODEL_TLS joyResult* result;
+
+// RCP transfer waiting for the model to reach halt()
+MODEL_TLS bool pending;
+MODEL_TLS u8 xfer;
+MODEL_TLS const u8* writeData;
+
+// joybus hardware, for the channel currently selected
+MODEL_TLS u8 channel;
+MODEL_TLS u8 tx[64];
+MODEL_TLS int txNibbles;
+MODEL_TLS u8 rx[64];
+MODEL_TLS int rxBytes;
+MODEL_TLS int rxNibbles;
+MODEL_TLS bool exchanged;
+MODEL_TLS bool noAnswer;
+
+void mix(u64 value) {
+  result->device = (result->device ^ value) * 0x100000001b3;
+}
+
+void joybusIdle(void) {
+  txNibbles = 0;
+  rxBytes = 0;
+  rxNibbles = 0;
+  exchanged = 0;
+}
+
+void joybusExchange(void) {
+  int n = txNibbles / 2;
+  mix(channel);
+  mix(n);
+  for (int i = 0; i < n; ++i)
+    mix(tx[i]);
+  ++result->exchanges;
+
+  rxBytes = channel < JOY_CHANNELS ? replyBytes[channel] : -1;
+  for (int i = 0; i < rxBytes; ++i)
+    rx[i] = (channel << 4) ^ i ^ (n ? tx[0] : 0);
+  noAnswer = rxBytes < 0;
+  rxNibbles = 0;
+  exchanged = 1;
+}
+
+u8 readIO(u8 port) {
+  cycles += IO_CYCLES;
+
+  switch (port) {
+    case PORT_JOYBUS_READ: {
+      if (!exchanged)
+        joybusExchange();  // no stop bit was sent
+      if (rxNibbles >= rxBytes * 2)
+        return 0;
+      u8 byte = rx[rxNibbles / 2];
+      return (rxNibbles++ & 1) ? byte & 0xf : byte >> 4;
+    }
+    case PORT_JOYBUS_STATUS:
+      if (exchanged && rxNibbles >= rxBytes * 2)
+        return JOYBUS_STATUS_CLOCK;
+      return JOYBUS_STATUS_CLOCK | BIT(2);
+    case PORT_JOYBUS_ERROR:
+      return noAnswer ? JOYBUS_ERROR_NOANSWER : 0;
+    case PORT_JOYBUS_CHANNEL:
+      return channel;
+    case PORT_RCP_XFER:
+      return xfer;
+    default:
+      return 0;
+  }
+}
+
+void writeIO(u8 port, u8 value) {
+  cycles += IO_CYCLES;
+
+  switch (port) {
+    case REG_INT_EN:
+      RE = value;
+      break;
+    case PORT_JOYBUS_CHANNEL:
+      channel = value;
+      joybusIdle();
+      break;
+    case PORT_JOYBUS_WRITE:
+      if (txNibbles < 2 * (int)sizeof(tx)) {
+        if (txNibbles & 1)
+          tx[txNibbles / 2] |= value & 0xf;
+        else
+          tx[txNibbles / 2] = value << 4;
+        ++txNibbles;
+      }
+      break;
+    case PORT_JOYBUS_CTRL:
+      if (value == JOYBUS_CTRL_WRITESTOPBIT) {
+        joybusExchange();
+      } else {
+        if (value == 3)
+          mix(0x100 | channel);
+        joybusIdle();
+      }
+      break;
+    case PORT_JOYBUS_ERROR:
+      noAnswer = 0;
+      break;
+  }
+}
+
+// The RCP transfer runs while the model waits for the second interrupt.
+void halt(void) {
+  if (!pending)
+    return;
+
+  for (int i = 0; i < 64; ++i) {
+    if (xfer & RCP_XFER_READ) {
+      result->block[i] = RAM(RAM_EXTERNAL + i * 2) << 4 | RAM(RAM_EXTERNAL + i * 2 + 1);
+    } else {
+      externalWrite(i * 2, writeData[i] >> 4);
+      externalWrite(i * 2 + 1, writeData[i] & 0xf);
+    }
+  }
+  pending = 0;
+}
+
+// The interrupt handler never waits for a command.
+void sync(void) {
+  fatalError();
+}
+
+void fatalError(void) {
+  longjmp(exitRun, 1);
+}
+
+void notImpl(u8 pu, u8 pl) {
+  (void)pu;
+  (void)pl;
+  fatalError();
+}
+
+// take the RCP interrupt for one 64-byte transfer
+bool transfer(u8 kind) {
+  pending = 1;
+  xfer = kind;
+  IME = 0;
+  if (setjmp(exitRun)) {
+    result->frozen = 1;
+    return false;
+  }
+  interruptA();
+  return !pending;
+}
+
+void JOYCORE(const u8 block[64], joyResult* out) {
+  memset(out, 0, sizeof(*out));
+  out->device = 0xcbf29ce484222325;
+  result = out;
+  writeData = block;
+
+  // main loop state after boot
+  memset(&r, 0, sizeof(r));
+  memset(ram, 0, sizeof(ram));
+  memset(&external, 0, sizeof(external));
+  external.dirty = EXTERNAL_ALL;
+  RAM_BIT_SET(STATUS, STATUS_RUNNING);
+  RE = INT_A_EN | INT_B_EN;
+  SB = SAVE_A;
+
+  if (!transfer(RCP_XFER_64B))
+    return;
+  for (int n = 0; n < JOY_CHANNELS; ++n) {
+    out->status[n] = RAM(JOYBUS_STATUS + n);
+    out->frame[n] = RAM(JOYBUS_ADDR_U + n) << 4 | RAM(JOYBUS_ADDR_L + n);
+  }
+
+  transfer(RCP_XFER_READ | RCP_XFER_64B);
+}
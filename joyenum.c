@@ -0,0 +1,403 @@
+#include "joyenum.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Enumerate the joybus command blocks that joybusCommandParse() can tell
+// apart, and run the parse (Write64B) and the transfer (Read64B) of each on
+// every core, reporting the channel tables and where the cores disagree.
+//
+// A layout is the sequence of frames from byte 0, written as
+//   00 fd fe ff     the 1-byte commands
+//   TX:RX           a frame with these TX and RX bytes
+// Payload bytes don't matter to the parse, so they are a fixed pattern, and
+// byte 63 is always 01 (the joybus command bit). Frames come in size classes:
+// TX length 0, 1, 3 or 60, under each combination of the top two bits, and
+// RX length 0, 1, 4 or 63, or what makes the frame end at byte 63 or 64 (the
+// next >= 0x100 abort), with the top two bits clear or set.
+//
+// Layouts that leave the parse on the same channel at the same byte go on
+// alike, so each (channel, byte) state is reached by one prefix only, and
+// every class is tried once from it, followed by fe if the parse would go on.
+// The devices behind the channels are fixed, see joycore.c.
+//
+// The report lists each distinct channel table with the number of layouts
+// giving it and one of them. A channel is shown as its JOYBUS_STATUS nibble,
+// followed by @ and the byte offset of its frame when it isn't skipped. -v
+// adds a line per layout. joyenum_rom also runs the recompiled NTSC ROM, and
+// every layout where it differs from cmodel.c is reported.
+//
+// -H checks the libpif.a fast path (pif_set_hle()) instead, on the layouts it
+// claims: each channel skipped (00) or holding a status (00, ff) or poll (01)
+// frame with TX length 1, under each combination of the RX top bits, a poll
+// also after an ff, up to a fe or the fifth channel. Each layout goes through
+// libpif once with the fast path and once with the model doing the transfer
+// (see joypif.c), and every layout where they differ is reported, as is any
+// the fast path turns down.
+
+enum {
+  STATES = JOY_CHANNELS * 63,
+  LAYOUT_TEXT = 256,
+  TABLE_TEXT = 64,
+  TABLE_SLOTS = 1 << 14,
+
+  STATUS_RESET = 1 << 0,
+  STATUS_SKIP = 1 << 3,
+};
+
+typedef struct {
+  const char* name;
+  joyCore* run;
+} core;
+
+const core cores[] = {
+    {"model", joyModel},
+#ifdef JOYENUM_ROM
+    {"rom", joyRom},
+#endif
+};
+
+enum {
+  CORES = sizeof(cores) / sizeof(cores[0]),
+};
+
+typedef struct {
+  bool seen;
+  uint8_t block[64];
+  char text[LAYOUT_TEXT];
+} state;
+
+// parse states by channel and byte, in the order they were reached
+state states[STATES];
+int queue[STATES];
+int queued;
+
+typedef struct {
+  uint8_t key[2 * JOY_CHANNELS];
+  int count;
+  char example[LAYOUT_TEXT];
+} table;
+
+table tables[TABLE_SLOTS];
+int tableCount;
+
+bool verbose;
+int layouts;
+int divergences;
+int declined;
+
+const int txLengths[] = {0, 1, 3, 60};
+const int rxLengths[] = {0, 1, 4, 63};
+const uint8_t tops[] = {0x00, 0x40, 0x80, 0xc0};
+
+// the channel table, as it decides the transfer
+void tableKey(const joyResult* r, uint8_t* key) {
+  for (int n = 0; n < JOY_CHANNELS; ++n) {
+    key[2 * n] = r->status[n];
+    key[2 * n + 1] = r->status[n] & STATUS_SKIP ? 0 : r->frame[n];
+  }
+}
+
+void tableText(const joyResult* r, char* text) {
+  if (r->frozen) {
+    strcpy(text, "frozen");
+    return;
+  }
+  int len = 0;
+  for (int n = 0; n < JOY_CHANNELS; ++n) {
+    len += sprintf(text + len, "%s%x", n ? " " : "", r->status[n]);
+    if (!(r->status[n] & STATUS_SKIP))
+      len += sprintf(text + len, "@%02x", (uint8_t)(r->frame[n] - 0x80) / 2);
+  }
+}
+
+uint64_t blockHash(const uint8_t* block) {
+  uint64_t h = 0xcbf29ce484222325;
+  for (int i = 0; i < 64; ++i)
+    h = (h ^ block[i]) * 0x100000001b3;
+  return h;
+}
+
+void countTable(const joyResult* r, const char* layout) {
+  uint8_t key[2 * JOY_CHANNELS];
+  tableKey(r, key);
+  uint64_t h = 0xcbf29ce484222325;
+  for (size_t i = 0; i < sizeof(key); ++i)
+    h = (h ^ key[i]) * 0x100000001b3;
+
+  unsigned slot = h % TABLE_SLOTS;
+  while (tables[slot].count && memcmp(tables[slot].key, key, sizeof(key)))
+    slot = (slot + 1) % TABLE_SLOTS;
+  if (!tables[slot].count) {
+    if (tableCount == TABLE_SLOTS - 1) {
+      printf("too many channel tables\n");
+      exit(3);
+    }
+    ++tableCount;
+    memcpy(tables[slot].key, key, sizeof(key));
+    strcpy(tables[slot].example, layout);
+  }
+  ++tables[slot].count;
+}
+
+void diverge(const char* layout, const core* other, const joyResult* a, const joyResult* b) {
+  char ta[TABLE_TEXT], tb[TABLE_TEXT];
+  tableText(a, ta);
+  tableText(b, tb);
+  printf("diverge %s: %s", layout, other->name);
+  if (a->frozen != b->frozen || memcmp(a->status, b->status, sizeof(a->status)) ||
+      memcmp(a->frame, b->frame, sizeof(a->frame)))
+    printf(" table {%s} vs {%s}", tb, ta);
+  if (memcmp(a->block, b->block, sizeof(a->block)))
+    printf(" block %016llx vs %016llx", (unsigned long long)blockHash(b->block),
+           (unsigned long long)blockHash(a->block));
+  if (a->device != b->device || a->exchanges != b->exchanges)
+    printf(" device %d vs %d exchanges", b->exchanges, a->exchanges);
+  printf("\n");
+  ++divergences;
+}
+
+void run(const uint8_t* block, const char* layout) {
+  joyResult results[CORES];
+  for (int i = 0; i < CORES; ++i)
+    cores[i].run(block, &results[i]);
+  ++layouts;
+
+  const joyResult* model = &results[0];
+  countTable(model, layout);
+  if (verbose) {
+    char text[TABLE_TEXT];
+    tableText(model, text);
+    printf("%-40s {%s} %016llx %016llx\n", layout, text, (unsigned long long)blockHash(model->block),
+           (unsigned long long)model->device);
+  }
+  for (int i = 0; i < CORES; ++i) {
+    if (results[i].frozen)
+      printf("frozen %s: %s\n", layout, cores[i].name);
+  }
+  for (int i = 1; i < CORES; ++i) {
+    if (memcmp(model, &results[i], sizeof(*model)))
+      diverge(layout, &cores[i], model, &results[i]);
+  }
+}
+
+// Place one token at byte p after the prefix of state s. Runs the layout,
+// and queues the state it leads to if the parse goes on from there.
+void step(const state* s, int p, int nextN, int nextP, const uint8_t* bytes, int len) {
+  state next;
+  memcpy(next.block, s->block, sizeof(next.block));
+  memcpy(next.block + p, bytes, len);
+  next.block[63] = 0x01;
+
+  int used = strlen(s->text);
+  int written;
+  if (len == 1)
+    written = snprintf(next.text, LAYOUT_TEXT, "%s%s%02x", s->text, used ? " " : "", bytes[0]);
+  else
+    written = snprintf(next.text, LAYOUT_TEXT, "%s%s%02x:%02x", s->text, used ? " " : "", bytes[0], bytes[1]);
+  if (written >= LAYOUT_TEXT) {
+    printf("layout too long\n");
+    exit(3);
+  }
+
+  bool live = nextN < JOY_CHANNELS && nextP < 63;
+  if (!live) {
+    run(next.block, next.text);
+    return;
+  }
+
+  // the same layout, ended here
+  uint8_t ended[64];
+  memcpy(ended, next.block, sizeof(ended));
+  ended[nextP] = 0xfe;
+  char text[LAYOUT_TEXT + 4];
+  snprintf(text, sizeof(text), "%s fe", next.text);
+  run(ended, text);
+
+  int id = nextN * 63 + nextP;
+  if (!states[id].seen) {
+    states[id] = next;
+    states[id].seen = 1;
+    queue[queued++] = id;
+  }
+}
+
+// every token class from state s
+void expand(int id) {
+  const state* s = &states[id];
+  int n = id / 63;
+  int p = id % 63;
+
+  uint8_t skip = 0x00, reset = 0xfd, stop = 0xfe, nop = 0xff;
+  step(s, p, n + 1, p + 1, &skip, 1);
+  step(s, p, n + 1, p + 1, &reset, 1);
+  step(s, p, JOY_CHANNELS, 63, &stop, 1);
+  step(s, p, n, p + 1, &nop, 1);
+  if (p > 61)
+    return;
+
+  for (size_t t = 0; t < sizeof(tops); ++t) {
+    for (size_t i = 0; i < sizeof(txLengths) / sizeof(txLengths[0]); ++i) {
+      int tx = txLengths[i];
+      if (!tops[t] && !tx)
+        continue;  // 00
+
+      // the fixed classes, then ending at byte 63 and at byte 64
+      int rxs[6];
+      int count = 0;
+      for (size_t j = 0; j < sizeof(rxLengths) / sizeof(rxLengths[0]); ++j)
+        rxs[count++] = rxLengths[j];
+      for (int end = 63; end <= 64; ++end) {
+        int rx = end - p - 2 - tx;
+        bool known = rx < 0 || rx > 63;
+        for (int j = 0; j < count && !known; ++j)
+          known = rxs[j] == rx;
+        if (!known)
+          rxs[count++] = rx;
+      }
+
+      for (int j = 0; j < count; ++j) {
+        for (int k = 0; k < 2; ++k) {
+          uint8_t bytes[2] = {tops[t] | tx, (k ? 0xc0 : 0x00) | rxs[j]};
+          int q = p + 2 + tx + rxs[j];
+          step(s, p, q < 64 ? n + 1 : JOY_CHANNELS, q < 64 ? q : 63, bytes, 2);
+        }
+      }
+    }
+  }
+}
+
+// one -H layout, both ways
+void runPif(const uint8_t* block, const char* layout) {
+  static const core fast = {"hle", NULL};
+  joyResult model, hle;
+  joyPif(block, &model, false);
+  if (!joyPif(block, &hle, true)) {
+    printf("declined %s\n", layout);
+    ++declined;
+  }
+  ++layouts;
+
+  if (verbose)
+    printf("%-40s %016llx %016llx\n", layout, (unsigned long long)blockHash(model.block),
+           (unsigned long long)model.device);
+  if (memcmp(&model, &hle, sizeof(model)))
+    diverge(layout, &fast, &model, &hle);
+}
+
+// Frames of the -H layouts from channel n at byte p, block and text holding
+// the ones before.
+void expandPif(uint8_t* block, char* text, int n, int p) {
+  int used = strlen(text);
+  char* end = text + used;
+  const char* space = used ? " " : "";
+
+  if (n == JOY_CHANNELS) {
+    runPif(block, text);
+    return;
+  }
+
+  // ended here, or skipped
+  uint8_t saved = block[p];
+  block[p] = 0xfe;
+  sprintf(end, "%sfe", space);
+  runPif(block, text);
+  block[p] = 0x00;
+  sprintf(end, "%s00", space);
+  expandPif(block, text, n + 1, p + 1);
+  block[p] = saved;
+
+  const uint8_t commands[] = {0x00, 0xff, 0x01};
+  for (size_t c = 0; c < sizeof(commands); ++c) {
+    int rx = commands[c] == 0x01 ? 4 : 3;
+    for (size_t t = 0; t < sizeof(tops); ++t) {
+      for (int nop = 0; nop < (commands[c] == 0x01 && !tops[t] ? 2 : 1); ++nop) {
+        uint8_t frame[4] = {0xff, 0x01, tops[t] | rx, commands[c]};
+        const uint8_t* bytes = frame + !nop;
+        int len = 3 + nop;
+        if (p + len + rx > 63)
+          continue;
+
+        uint8_t kept[4];
+        memcpy(kept, block + p, len);
+        memcpy(block + p, bytes, len);
+        int at = sprintf(end, "%s", space);
+        for (int i = 0; i < len; ++i)
+          at += sprintf(end + at, "%s%02x", i ? ":" : "", bytes[i]);
+        expandPif(block, text, n + 1, p + len + rx);
+        memcpy(block + p, kept, len);
+      }
+    }
+  }
+  *end = 0;
+}
+
+int byCount(const void* a, const void* b) {
+  const table* x = a;
+  const table* y = b;
+  if (x->count != y->count)
+    return y->count - x->count;
+  return memcmp(x->key, y->key, sizeof(x->key));
+}
+
+int main(int argc, char* argv[]) {
+  int opt;
+  bool pif = 0;
+  while ((opt = getopt(argc, argv, "vH")) != -1) {
+    switch (opt) {
+      case 'v':
+        verbose = 1;
+        break;
+      case 'H':
+        pif = 1;
+        break;
+      default:
+        printf("usage: %s [-v] [-H]\n", argv[0]);
+        exit(4);
+    }
+  }
+
+  if (pif) {
+    uint8_t block[64];
+    for (int i = 0; i < 64; ++i)
+      block[i] = 0x5a ^ i;
+    block[63] = 0x01;
+    char text[LAYOUT_TEXT] = "";
+    expandPif(block, text, 0, 0);
+    printf("%d layouts on libpif: %d declined by the fast path, %d divergences\n", layouts, declined,
+           divergences);
+    return divergences || declined ? 1 : 0;
+  }
+
+  state* first = &states[0];
+  first->seen = 1;
+  for (int i = 0; i < 64; ++i)
+    first->block[i] = 0x5a ^ i;
+  queue[queued++] = 0;
+  for (int i = 0; i < queued; ++i)
+    expand(queue[i]);
+
+  // most common tables first
+  int used = 0;
+  for (int i = 0; i < TABLE_SLOTS; ++i) {
+    if (tables[i].count)
+      tables[used++] = tables[i];
+  }
+  qsort(tables, used, sizeof(table), byCount);
+  for (int i = 0; i < used; ++i) {
+    joyResult r = {0};
+    for (int n = 0; n < JOY_CHANNELS; ++n) {
+      r.status[n] = tables[i].key[2 * n];
+      r.frame[n] = tables[i].key[2 * n + 1];
+    }
+    char text[TABLE_TEXT];
+    tableText(&r, text);
+    printf("table %6d {%s} %s\n", tables[i].count, text, tables[i].example);
+  }
+
+  printf("%d layouts from %d parse states on %d core%s: %d channel tables, %d divergences\n", layouts,
+         queued, CORES, CORES > 1 ? "s" : "", tableCount, divergences);
+  return divergences ? 1 : 0;
+}
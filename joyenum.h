@@ -0,0 +1,36 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+// One joybus core for joyenum: a PIF implementation (cmodel.c, or the ROM
+// recompiled by recompiler.py) with the joycore.c harness, linked into one
+// object that exports only its entry point.
+
+enum {
+  JOY_CHANNELS = 5,
+};
+
+typedef struct {
+  // joybus channel table after the w64 parse: the JOYBUS_STATUS nibble and
+  // the JOYBUS_ADDR byte (frame pointer, or scratch) of each channel
+  uint8_t status[JOY_CHANNELS];
+  uint8_t frame[JOY_CHANNELS];
+  // PIF-RAM the r64 returned
+  uint8_t block[64];
+  // FNV-1a over the exchanges and resets the devices saw, in order
+  uint64_t device;
+  int exchanges;
+  bool frozen;
+} joyResult;
+
+// Write block with Write64B, then transfer it with Read64B, on a PIF that
+// is in its main loop.
+typedef void joyCore(const uint8_t block[64], joyResult* out);
+
+joyCore joyModel;
+joyCore joyRom;
+
+// The same through libpif.a, with its fast path for standard layouts
+// (pif_set_hle()) on or off. Only the r64 block, the device traffic and
+// whether the PIF froze are known; the channel table stays 0. True if the
+// fast path took the Read64B.
+bool joyPif(const uint8_t block[64], joyResult* out, bool hle);
@@ -0,0 +1,105 @@
+#include "joyenum.h"
+#include "pif.h"
+
+#include "cmodel.h"
+#include "cmodel_cic.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The libpif core for joyenum -H, linked with libpif.a into one object
+// exporting only joyPif(). There is one PIF per mode, booted once with the
+// high-level 6102 and then kept in its main loop; each block is written with
+// pif_write64() and read back with pif_read64(). The devices are the ones
+// joycore.c has, behind pif_devices callbacks instead of the shift hardware.
+
+// as in joycore.c
+const int replyBytes[JOY_CHANNELS] = {4, 1, -1, 0, 33};
+
+pif* pifs[2];
+joyResult* result;
+
+void mix(uint64_t value) {
+  result->device = (result->device ^ value) * 0x100000001b3;
+}
+
+int joybus(void* user, int channel, const uint8_t* tx, int txLen, uint8_t* rx) {
+  (void)user;
+  mix(channel);
+  mix(txLen);
+  for (int i = 0; i < txLen; ++i)
+    mix(tx[i]);
+  ++result->exchanges;
+
+  int rxBytes = channel < JOY_CHANNELS ? replyBytes[channel] : -1;
+  for (int i = 0; i < rxBytes; ++i)
+    rx[i] = (channel << 4) ^ i ^ (txLen ? tx[0] : 0);
+  return rxBytes;
+}
+
+void joybusReset(void* user, int channel) {
+  (void)user;
+  mix(0x100 | channel);
+}
+
+void pifCommand(pif* p, uint8_t command) {
+  uint8_t word[4] = {0, 0, 0, command};
+  pif_write(p, 0x3c, word);
+  pif_step(p, 1);
+}
+
+// the CPU side of a boot, as in cosim.c
+pif* boot(void) {
+  static const pif_devices devices = {.joybus = joybus, .joybusReset = joybusReset};
+  pif* p = pif_create(&devices, false);
+  if (!p || !pif_set_cic(p, 6102)) {
+    printf("cannot create a PIF\n");
+    exit(3);
+  }
+
+  const uint8_t* sum = findCicPart(6102)->secret + 2;
+  uint8_t hi[4] = {0, 0, sum[0], sum[1]};
+  uint8_t lo[4] = {sum[2], sum[3], sum[4], sum[5]};
+  uint8_t seed[4];
+  pifCommand(p, 0x10);
+  pif_read(p, 0x24, seed);
+  pif_write(p, 0x30, hi);
+  pif_write(p, 0x34, lo);
+  pifCommand(p, 0x20);
+  pifCommand(p, 0x40);
+  pifCommand(p, 0x08);
+  if (pif_frozen(p)) {
+    printf("PIF froze during boot\n");
+    exit(3);
+  }
+  return p;
+}
+
+bool joyPif(const uint8_t block[64], joyResult* out, bool hle) {
+  memset(out, 0, sizeof(*out));
+  out->device = 0xcbf29ce484222325;
+
+  // a PIF left frozen by the last block boots again
+  pif** p = &pifs[hle];
+  if (*p && pif_frozen(*p)) {
+    pif_destroy(*p);
+    *p = NULL;
+  }
+  if (!*p) {
+    *p = boot();
+    pif_set_hle(*p, hle);
+  }
+
+  result = out;
+  bool fast = false;
+  if (pif_write64(*p, block)) {
+    // the fast path doesn't run the model, so no time passes
+    uint64_t before = pif_cycles(*p);
+    pif_read64(*p, out->block);
+    fast = hle && pif_cycles(*p) == before;
+  }
+  out->frozen = pif_frozen(*p);
+  result = NULL;
+  return fast;
+}
@@ -0,0 +1,84 @@
+#include "perf.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+const struct {
+  uint32_t type;
+  uint64_t config;
+} perfEvents[] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+};
+
+bool perfOpen(perfGroup* g) {
+  g->leader = -1;
+  g->open = 0;
+  int error = 0;
+
+  for (int i = 0; i < PERF_COUNTERS; ++i) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = perfEvents[i].type;
+    attr.config = perfEvents[i].config;
+    attr.disabled = g->leader < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+
+    g->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, g->leader, 0);
+    if (g->fd[i] < 0) {
+      if (!error)
+        error = errno;
+      continue;
+    }
+    if (g->leader < 0)
+      g->leader = g->fd[i];
+    ++g->open;
+  }
+
+  if (g->leader < 0) {
+    errno = error;
+    return false;
+  }
+  ioctl(g->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(g->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  return true;
+}
+
+void perfRead(const perfGroup* g, uint64_t values[PERF_COUNTERS]) {
+  // nr, then one value per open counter in the order they were opened
+  uint64_t data[1 + PERF_COUNTERS] = {0};
+  if (read(g->leader, data, sizeof(data)) < 0)
+    data[0] = 0;
+
+  uint64_t n = 0;
+  for (int i = 0; i < PERF_COUNTERS; ++i)
+    values[i] = g->fd[i] >= 0 && n < data[0] ? data[1 + n++] : 0;
+}
+
+void perfPause(const perfGroup* g) {
+  ioctl(g->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void perfResume(const perfGroup* g) {
+  ioctl(g->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void perfClose(perfGroup* g) {
+  for (int i = 0; i < PERF_COUNTERS; ++i) {
+    if (g->fd[i] >= 0)
+      close(g->fd[i]);
+    g->fd[i] = -1;
+  }
+  g->leader = -1;
+  g->open = 0;
+}
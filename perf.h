@@ -0,0 +1,35 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+// Linux perf_event counters of the calling thread in user mode, opened as
+// one group so a read gets all of them at the same point. Counters the host
+// can't provide (hardware events in most VMs) are left out and read as 0;
+// task-clock is a software event and nearly always there.
+
+enum {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_BRANCH_MISSES,
+  PERF_CACHE_MISSES,
+  PERF_TASK_CLOCK,  // nanoseconds on the CPU
+  PERF_COUNTERS,
+};
+
+static const char* const perfNames[] = {
+    "cycles", "instructions", "branch-misses", "cache-misses", "task-clock",
+};
+
+typedef struct {
+  int leader;
+  int fd[PERF_COUNTERS];  // -1 where the counter couldn't be opened
+  int open;
+} perfGroup;
+
+// Open and start the counters. False, with errno from the first failure,
+// if none could be opened.
+bool perfOpen(perfGroup* g);
+void perfRead(const perfGroup* g, uint64_t values[PERF_COUNTERS]);
+// Stop and restart the whole group, leaving out what runs in between.
+void perfPause(const perfGroup* g);
+void perfResume(const perfGroup* g);
+void perfClose(perfGroup* g);
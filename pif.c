@@ -0,0 +1,594 @@
+#include "pif.h"
+
+#include "cmodel.h"
+#include "cmodel_pif.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+
+// Library harness for cmodel.c (built with -DCMODEL_LIB). Each pif_* call
+// loads the context's model state into the model globals, resumes the model
+// coroutine until it reaches sync() again, and saves the state back.
+//
+// The model's port traffic is served here: RCP transfers are applied when the
+// model acknowledges them in halt(), the joybus shift hardware is emulated on
+// top of the device callback, and the rest goes to readPort/writePort. Joybus
+// messages (and CIC nibbles, if the devices take them) arrive whole as model
+// transactions, except while tracing, when they go through the ports.
+
+extern MODEL_TLS bool reset;
+extern MODEL_TLS bool regionPAL;
+extern MODEL_TLS void (*cicCompare)(void);
+extern MODEL_TLS latencyStats* latency;
+void start(void);
+void checkInterrupt(void);
+
+enum {
+  STACK_SIZE = 1 << 16,
+
+  // Resumes allowed for the model to pick up an RCP transfer. The 6105
+  // challenge needs two: the interrupt defers it to the main loop.
+  MAX_RESUMES = 4,
+
+  // Rough cost of one pass through a wait loop that does no port I/O, so
+  // pif_step() makes progress (and the boot timer runs) while the PIF idles.
+  IDLE_CYCLES = 16,
+
+  JOYBUS_STATUS_READY = BIT(2),
+};
+
+// what the host gave the model before resuming it, for the trace
+enum {
+  TRACE_PASS,
+  TRACE_W4,
+  TRACE_W64,
+  TRACE_READ,
+  TRACE_RESET,
+};
+
+struct pif {
+  pif_devices dev;
+  bool hle;
+  bool frozen;
+  cicHLE* cic;  // replaces the CIC port when set
+  int cicType;
+  ioTransactions io;
+
+  // model state while the context is not running
+  rfile r;
+  r4 ram[256];
+  bool reset;
+  bool regionPAL;
+  void (*cicCompare)(void);
+  u64 cycles;
+  externalWrites external;
+
+  ucontext_t host;
+  ucontext_t model;
+  u8* stack;
+
+  // RCP transfer waiting for the model to reach halt()
+  bool pending;
+  u8 xfer;  // RCP_XFER_* as read from PORT_RCP_XFER
+  u8 address;
+  u8 length;
+  u8 data[64];
+
+  // joybus hardware, for the channel currently selected
+  u8 channel;
+  u8 tx[64];
+  int txNibbles;
+  u8 rx[64];
+  int rxBytes;
+  int rxNibbles;
+  bool exchanged;
+  bool noAnswer;
+
+  u64 rng;
+
+  FILE* trace;
+  u8 traceCommand;
+
+  latencyStats latency;
+};
+
+MODEL_TLS pif* current;
+
+void load(pif* p) {
+  current = p;
+  r = p->r;
+  memcpy(ram, p->ram, sizeof(ram));
+  reset = p->reset;
+  regionPAL = p->regionPAL;
+  cicCompare = p->cicCompare;
+  cycles = p->cycles;
+  external = p->external;
+  latency = &p->latency;
+  hleCIC = p->cic;
+  // a trace needs the port traffic
+  transactions = p->trace ? NULL : &p->io;
+}
+
+void save(pif* p) {
+  p->r = r;
+  memcpy(p->ram, ram, sizeof(ram));
+  p->reset = reset;
+  p->regionPAL = regionPAL;
+  p->cicCompare = cicCompare;
+  p->cycles = cycles;
+  p->external = external;
+  latency = NULL;
+  hleCIC = NULL;
+  transactions = NULL;
+  current = NULL;
+}
+
+// run the model until it yields in sync() (or freezes)
+void enter(pif* p) {
+  load(p);
+  swapcontext(&p->host, &p->model);
+  save(p);
+}
+
+// The command cmodel reads at this sync() point. RCP reads of any size are
+// "r64" there: the model learns the size from PORT_RCP_XFER.
+void traceSync(pif* p, bool taken) {
+  switch (p->traceCommand) {
+    case TRACE_W4:
+      fprintf(p->trace, "w4 %x", p->address);
+      for (int i = 0; i < 4; ++i)
+        fprintf(p->trace, " %x %x", p->data[i] >> 4, p->data[i] & 0xf);
+      fprintf(p->trace, "\n");
+      break;
+    case TRACE_W64:
+      fprintf(p->trace, "w64");
+      for (int i = 0; i < 64; ++i)
+        fprintf(p->trace, "%s%x %x", i % 16 ? " " : "\n", p->data[i] >> 4, p->data[i] & 0xf);
+      fprintf(p->trace, "\n");
+      break;
+    case TRACE_READ:
+      fprintf(p->trace, "r64\n");
+      break;
+    case TRACE_RESET:
+      fprintf(p->trace, "reset\n");
+      break;
+    default:
+      // cmodel only takes interrupts after a command
+      if (taken)
+        fprintf(p->trace, "# interrupt still pending from an earlier command\n");
+      break;
+  }
+  p->traceCommand = TRACE_PASS;
+  if (!taken)
+    fprintf(p->trace, "pass\n");
+}
+
+// hand control back to the pif_* call that entered the model
+void yield(void) {
+  swapcontext(&current->model, &current->host);
+}
+
+int joybusDevice(pif* p, int channel, const u8* tx, int txLen, u8* rx) {
+  if (!p->dev.joybus)
+    return -1;
+
+  int n = p->dev.joybus(p->dev.user, channel, tx, txLen, rx);
+  return n > 64 ? 64 : n;
+}
+
+void joybusIdle(pif* p) {
+  p->txNibbles = 0;
+  p->rxBytes = 0;
+  p->rxNibbles = 0;
+  p->exchanged = 0;
+}
+
+void joybusExchange(pif* p) {
+  p->rxBytes = joybusDevice(p, p->channel, p->tx, p->txNibbles / 2, p->rx);
+  p->noAnswer = p->rxBytes < 0;
+  p->rxNibbles = 0;
+  p->exchanged = 1;
+}
+
+u8 joybusStatus(pif* p) {
+  // the line is always clocked; it stops being ready once the device has
+  // nothing more to send
+  if (p->exchanged && p->rxNibbles >= p->rxBytes * 2)
+    return JOYBUS_STATUS_CLOCK;
+  return JOYBUS_STATUS_CLOCK | JOYBUS_STATUS_READY;
+}
+
+u8 joybusRead(pif* p) {
+  if (!p->exchanged)
+    joybusExchange(p);  // no stop bit was sent
+  if (p->rxNibbles >= p->rxBytes * 2)
+    return 0;
+
+  u8 byte = p->rx[p->rxNibbles / 2];
+  return (p->rxNibbles++ & 1) ? byte & 0xf : byte >> 4;
+}
+
+void joybusWrite(pif* p, u8 value) {
+  int i = p->txNibbles / 2;
+  if (i == sizeof(p->tx))
+    return;
+
+  if (p->txNibbles++ & 1)
+    p->tx[i] |= value & 0xf;
+  else
+    p->tx[i] = value << 4;
+}
+
+// Joybus messages from the model's transactions, on the same hardware state
+// as the port path.
+void ioJoybusSend(void* user, const u8* buf, int n) {
+  pif* p = user;
+  memcpy(p->tx, buf, n);
+  p->txNibbles = n * 2;
+  joybusExchange(p);
+}
+
+int ioJoybusRecv(void* user, u8* buf, int n) {
+  pif* p = user;
+  if (p->rxBytes < 0)
+    return -1;
+  if (n > p->rxBytes)
+    n = p->rxBytes;
+  memcpy(buf, p->rx, n);
+  p->rxNibbles = n * 2;
+  return n;
+}
+
+u8 ioCicReadNibble(void* user) {
+  pif* p = user;
+  return p->dev.cicReadNibble(p->dev.user);
+}
+
+void ioCicWriteNibble(void* user, u8 value) {
+  pif* p = user;
+  p->dev.cicWriteNibble(p->dev.user, value);
+}
+
+u8 readPort(pif* p, u8 port) {
+  cycles += IO_CYCLES;
+
+  switch (port) {
+    case PORT_JOYBUS_READ:
+      return joybusRead(p);
+    case PORT_JOYBUS_STATUS:
+      return joybusStatus(p);
+    case PORT_JOYBUS_ERROR:
+      return p->noAnswer ? JOYBUS_ERROR_NOANSWER : 0;
+    case PORT_JOYBUS_CHANNEL:
+      return p->channel;
+    case PORT_RCP_XFER:
+      return p->xfer;
+    case PORT_RNG:
+      p->rng ^= p->rng << 13;
+      p->rng ^= p->rng >> 7;
+      p->rng ^= p->rng << 17;
+      return (p->rng & 0xf) ? 0 : RNG_DATA;
+    default:
+      if (!p->dev.readPort)
+        return 0;
+      return p->dev.readPort(p->dev.user, port) & 0xf;
+  }
+}
+
+u8 readIO(u8 port) {
+  u8 value = readPort(current, port);
+  if (current->trace)
+    fprintf(current->trace, "%x\n", value);
+  return value;
+}
+
+void writeIO(u8 port, u8 value) {
+  pif* p = current;
+  cycles += IO_CYCLES;
+  if (p->trace)
+    fprintf(p->trace, "=w %x %x\n", port, value);
+
+  switch (port) {
+    case REG_INT_EN:
+      RE = value;
+      break;
+    case PORT_JOYBUS_CHANNEL:
+      p->channel = value;
+      joybusIdle(p);
+      break;
+    case PORT_JOYBUS_WRITE:
+      joybusWrite(p, value);
+      break;
+    case PORT_JOYBUS_CTRL:
+      if (value == JOYBUS_CTRL_WRITESTOPBIT) {
+        joybusExchange(p);
+      } else {
+        if (value == 3 && p->dev.joybusReset)
+          p->dev.joybusReset(p->dev.user, p->channel);
+        joybusIdle(p);
+      }
+      break;
+    case PORT_JOYBUS_ERROR:
+      p->noAnswer = 0;
+      break;
+    case PORT_RNG:
+      break;
+    default:
+      if (p->dev.writePort)
+        p->dev.writePort(p->dev.user, port, value);
+      break;
+  }
+}
+
+// The RCP transfer runs while the model waits for the second interrupt.
+void halt(void) {
+  pif* p = current;
+  if (!p->pending)
+    return;
+
+  u8 b = RAM_EXTERNAL + p->address * 2;
+  for (int i = 0; i < p->length; ++i) {
+    if (p->xfer & RCP_XFER_READ) {
+      p->data[i] = RAM(b + i * 2) << 4 | RAM(b + i * 2 + 1);
+    } else {
+      externalWrite(p->address * 2 + i * 2, p->data[i] >> 4);
+      externalWrite(p->address * 2 + i * 2 + 1, p->data[i] & 0xf);
+    }
+  }
+  p->pending = 0;
+}
+
+// Yield to the host. Interrupts raised by a pif_* call are taken before
+// returning to the main loop, so a transfer doesn't also cost a loop pass.
+void sync(void) {
+  bool taken;
+  do {
+    yield();
+    taken = IME && ((IFA && (RE & INT_A_EN)) || (IFB && (RE & INT_B_EN)));
+    if (current->trace)
+      traceSync(current, taken);
+    checkInterrupt();
+  } while (taken);
+}
+
+void fatalError(void) {
+  current->frozen = 1;
+  for (;;)
+    yield();
+}
+
+void notImpl(u8 pu, u8 pl) {
+  (void)pu;
+  (void)pl;
+  fatalError();
+}
+
+bool transfer(pif* p, u8 xfer, u8 address, u8 length, u8* data) {
+  if (p->frozen)
+    return false;
+
+  p->pending = 1;
+  p->xfer = xfer;
+  p->address = address & 0x3f;
+  p->length = length;
+  if (!(xfer & RCP_XFER_READ))
+    memcpy(p->data, data, length);
+
+  p->traceCommand = xfer & RCP_XFER_READ ? TRACE_READ : length == 4 ? TRACE_W4 : TRACE_W64;
+  p->r.ifa = 1;
+  for (int i = 0; p->pending && !p->frozen && i < MAX_RESUMES; ++i)
+    enter(p);
+
+  if (p->pending) {
+    p->pending = 0;
+    p->r.ifa = 0;
+    p->traceCommand = TRACE_PASS;
+    return false;
+  }
+
+  if (xfer & RCP_XFER_READ)
+    memcpy(data, p->data, length);
+  return true;
+}
+
+// Fast path for pif_read64(). Only used when the last command block parsed
+// by joybusCommandParse() is a standard libultra layout: every channel is
+// skipped or holds a status (00/ff, 3 bytes back) or poll (01, 4 bytes back)
+// frame, with no resets and no stop-bit tricks. PIF-RAM ends up as the model
+// would leave it; internal scratch RAM and cycles are not touched.
+bool hleFrame(u8 sb) {
+  if (sb + 6 + 8 > 0x100)
+    return false;
+
+  u8 tx = RAM(sb + 0) << 4 | RAM(sb + 1);
+  u8 rx = (RAM(sb + 2) & 3) << 4 | RAM(sb + 3);
+  u8 cmd = RAM(sb + 4) << 4 | RAM(sb + 5);
+  if (tx != 1)
+    return false;
+  return ((cmd == 0x00 || cmd == 0xff) && rx == 3) || (cmd == 0x01 && rx == 4);
+}
+
+bool hleLayout(void) {
+  if (!RAM_BIT_TEST(STATUS, STATUS_RUNNING) || RAM_BIT_TEST(PIF_CMD_L, PIF_CMD_L_CHALLENGE))
+    return false;
+  if (RAM_BIT_TEST(PIF_CMD_L, 2))
+    return false;
+  if (!IME || !(RE & INT_A_EN))
+    return false;
+
+  for (u8 n = 0; n < 5; ++n) {
+    if (RAM_BIT_TEST(JOYBUS_STATUS + n, JOYBUS_STATUS_RESET))
+      return false;
+    if (RAM_BIT_TEST(JOYBUS_STATUS + n, JOYBUS_STATUS_SKIP))
+      continue;
+    if (!hleFrame(RAM(JOYBUS_ADDR_U + n) << 4 | RAM(JOYBUS_ADDR_L + n)))
+      return false;
+  }
+  return true;
+}
+
+bool hleRead64(pif* p) {
+  if (p->frozen || p->pending || p->trace)
+    return false;
+
+  load(p);
+  bool ok = hleLayout();
+  if (ok) {
+    // same channel order as joybusTransfer()
+    for (int n = 4; n >= 0; --n) {
+      if (RAM_BIT_TEST(JOYBUS_STATUS + n, JOYBUS_STATUS_SKIP))
+        continue;
+
+      u8 sb = RAM(JOYBUS_ADDR_U + n) << 4 | RAM(JOYBUS_ADDR_L + n);
+      u8 rx = RAM(sb + 3);
+      u8 cmd = RAM(sb + 4) << 4 | RAM(sb + 5);
+      u8 data[64];
+      RAM_SET(sb + 2, RAM(sb + 2) & 3);  // clear the previous error bits
+      int got = joybusDevice(p, n, &cmd, 1, data);
+
+      for (int i = 0; i < got && i < rx; ++i) {
+        RAM_SET(sb + 6 + i * 2, data[i] >> 4);
+        RAM_SET(sb + 7 + i * 2, data[i] & 0xf);
+      }
+      if (got < 0)
+        RAM_SET(sb + 2, RAM(sb + 2) + JOYBUS_SENDERR_NO_DEVICE);
+      else if (got < rx)
+        RAM_SET(sb + 2, RAM(sb + 2) + JOYBUS_SENDERR_TIMEOUT);
+    }
+
+    for (int i = 0; i < 64; ++i)
+      p->data[i] = RAM(RAM_EXTERNAL + i * 2) << 4 | RAM(RAM_EXTERNAL + i * 2 + 1);
+  }
+  save(p);
+  return ok;
+}
+
+// set up the model coroutine to begin at start()
+void initModel(pif* p) {
+  getcontext(&p->model);
+  p->model.uc_stack.ss_sp = p->stack;
+  p->model.uc_stack.ss_size = STACK_SIZE;
+  p->model.uc_link = NULL;
+  makecontext(&p->model, start, 0);
+}
+
+pif* pif_create(const pif_devices* devices, bool pal) {
+  pif* p = calloc(1, sizeof(pif));
+  if (!p)
+    return NULL;
+  p->stack = malloc(STACK_SIZE);
+  if (!p->stack) {
+    free(p);
+    return NULL;
+  }
+
+  if (devices)
+    p->dev = *devices;
+  p->regionPAL = pal;
+  p->rng = 0x2545f4914f6cdd1d;
+
+  p->io.user = p;
+  p->io.joybusSend = ioJoybusSend;
+  p->io.joybusRecv = ioJoybusRecv;
+  if (p->dev.cicReadNibble && p->dev.cicWriteNibble) {
+    p->io.cicReadNibble = ioCicReadNibble;
+    p->io.cicWriteNibble = ioCicWriteNibble;
+  }
+
+  initModel(p);
+  return p;
+}
+
+void pif_destroy(pif* ctx) {
+  if (!ctx)
+    return;
+  if (ctx->trace && !ctx->frozen)
+    fprintf(ctx->trace, "q\n");
+  cicHleDestroy(ctx->cic);
+  free(ctx->stack);
+  free(ctx);
+}
+
+bool pif_write(pif* ctx, uint8_t addr, const uint8_t data[4]) {
+  return transfer(ctx, 0, addr & ~3, 4, (u8*)data);
+}
+
+bool pif_read(pif* ctx, uint8_t addr, uint8_t data[4]) {
+  return transfer(ctx, RCP_XFER_READ, addr & ~3, 4, data);
+}
+
+bool pif_write64(pif* ctx, const uint8_t buf[64]) {
+  return transfer(ctx, RCP_XFER_64B, 0, 64, (u8*)buf);
+}
+
+bool pif_read64(pif* ctx, uint8_t buf[64]) {
+  if (ctx->hle && hleRead64(ctx)) {
+    memcpy(buf, ctx->data, 64);
+    return true;
+  }
+  return transfer(ctx, RCP_XFER_READ | RCP_XFER_64B, 0, 64, buf);
+}
+
+void pif_reset(pif* ctx) {
+  if (ctx->frozen)
+    return;
+  ctx->r.ifb = 1;
+  ctx->traceCommand = TRACE_RESET;
+  enter(ctx);
+}
+
+void pif_step(pif* ctx, uint64_t cycles) {
+  u64 end = ctx->cycles + cycles;
+  while (ctx->cycles < end && !ctx->frozen) {
+    u64 before = ctx->cycles;
+    enter(ctx);
+    if (ctx->cycles == before)
+      ctx->cycles += IDLE_CYCLES;
+  }
+}
+
+void pif_trace(pif* ctx, FILE* f) {
+  ctx->trace = f;
+  if (ctx->cic)
+    fprintf(f, "# high-level CIC %d, replay with cmodel -C %d\n", ctx->cicType, ctx->cicType);
+  fprintf(f, "# region\n%x\n", ctx->regionPAL);
+}
+
+void pif_latency(const pif* ctx, FILE* f) {
+  histPrintHeader(f);
+  for (int i = 0; i < LATENCY_KINDS; ++i)
+    histPrint(f, latencyNames[i], &ctx->latency.h[i]);
+}
+
+void pif_set_hle(pif* ctx, bool hle) {
+  ctx->hle = hle;
+}
+
+bool pif_set_cic(pif* ctx, int type) {
+  cicHLE* cic = cicHleCreate(type);
+  if (!cic)
+    return false;
+  cicHleDestroy(ctx->cic);
+  ctx->cic = cic;
+  ctx->cicType = type;
+  return true;
+}
+
+uint64_t pif_cycles(const pif* ctx) {
+  // live count when asked from one of the context's own callbacks
+  if (ctx == current)
+    return cycles;
+  return ctx->cycles;
+}
+
+uint16_t pif_dirty(const pif* ctx) {
+  if (ctx == current)
+    return external.dirty;
+  return ctx->external.dirty;
+}
+
+bool pif_frozen(const pif* ctx) {
+  return ctx->frozen;
+}
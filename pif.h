@@ -0,0 +1,89 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Embeddable PIF: the C model from cmodel.c driven by calls instead of a
+// trace. The model runs as a coroutine on its own stack and only advances
+// inside pif_* calls. Contexts on one thread share that thread's model
+// globals and take turns; a context must not be used by two threads at once.
+//
+// Link with libpif.a, which exports nothing but the pif_* symbols.
+
+typedef struct pif pif;
+
+typedef struct {
+  void* user;
+
+  // One joybus command on a channel. Write up to 64 response bytes to rx and
+  // return how many were written, or -1 if no device answers.
+  int (*joybus)(void* user, int channel, const uint8_t* tx, int txLen, uint8_t* rx);
+  // Optional: channel reset (0xfd frames, or TX with bit 6 set).
+  void (*joybusReset)(void* user, int channel);
+
+  // Lines outside the PIF: the CIC port (5), ROM lockout (6) and the reset
+  // port (8) driving the VR4300 NMI/pre-NMI. Reads of port 8 report the reset
+  // button, with bit 3 set once it has been released.
+  uint8_t (*readPort)(void* user, uint8_t port);
+  void (*writePort)(void* user, uint8_t port, uint8_t value);
+
+  // Optional, both or neither: whole CIC nibbles, in place of the four bits
+  // each that are otherwise clocked through port 5. The compare exchange,
+  // clock pulse and reset handshake still go through the port.
+  uint8_t (*cicReadNibble)(void* user);
+  void (*cicWriteNibble)(void* user, uint8_t value);
+} pif_devices;
+
+// Create a PIF. The model starts running (and reading the CIC through
+// devices->readPort) with the first call that advances it.
+pif* pif_create(const pif_devices* devices, bool pal);
+void pif_destroy(pif* ctx);
+
+// RCP accesses to PIF-RAM, addr being a byte offset (multiple of 4). They
+// return false if the PIF did not service the transfer, e.g. after it froze
+// the console or while its interrupts are off.
+bool pif_write(pif* ctx, uint8_t addr, const uint8_t data[4]);
+bool pif_read(pif* ctx, uint8_t addr, uint8_t data[4]);
+bool pif_write64(pif* ctx, const uint8_t buf[64]);
+bool pif_read64(pif* ctx, uint8_t buf[64]);
+
+// Press the reset button.
+void pif_reset(pif* ctx);
+
+// Let the PIF main loop run for at least this many SM5 cycles.
+void pif_step(pif* ctx, uint64_t cycles);
+
+// Answer standard controller status/poll blocks directly from C instead of
+// running the joybus transfer in the model. Off by default.
+void pif_set_hle(pif* ctx, bool hle);
+
+// Answer the CIC from a built-in high-level CIC of this part number (6101,
+// 6102, 7101, ...) instead of readPort/writePort on port 5. The model then
+// exchanges whole nibbles and messages with it, which no port traffic shows.
+// Call right after pif_create(). Returns false for an unknown part.
+bool pif_set_cic(pif* ctx, int type);
+
+// Record everything the model does from now on as a cmodel trace: the values
+// of all its port reads, the commands it picks up at sync points and an =w
+// expectation for each write, streamed to f. Call right after pif_create().
+// pif_destroy() ends the trace; f is left open. HLE reads are not used while
+// tracing, since the model doesn't see them, and joybus messages and CIC
+// nibbles go through the ports. With a high-level CIC, set it first: the
+// trace then replays with cmodel -C.
+void pif_trace(pif* ctx, FILE* f);
+
+// Write percentiles of the latencies the model timed so far, in modeled
+// cycles, as a table with one line per kind: Read4B, Read64B (with the
+// joybus transfer), writes, the 6105 challenge, one CIC compare and reset
+// button to NMI.
+void pif_latency(const pif* ctx, FILE* f);
+
+// Modeled SM5 cycles so far, also valid from inside device callbacks.
+uint64_t pif_cycles(const pif* ctx);
+
+// 4-byte blocks of PIF-RAM (bit n: bytes 4n..4n+3) that RCP writes changed
+// since the PIF last parsed a joybus command from the main loop. Writes of
+// the same bytes again don't count; replies the PIF writes never do.
+uint16_t pif_dirty(const pif* ctx);
+
+// True once the PIF has detected an error and is holding the console.
+bool pif_frozen(const pif* ctx);
@@ -0,0 +1,411 @@
+# Translate an SM5 ROM image (PIF or CIC) to C
+#
+# Every ROM routine becomes one C function: the reset vector, the interrupt
+# vectors when the ROM enables interrupts, and each TRS/CALL target. TRS and
+# CALL are direct calls, TR/TL are gotos (code reached from several routines
+# is emitted in each of them) and RTN/RTNS/RTNI return whether the caller
+# skips its next instruction. Interrupts are checked after IE; RTNI only
+# returns into checkInterrupt(), which takes the next pending one.
+#
+# The output links against the same readIO/writeIO/halt/sync interface as
+# the hand-written models, in place of them: build cmodel.c or cmodel_cic.c
+# with -DCMODEL_ROM. sync() is called before each instruction given with -s,
+# which should be where the hand-written model syncs, so the same traces
+# replay on both. A loop that can never exit (SignalError) runs once and
+# calls fatalError(). Each instruction counts in romHits and costs a cycle
+# (TL/CALL/PAT two); port accesses cost what the harness charges.
+
+import argparse
+import os
+
+parser = argparse.ArgumentParser("recompiler")
+parser.add_argument("path", \
+                    help="path to ROM image to translate")
+parser.add_argument("-o", "--output", \
+                    help="C file to write (default: stdout)")
+parser.add_argument("-s", "--sync", action="append", default=[], \
+                    help="call sync() before the instruction at pu:pl (repeatable)")
+args = parser.parse_args()
+
+if not os.path.exists(args.path):
+    exit("Unable to find file " + args.path)
+
+with open(args.path, "rb") as f:
+    rom = f.read()
+
+
+def address(text):
+    pu, pl = text.split(":")
+    return int(pu, 16) << 6 | int(pl, 16)
+
+
+def name(pc):
+    return f"{pc >> 6:02x}_{pc & 0x3f:02x}"
+
+
+syncs = {address(s) for s in args.sync}
+
+STANDBY_EXIT = 0x0c0  # $03:00, where HALT resumes
+PAT_PAGE = 0x100      # $04:00
+
+# 8-bit mode registers, accessed through XA
+PORTS8 = range(8, 0xc)
+
+# instructions that skip the next one on a condition
+SKIPS = {"ADX", "EXCI", "EXCD", "INCB", "DECB", "ADC", "TAM", "TC", "TM", "TABL",
+         "TPB", "TA", "TB", "TSF"}
+
+# instructions that never fall through
+ENDS = {"TR", "TL", "RTN", "RTNS", "RTNI", "HALT", "STOP", "???"}
+
+# instructions that touch a port; the harness charges their cycles
+PORT_OPS = {"INL", "OUTL", "ANP", "ORP", "IN", "OUT", "TPB"}
+
+
+def decode(pc):
+    op = rom[pc]
+    if op == 0x69:
+        ex = rom[pc + 1]
+        return {2: ("TT", 0), 3: ("DR", 0), 4: ("TSF", 0)}.get(ex, ("???", ex)) + (2,)
+    if op == 0x00:
+        return ("NOP", 0, 1)
+    if op < 0x40:
+        return (["ADX", "LAX", "LBLX", "LBMX"][op >> 4], op & 0xf, 1)
+    if op < 0x60:
+        return (["RM", "SM", "TM", "TPB", "LDA", "EXC", "EXCI", "EXCD"][(op >> 2) & 7], op & 3, 1)
+    if op < 0x80:
+        return (["RC", "SC", "ID", "IE", "EXAX", "ATX", "EXBM", "EXBL",
+                 "EX", "???", "PAT", "TABL", "TA", "TB", "TC", "TAM",
+                 "INL", "OUTL", "ANP", "ORP", "IN", "OUT", "STOP", "HALT",
+                 "INCB", "COMA", "ADD", "ADC", "DECB", "RTN", "RTNS", "RTNI"][op & 0x1f], 0, 1)
+    if op < 0xc0:
+        return ("TR", (pc & 0xfc0) | (op & 0x3f), 1)
+    if op < 0xe0:
+        return ("TRS", 0x40 | (op & 0x1f) << 1, 1)
+    return ("TL" if op < 0xf0 else "CALL", (op & 0xf) << 8 | rom[pc + 1], 2)
+
+
+def size(pc):
+    return decode(pc)[2]
+
+
+# Straight-line code from target back to the jump at pc, with nothing that
+# could leave it: such a loop spins forever.
+def endless(pc, target):
+    seen = set()
+    while target not in seen:
+        seen.add(target)
+        mnemonic = decode(target)[0]
+        if target == pc:
+            return True
+        if mnemonic in SKIPS or mnemonic in ("TRS", "CALL", "RTN", "RTNS", "RTNI", "HALT", "STOP",
+                                             "IN", "INL", "TR", "TL"):
+            return False
+        target += size(target)
+    return False
+
+
+# Addresses of one routine, following jumps and skips but not calls.
+def walk(entry):
+    body = set()
+    todo = [entry]
+    while todo:
+        pc = todo.pop()
+        if pc in body or pc >= len(rom):
+            continue
+        body.add(pc)
+        mnemonic, operand, length = decode(pc)
+        following = pc + length
+        if mnemonic in ("TR", "TL"):
+            if not endless(pc, operand):
+                todo.append(operand)
+        elif mnemonic in ENDS and mnemonic != "HALT":
+            pass
+        elif mnemonic == "HALT":
+            todo.append(STANDBY_EXIT)
+        else:
+            todo.append(following)
+            if mnemonic in SKIPS or (mnemonic in ("TRS", "CALL") and skips(operand)):
+                todo.append(following + size(following))
+    return body
+
+
+bodies = {}
+
+
+def routine(entry):
+    if entry not in bodies:
+        bodies[entry] = set()  # in case of recursion
+        bodies[entry] = walk(entry)
+    return bodies[entry]
+
+
+# whether a routine can return with RTNS
+def skips(entry):
+    return any(decode(pc)[0] == "RTNS" for pc in routine(entry))
+
+
+def cost(pc):
+    mnemonic, operand, length = decode(pc)
+    if mnemonic in PORT_OPS:
+        return 0
+    return 2 if mnemonic == "PAT" else length
+
+
+def label(pc):
+    return "L" + name(pc)
+
+
+def skipTo(pc):
+    following = pc + size(pc)
+    return f"{{ cycles += {size(following)}; goto {label(following + size(following))}; }}"
+
+
+# Where each instruction of a routine goes besides falling through, for labels.
+def targets(body):
+    found = set()
+    for pc in body:
+        mnemonic, operand, length = decode(pc)
+        following = pc + length
+        if mnemonic in ("TR", "TL"):
+            if not endless(pc, operand):
+                found.add(operand)
+        elif mnemonic == "HALT":
+            found.add(STANDBY_EXIT)
+        elif mnemonic in SKIPS or (mnemonic in ("TRS", "CALL") and skips(operand)):
+            found.add(following + size(following))
+    return found
+
+
+def port(bl, access):
+    return f"0x{bl:x}" if bl is not None else access
+
+
+# C for the instruction at pc; bl is Bl if known from a preceding LBLX
+def statement(pc, bl):
+    mnemonic, operand, length = decode(pc)
+    skip = skipTo(pc) if pc + length < len(rom) else ""
+    bm = f" BM ^= {operand};" if operand else ""
+    wide = bl in PORTS8 if bl is not None else None
+    if mnemonic == "NOP" or mnemonic == "DR":
+        return ";"
+    if mnemonic == "ADX":
+        return f"t = A + {operand}; A = t; if (t > 0xf) {skip}"
+    if mnemonic == "LAX":
+        return f"A = {operand};"
+    if mnemonic == "LBLX":
+        return f"BL = {operand};"
+    if mnemonic == "LBMX":
+        return f"BM = {operand};"
+    if mnemonic == "RM":
+        return f"RAM_BIT_RESET(B, {operand});"
+    if mnemonic == "SM":
+        return f"RAM_BIT_SET(B, {operand});"
+    if mnemonic == "TM":
+        return f"if (RAM(B) & BIT({operand})) {skip}"
+    if mnemonic == "TPB":
+        return f"if (readIO({port(bl, 'BL')}) & BIT({operand})) {skip}"
+    if mnemonic == "LDA":
+        return f"A = RAM(B);{bm}"
+    if mnemonic == "EXC":
+        return f"t = A; A = RAM(B); RAM_SET(B, t);{bm}"
+    if mnemonic == "EXCI":
+        return f"t = A; A = RAM(B); RAM_SET(B, t); BL += 1;{bm} if (BL == 0) {skip}"
+    if mnemonic == "EXCD":
+        return f"t = A; A = RAM(B); RAM_SET(B, t); BL -= 1;{bm} if (BL == 0xf) {skip}"
+    if mnemonic == "RC":
+        return "C = 0;"
+    if mnemonic == "SC":
+        return "C = 1;"
+    if mnemonic == "ID":
+        return "IME = 0;"
+    if mnemonic == "IE":
+        return "IME = 1; checkInterrupt();"
+    if mnemonic == "EXAX":
+        return "t = A; A = X; X = t;"
+    if mnemonic == "ATX":
+        return "X = A;"
+    if mnemonic == "EXBM":
+        return "t = A; A = BM; BM = t;"
+    if mnemonic == "EXBL":
+        return "t = A; A = BL; BL = t;"
+    if mnemonic == "EX":
+        return "t = B; B = SB; SB = t;"
+    if mnemonic == "PAT":
+        return "t = romPAT[(X & 3) << 4 | A]; A = t; X = t >> 4;"
+    if mnemonic == "TABL":
+        return f"if (A == BL) {skip}"
+    if mnemonic == "TA":
+        return f"t = IFA; IFA = 0; if (t) {skip}"
+    if mnemonic == "TB":
+        return f"t = IFB; IFB = 0; if (t) {skip}"
+    if mnemonic == "TC":
+        return f"if (C) {skip}"
+    if mnemonic == "TAM":
+        return f"if (A == RAM(B)) {skip}"
+    if mnemonic == "TSF":
+        return f"if (secretBit(B)) {skip}"
+    if mnemonic == "INL":
+        return "A = readIO(1);"
+    if mnemonic == "OUTL":
+        return "latch[0] = A; writeIO(0, A);" if latched else "writeIO(0, A);"
+    if mnemonic in ("ANP", "ORP"):
+        op = "&" if mnemonic == "ANP" else "|"
+        p = port(bl, "BL")
+        return f"latch[{p}] {op}= A; writeIO({p}, latch[{p}]);"
+    if mnemonic == "IN":
+        if wide is None:
+            return "t = readIO(BL); A = t; if (BL >= 8 && BL < 0xc) X = t >> 4;"
+        if wide:
+            return f"t = readIO({port(bl, '')}); A = t; X = t >> 4;"
+        return f"A = readIO({port(bl, '')});"
+    if mnemonic == "OUT":
+        value = "X << 4 | A" if wide else "A"
+        if wide is None:
+            value = "BL >= 8 && BL < 0xc ? X << 4 | A : A"
+        p = port(bl, "BL")
+        if latched:
+            return f"latch[{p}] = {value}; writeIO({p}, latch[{p}]);"
+        return f"writeIO({p}, {value});"
+    if mnemonic == "HALT":
+        return f"halt(); goto {label(STANDBY_EXIT)};"
+    if mnemonic == "INCB":
+        return f"BL += 1; if (BL == 0) {skip}"
+    if mnemonic == "COMA":
+        return "A ^= 0xf;"
+    if mnemonic == "ADD":
+        return "A += RAM(B);"
+    if mnemonic == "ADC":
+        return f"t = A + RAM(B) + C; A = t; C = t > 0xf; if (C) {skip}"
+    if mnemonic == "DECB":
+        return f"BL -= 1; if (BL == 0xf) {skip}"
+    if mnemonic == "RTN":
+        return "return false;"
+    if mnemonic == "RTNS":
+        return "return true;"
+    if mnemonic == "RTNI":
+        return "IME = 1; return false;"
+    if mnemonic in ("TR", "TL"):
+        if endless(pc, operand):
+            return "fatalError(); return false;"
+        return f"goto {label(operand)};"
+    if mnemonic in ("TRS", "CALL"):
+        if skips(operand):
+            return f"if (rom{name(operand)}()) {skip}"
+        return f"rom{name(operand)}();"
+    return f"notImpl(0x{pc >> 6:02x}, 0x{pc & 0x3f:02x});" + (" return false;" if mnemonic != "TT" else "")
+
+
+# instructions that change Bl other than LBLX
+BL_CHANGES = {"EXCI", "EXCD", "EXBL", "EX", "INCB", "DECB", "TRS", "CALL", "IE"}
+
+
+def disassembly(pc):
+    mnemonic, operand, length = decode(pc)
+    if mnemonic in ("TR", "TL", "TRS", "CALL"):
+        return f"{mnemonic} ${name(operand).replace('_', ':')}"
+    if mnemonic in ("ADX", "LAX", "LBLX", "LBMX", "RM", "SM", "TM", "TPB", "LDA", "EXC", "EXCI", "EXCD"):
+        return f"{mnemonic} {operand}"
+    return mnemonic
+
+
+def function(entry):
+    body = sorted(routine(entry))
+    jumped = targets(body)
+    lines = []
+    if body[0] != entry:
+        jumped.add(entry)
+        lines.append(f"  goto {label(entry)};")
+    bl = None
+    following = None
+    for pc in body:
+        if pc in jumped or pc != following:
+            bl = None
+        if pc in jumped:
+            lines.append(f"{label(pc)}:")
+        code = statement(pc, bl)
+        if pc in syncs:
+            code = "sync(); " + code
+        lines.append(f"  STEP(0x{pc >> 6:02x}, 0x{pc & 0x3f:02x}, {cost(pc)}); {code}  // {disassembly(pc)}")
+        mnemonic, operand, length = decode(pc)
+        if mnemonic == "LBLX":
+            bl = operand
+        elif mnemonic in BL_CHANGES or pc in syncs:
+            bl = None
+        following = None if mnemonic in ENDS else pc + length
+    temp = any("t = " in line or "t;" in line for line in lines)
+    out = [f"// ${name(entry).replace('_', ':')}", f"static bool rom{name(entry)}(void) {{"]
+    if temp:
+        out.append("  u8 t;")
+    return out + lines + ["}", ""]
+
+
+# Routines reachable from the reset vector, and the interrupt vectors once
+# the ROM turns interrupts on.
+entries = [0]
+interrupts = False
+done = set()
+while entries:
+    entry = entries.pop()
+    if entry in done:
+        continue
+    done.add(entry)
+    for pc in routine(entry):
+        mnemonic, operand, length = decode(pc)
+        if mnemonic in ("TRS", "CALL"):
+            entries.append(operand)
+        if mnemonic in ("IE", "RTNI") and not interrupts:
+            interrupts = True
+            entries += [0x080, 0x084]
+
+# A routine walked while one of its callees was still being walked (that is,
+# recursively) assumed the callee never skips; walk again until that holds.
+while True:
+    previous = dict(bodies)
+    for entry in done:
+        bodies[entry] = walk(entry)
+    if bodies == previous:
+        break
+
+code = set()
+for entry in done:
+    code |= {decode(pc)[0] for pc in routine(entry)}
+latched = bool(code & {"ANP", "ORP"})
+
+out = [f"// Generated by recompiler.py from {os.path.basename(args.path)}; do not edit.",
+       "",
+       '#include "cmodel.h"',
+       "",
+       "#define STEP(pu, pl, n) (COVER(pu, pl), cycles += (n))",
+       ""]
+if "PAT" in code:
+    out.append(f"// ${name(PAT_PAGE).replace('_', ':')}, read by PAT")
+    out.append("static const u8 romPAT[0x40] = {")
+    for i in range(0, 0x40, 8):
+        out.append("    " + " ".join(f"0x{b:02x}," for b in rom[PAT_PAGE + i:PAT_PAGE + i + 8]))
+    out.append("};")
+    out.append("")
+if latched:
+    out += ["// last value written to each port, for ANP and ORP", "static MODEL_TLS u8 latch[16];", ""]
+if interrupts:
+    out += ["void checkInterrupt(void);", ""]
+if "TSF" in code:
+    out += ["// bit of the CIC's secret ROM at address, provided by the harness", "bool secretBit(u8 address);", ""]
+for entry in sorted(done):
+    out.append(f"static bool rom{name(entry)}(void);")
+out.append("")
+for entry in sorted(done):
+    out += function(entry)
+
+out += ["void start(void) {", "  rom00_00();", "}", ""]
+if interrupts:
+    out += ["// IFA", "void interruptA(void) {", "  rom02_00();", "}", "",
+            "// the $02:04 vector, which the models call interruptB()",
+            "void interruptB(void) {", "  rom02_04();", "}", ""]
+
+text = "\n".join(out[:-1]) + "\n"
+if args.output:
+    with open(args.output, "w") as f:
+        f.write(text)
+else:
+    print(text, end="")
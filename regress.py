@@ -0,0 +1,108 @@
+# Replay a trace corpus through a model, skipping unchanged traces
+#
+# Each result is kept under a key hashing the trace contents, the model
+# binary and the high-level CIC type (-C); the region is the trace's first
+# value, so the contents cover it. The cache is a text file in the spirit of
+# sha256sums.txt, one "key result *trace" line per run, and a trace whose key
+# is already there is reported from it without running. Editing the model
+# or a trace changes the key, so only what it affects runs again. Entries
+# are never dropped, so switching back to an earlier model hits too.
+# Results are "ok" or "exit:N", N being the model's exit code.
+
+import argparse
+import collections
+import concurrent.futures
+import hashlib
+import os
+import subprocess
+
+parser = argparse.ArgumentParser("regress")
+parser.add_argument("traces", nargs="+", \
+                    help="traces to replay")
+parser.add_argument("-m", "--model", default="./cmodel", \
+                    help="model binary (default: ./cmodel)")
+parser.add_argument("-C", "--cic", \
+                    help="high-level CIC type, passed to the model as -C")
+parser.add_argument("-c", "--cache", default="regress.sha256", \
+                    help="cache file (default: regress.sha256)")
+parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count(), \
+                    help="models run at once (default: number of CPUs)")
+parser.add_argument("-f", "--force", action="store_true", \
+                    help="run every trace, refreshing its cache entry")
+parser.add_argument("-v", "--verbose", action="store_true", \
+                    help="list cached results too")
+args = parser.parse_args()
+
+
+def digest(path):
+    h = hashlib.sha256()
+    with open(path, "rb") as f:
+        for chunk in iter(lambda: f.read(1 << 20), b""):
+            h.update(chunk)
+    return h.hexdigest()
+
+
+for path in [args.model] + args.traces:
+    if not os.path.exists(path):
+        exit("Unable to find file " + path)
+
+model = digest(args.model)
+
+
+def key(trace):
+    h = hashlib.sha256()
+    h.update(f"model {model}\ntrace {digest(trace)}\ncic {args.cic or '-'}\n".encode())
+    return h.hexdigest()
+
+
+cache = {}
+if os.path.exists(args.cache):
+    with open(args.cache) as f:
+        for line in f:
+            fields = line.split(maxsplit=2)
+            if len(fields) == 3 and fields[2].startswith("*"):
+                cache[fields[0]] = (fields[1], fields[2][1:].rstrip("\n"))
+
+keys = {trace: key(trace) for trace in args.traces}
+pending = [trace for trace in args.traces if args.force or keys[trace] not in cache]
+
+
+# The models run quiet (-q), so what they print is mostly why they stopped;
+# only the last lines of it are kept either way.
+def run(trace):
+    command = [args.model, "-q"]
+    if args.cic:
+        command += ["-C", args.cic]
+    with subprocess.Popen(command + [trace], stdout=subprocess.PIPE, stderr=subprocess.STDOUT) as p:
+        tail = collections.deque((line.decode(errors="replace").rstrip("\n") for line in p.stdout), maxlen=5)
+    result = "ok" if p.returncode == 0 else f"exit:{p.returncode}"
+    return result, tail
+
+
+failed = 0
+with concurrent.futures.ThreadPoolExecutor(max(args.jobs, 1)) as pool:
+    for trace, (result, output) in zip(pending, pool.map(run, pending)):
+        cache[keys[trace]] = (result, trace)
+        print(f"{trace}: {result}")
+        if result != "ok":
+            # the model's last lines show where it stopped
+            for line in output:
+                print(f"  {line}")
+
+for trace in args.traces:
+    result = cache[keys[trace]][0]
+    if result != "ok":
+        failed += 1
+        if trace not in pending:
+            print(f"{trace}: {result} (cached)")
+    elif args.verbose and trace not in pending:
+        print(f"{trace}: ok (cached)")
+
+# write the whole cache again, then move it over the old one
+with open(args.cache + ".tmp", "w") as f:
+    for k, (result, trace) in cache.items():
+        f.write(f"{k} {result} *{trace}\n")
+os.replace(args.cache + ".tmp", args.cache)
+
+print(f"# {len(args.traces)} traces, {len(pending)} run, {len(args.traces) - len(pending)} cached, {failed} failed")
+exit(1 if failed else 0)
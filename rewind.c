@@ -0,0 +1,325 @@
+#include "cmodel.h"
+#include "journal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Time travel over a journal written by cmodel -j or cmodel_cic -j (see
+// journal.h). The model state at any event is rebuilt from the journal
+// alone: short moves apply or undo the records in between, long ones start
+// from the nearest checkpoint, so nothing is ever replayed from the start.
+// Commands on stdin, one per line, addresses in hex:
+//   goto <n>              the state when event n is reached
+//   step [n]              n events forward (1)
+//   back [n]              n events back (1)
+//   back-to-write <addr>  back to the last event that changed RAM nibble addr
+//   to-write <addr>       forward to the next event that changes it
+//   where                 the event, and the ports it accesses
+//   regs
+//   ram [addr [count]]
+// Moves end by printing where. The state is what the model had on
+// reaching the event, before the event's own changes.
+
+rfile r;
+r4 ram[256];
+u64 cycles;
+watchState watch;  // never armed, for RAM()
+
+u8* data;
+size_t size;
+size_t* events;  // offset of each JOURNAL_EVENT record
+u64 eventCount;
+u64 current;
+
+void badJournal(size_t offset) {
+  printf("bad journal at %zx\n", offset);
+  exit(3);
+}
+
+u64 readVarint(size_t* offset) {
+  u64 value = 0;
+  for (int shift = 0; *offset < size && shift < 64; shift += 7) {
+    u8 byte = data[(*offset)++];
+    value |= (u64)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return value;
+  }
+  badJournal(*offset);
+  return 0;
+}
+
+// length of the record at offset, 0 if it runs past the end
+size_t recordLength(size_t offset) {
+  size_t length;
+  switch (data[offset]) {
+    case JOURNAL_EVENT: {
+      size_t end = offset + 3;
+      if (end > size)
+        return 0;
+      while (end < size && (data[end] & 0x80))
+        ++end;
+      length = end + 1 - offset;
+      break;
+    }
+    case JOURNAL_RAM:
+    case JOURNAL_PORT:
+      length = 3;
+      break;
+    case JOURNAL_REGS:
+      length = 1 + 2 * sizeof(rfile);
+      break;
+    case JOURNAL_CHECKPOINT:
+      length = 1 + 2 * sizeof(u64) + sizeof(rfile) + 128;
+      break;
+    default:
+      badJournal(offset);
+      return 0;
+  }
+  return offset + length <= size ? length : 0;
+}
+
+// end of event n's records
+size_t eventEnd(u64 n) {
+  return n + 1 < eventCount ? events[n + 1] : size;
+}
+
+u64 eventDelta(u64 n) {
+  size_t offset = events[n] + 3;
+  return readVarint(&offset);
+}
+
+u16 eventPC(u64 n) {
+  return data[events[n] + 1] | data[events[n] + 2] << 8;
+}
+
+void load(const char* path) {
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    printf("cannot open %s\n", path);
+    exit(4);
+  }
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  data = malloc(size ? size : 1);
+  if (!data || fread(data, 1, size, f) != size) {
+    printf("cannot read %s\n", path);
+    exit(3);
+  }
+  fclose(f);
+  if (size < 4 || memcmp(data, JOURNAL_MAGIC, 4)) {
+    printf("%s is not a journal\n", path);
+    exit(4);
+  }
+
+  // index the events; a record cut short by a crash ends the journal
+  size_t capacity = 1 << 16;
+  events = malloc(capacity * sizeof(size_t));
+  size_t offset = 4;
+  while (offset < size) {
+    size_t length = recordLength(offset);
+    if (!length)
+      break;
+    if (data[offset] == JOURNAL_EVENT) {
+      if (eventCount == capacity) {
+        capacity *= 2;
+        events = realloc(events, capacity * sizeof(size_t));
+      }
+      if (!events) {
+        printf("out of memory\n");
+        exit(3);
+      }
+      events[eventCount++] = offset;
+    }
+    offset += length;
+  }
+  size = offset;
+  if (!eventCount || events[0] + recordLength(events[0]) >= size ||
+      data[events[0] + recordLength(events[0])] != JOURNAL_CHECKPOINT)
+    badJournal(4);
+}
+
+// jump to the checkpoint at event n, a multiple of JOURNAL_CHECKPOINT_EVERY
+void checkpoint(u64 n) {
+  size_t offset = events[n] + recordLength(events[n]);
+  if (data[offset] != JOURNAL_CHECKPOINT)
+    badJournal(offset);
+  ++offset;
+  u64 event;
+  memcpy(&event, data + offset, sizeof(event));
+  offset += sizeof(event);
+  memcpy(&cycles, data + offset, sizeof(cycles));
+  offset += sizeof(cycles);
+  memcpy(&r, data + offset, sizeof(r));
+  offset += sizeof(r);
+  for (int i = 0; i < 256; i += 2) {
+    ram[i].l = data[offset] >> 4;
+    ram[i + 1].l = data[offset++] & 0xf;
+  }
+  if (event != n)
+    badJournal(events[n]);
+  current = n;
+}
+
+void forward(void) {
+  for (size_t offset = events[current]; offset < eventEnd(current); offset += recordLength(offset)) {
+    const u8* p = data + offset;
+    if (p[0] == JOURNAL_RAM)
+      ram[p[1]].l = p[2] & 0xf;
+    else if (p[0] == JOURNAL_REGS)
+      memcpy(&r, p + 1 + sizeof(rfile), sizeof(rfile));
+  }
+  ++current;
+  cycles += eventDelta(current);
+}
+
+void backward(void) {
+  cycles -= eventDelta(current);
+  --current;
+
+  // undo in reverse order
+  size_t offsets[4096];
+  int count = 0;
+  for (size_t offset = events[current]; offset < eventEnd(current); offset += recordLength(offset)) {
+    if (data[offset] != JOURNAL_RAM && data[offset] != JOURNAL_REGS)
+      continue;
+    if (count == (int)(sizeof(offsets) / sizeof(offsets[0]))) {
+      // more changes than one event can make; go by the checkpoint instead
+      u64 target = current;
+      checkpoint(target / JOURNAL_CHECKPOINT_EVERY * JOURNAL_CHECKPOINT_EVERY);
+      while (current < target)
+        forward();
+      return;
+    }
+    offsets[count++] = offset;
+  }
+  while (count--) {
+    const u8* p = data + offsets[count];
+    if (p[0] == JOURNAL_RAM)
+      ram[p[1]].l = p[2] >> 4;
+    else
+      memcpy(&r, p + 1, sizeof(rfile));
+  }
+}
+
+void go(u64 n) {
+  if (n >= eventCount)
+    n = eventCount - 1;
+  u64 base = n / JOURNAL_CHECKPOINT_EVERY * JOURNAL_CHECKPOINT_EVERY;
+  if ((n < current && current - n > JOURNAL_CHECKPOINT_EVERY) || (n > current && base > current))
+    checkpoint(base);
+  while (current < n)
+    forward();
+  while (current > n)
+    backward();
+}
+
+// the RAM record changing address among event n's records, or 0
+size_t findWrite(u64 n, u8 address) {
+  for (size_t offset = events[n]; offset < eventEnd(n); offset += recordLength(offset)) {
+    if (data[offset] == JOURNAL_RAM && data[offset + 1] == address)
+      return offset;
+  }
+  return 0;
+}
+
+void printPC(u16 pc) {
+  if (pc == WATCH_HARNESS)
+    printf("harness");
+  else
+    printf("%02x:%02x", pc >> 6, pc & 0x3f);
+}
+
+void where(void) {
+  printf("event %llu of %llu at ", (unsigned long long)current, (unsigned long long)eventCount);
+  printPC(eventPC(current));
+  printf(", cycle %llu", (unsigned long long)cycles);
+  for (size_t offset = events[current]; offset < eventEnd(current); offset += recordLength(offset)) {
+    if (data[offset] == JOURNAL_PORT)
+      printf(" %c%x=%x", data[offset + 1] & JOURNAL_PORT_WRITE ? 'w' : 'r', data[offset + 1] & 0xf,
+             data[offset + 2]);
+  }
+  printf("\n");
+}
+
+void printRegs(void) {
+  printf("a %x x %x b %02x sb %02x c %d ime %d ifa %d ifb %d re %x\n", A, X, B, SB, C, IME, IFA, IFB, RE);
+}
+
+void printRam(unsigned address, unsigned count) {
+  for (unsigned i = 0; i < count && address + i < 256; ++i) {
+    if (i % 16 == 0)
+      printf("%s%02x:", i ? "\n" : "", address + i);
+    printf(" %x", RAM(address + i));
+  }
+  printf("\n");
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 2) {
+    printf("usage: %s journal-file\n", argv[0]);
+    exit(4);
+  }
+  load(argv[1]);
+  checkpoint(0);
+  where();
+
+  char line[256];
+  while (fgets(line, sizeof(line), stdin)) {
+    char cmd[32];
+    unsigned a = 0, b = 0;
+    unsigned long long n = 1;
+    int args = sscanf(line, "%31s", cmd);
+    if (args < 1)
+      continue;
+
+    if (!strcmp(cmd, "goto") && sscanf(line, "%*s %llu", &n) == 1) {
+      go(n);
+      where();
+    } else if (!strcmp(cmd, "step")) {
+      sscanf(line, "%*s %llu", &n);
+      go(current + n);
+      where();
+    } else if (!strcmp(cmd, "back")) {
+      sscanf(line, "%*s %llu", &n);
+      go(n > current ? 0 : current - n);
+      where();
+    } else if (!strcmp(cmd, "back-to-write") && sscanf(line, "%*s %x", &a) == 1) {
+      u64 k = current;
+      size_t found = 0;
+      while (k-- > 0 && !(found = findWrite(k, a)))
+        ;
+      if (!found) {
+        printf("no earlier write to %02x\n", a & 0xff);
+        continue;
+      }
+      go(k);
+      printf("%02x %x -> %x\n", a & 0xff, data[found + 2] >> 4, data[found + 2] & 0xf);
+      where();
+    } else if (!strcmp(cmd, "to-write") && sscanf(line, "%*s %x", &a) == 1) {
+      u64 k = current;
+      size_t found = 0;
+      while (k < eventCount && !(found = findWrite(k, a)))
+        ++k;
+      if (!found) {
+        printf("no later write to %02x\n", a & 0xff);
+        continue;
+      }
+      go(k);
+      printf("%02x %x -> %x\n", a & 0xff, data[found + 2] >> 4, data[found + 2] & 0xf);
+      where();
+    } else if (!strcmp(cmd, "where")) {
+      where();
+    } else if (!strcmp(cmd, "regs")) {
+      printRegs();
+    } else if (!strcmp(cmd, "ram")) {
+      args = sscanf(line, "%*s %x %x", &a, &b);
+      printRam(args >= 1 ? a : 0, args >= 2 ? b : args == 1 ? 1 : 256);
+    } else if (!strcmp(cmd, "q")) {
+      break;
+    } else {
+      printf("unknown command %s", line);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,135 @@
+#include "ring.h"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+void cpuRelax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+// Wait until *word no longer holds seen. The sleeping flag is raised before
+// the last check, and wakers test it after publishing, so a wakeup can't be
+// lost between the two.
+// On a single CPU the other side can't make progress while we spin, so go
+// straight to sleeping (or yielding, when polling).
+void ringWait(ringShared* shm, _Atomic uint32_t* word, _Atomic uint32_t* sleeping, uint32_t seen) {
+  static long cpus;
+  if (!cpus)
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  for (int i = 0; cpus > 1 && i < RING_SPIN; ++i) {
+    if (atomic_load_explicit(word, memory_order_acquire) != seen)
+      return;
+    cpuRelax();
+  }
+
+  if (shm->poll) {
+    while (atomic_load_explicit(word, memory_order_acquire) == seen) {
+      if (cpus > 1)
+        cpuRelax();
+      else
+        sched_yield();
+    }
+    return;
+  }
+
+  while (atomic_load(word) == seen) {
+    atomic_store(sleeping, 1);
+    if (atomic_load(word) == seen)
+      syscall(SYS_futex, word, FUTEX_WAIT, seen, NULL, NULL, 0);
+    atomic_store(sleeping, 0);
+  }
+}
+
+void ringWake(_Atomic uint32_t* word, _Atomic uint32_t* sleeping) {
+  if (atomic_load(sleeping))
+    syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+void ringPut(ringShared* shm, ring* q, const ringMsg* msg) {
+  uint32_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+  while (head - tail == RING_SLOTS) {
+    ringWait(shm, &q->tail, &q->tailSleeping, tail);
+    tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+  }
+
+  q->slots[head % RING_SLOTS] = *msg;
+  atomic_store(&q->head, head + 1);
+  ringWake(&q->head, &q->headSleeping);
+}
+
+void ringGet(ringShared* shm, ring* q, ringMsg* msg) {
+  uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  ringWait(shm, &q->head, &q->headSleeping, tail);
+
+  *msg = q->slots[tail % RING_SLOTS];
+  atomic_store(&q->tail, tail + 1);
+  ringWake(&q->tail, &q->tailSleeping);
+}
+
+ringShared* ringMap(int fd) {
+  ringShared* shm = mmap(NULL, sizeof(ringShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  return shm == MAP_FAILED ? NULL : shm;
+}
+
+ringShared* ringCreate(const char* name, bool poll) {
+  shm_unlink(name);
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0)
+    return NULL;
+  if (ftruncate(fd, sizeof(ringShared))) {
+    close(fd);
+    return NULL;
+  }
+
+  ringShared* shm = ringMap(fd);
+  if (!shm)
+    return NULL;
+
+  memset(shm, 0, sizeof(*shm));
+  shm->poll = poll;
+  atomic_store(&shm->magic, RING_MAGIC);
+  return shm;
+}
+
+// Attach to a region made by ringCreate(), waiting up to a few seconds for
+// the other side to create it.
+ringShared* ringAttach(const char* name) {
+  for (int tries = 0; tries < 500; ++tries) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd >= 0) {
+      ringShared* shm = NULL;
+      if (lseek(fd, 0, SEEK_END) >= (off_t)sizeof(ringShared))
+        shm = ringMap(fd);
+      else
+        close(fd);
+
+      if (shm) {
+        while (atomic_load(&shm->magic) != RING_MAGIC)
+          cpuRelax();
+        return shm;
+      }
+    }
+
+    nanosleep(&(struct timespec){0, 10 * 1000 * 1000}, NULL);
+  }
+  return NULL;
+}
+
+void ringDetach(ringShared* shm) {
+  munmap(shm, sizeof(ringShared));
+}
+
+void ringUnlink(const char* name) {
+  shm_unlink(name);
+}
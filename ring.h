@@ -0,0 +1,63 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Single-producer single-consumer message rings in POSIX shared memory, so an
+// emulator in another process can drive the model (cmodel -s). The host posts
+// commands and port values on "in", the model posts requests and events on
+// "out". A waiting side spins for RING_SPIN polls, then sleeps on a futex
+// unless the region was created for busy-polling only.
+
+enum {
+  RING_SLOTS = 64,
+  RING_SPIN = 1 << 14,
+  RING_MAGIC = 0x52494e47,
+};
+
+enum {
+  // host -> model
+  RING_W4,       // port = byte address in PIF-RAM, data = 4 bytes
+  RING_W64,      // data = 64 bytes
+  RING_R64,
+  RING_RESET,
+  RING_PASS,
+  RING_QUIT,
+  RING_VALUE,    // answer to RING_READ / RING_REGION
+
+  // model -> host
+  RING_REGION,   // model wants the region (1 = PAL)
+  RING_READ,     // model reads port
+  RING_WRITE,    // model wrote value to port
+  RING_COMMAND,  // model waits for the next command
+  RING_RAM,      // data = PIF-RAM, posted whenever an RCP transfer runs
+  RING_EXIT,     // value = exit code
+};
+
+typedef struct {
+  uint8_t kind;
+  uint8_t port;
+  uint8_t value;
+  uint8_t data[64];
+} ringMsg;
+
+typedef struct {
+  _Alignas(64) _Atomic uint32_t head;
+  _Atomic uint32_t headSleeping;
+  _Alignas(64) _Atomic uint32_t tail;
+  _Atomic uint32_t tailSleeping;
+  _Alignas(64) ringMsg slots[RING_SLOTS];
+} ring;
+
+typedef struct {
+  _Atomic uint32_t magic;
+  bool poll;
+  ring in;
+  ring out;
+} ringShared;
+
+ringShared* ringCreate(const char* name, bool poll);
+ringShared* ringAttach(const char* name);
+void ringDetach(ringShared* shm);
+void ringUnlink(const char* name);
+void ringPut(ringShared* shm, ring* q, const ringMsg* msg);
+void ringGet(ringShared* shm, ring* q, ringMsg* msg);
@@ -0,0 +1,248 @@
+#include "ring.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Test client for cmodel -s: replays a regular trace through the shared-memory
+// rings and prints the same log as cmodel does when it reads the trace itself.
+// =w expectations are checked against the writes the model posts; =ram can't
+// be seen from here and is skipped. Round trip times go to stderr.
+//
+//   ./cmodel -q -s /pif &
+//   ./ringclient /pif input.txt
+
+FILE* input;
+bool quiet;
+ringShared* shm;
+
+uint64_t sent;  // when the last answer was posted
+uint64_t roundTrips;
+uint64_t roundTripNs;
+uint64_t roundTripMin = UINT64_MAX;
+
+uint64_t nowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void echo(const char* format, ...) {
+  if (quiet)
+    return;
+
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+}
+
+void skipComments(void) {
+  int num;
+  do {
+    num = 0;
+    fscanf(input, " #%n%*[^\n] ", &num);
+  } while (num > 0);
+}
+
+// Next token, after skipping comments and =ram. An =w is returned as "=w" and
+// left for expectWrite() to read.
+bool nextToken(char* token) {
+  for (;;) {
+    skipComments();
+    if (1 != fscanf(input, "%15s", token))
+      return false;
+    if (strcmp(token, "=ram"))
+      return true;
+    fscanf(input, "%*s %*s");
+  }
+}
+
+unsigned scanHex(void) {
+  skipComments();
+
+  unsigned value;
+  if (1 != fscanf(input, "%x", &value)) {
+    printf("scanf error\n");
+    exit(3);
+  }
+  return value;
+}
+
+unsigned nextValue(void) {
+  char token[16];
+  if (!nextToken(token)) {
+    printf("scanf error\n");
+    exit(3);
+  }
+  if (!strcmp(token, "=w")) {
+    printf("expect failed: w %x %x, but model is reading\n", scanHex(), scanHex());
+    exit(5);
+  }
+  return strtoul(token, NULL, 16);
+}
+
+// Only the '=' is looked at before deciding, and ungetc() keeps that one
+// character, so this works on pipes too.
+void expectWrite(unsigned port, unsigned value) {
+  char kind[16];
+  for (;;) {
+    skipComments();
+    int next = fgetc(input);
+    if (next != '=') {
+      ungetc(next, input);
+      return;
+    }
+    if (1 != fscanf(input, "%15s", kind)) {
+      printf("scanf error\n");
+      exit(3);
+    }
+    if (!strcmp(kind, "w"))
+      break;
+    fscanf(input, "%*s %*s");
+  }
+
+  unsigned expectPort = scanHex();
+  unsigned expectValue = scanHex();
+  if (port != expectPort || value != expectValue) {
+    printf("expect failed: w %x %x, expected w %x %x\n", port, value, expectPort, expectValue);
+    exit(5);
+  }
+}
+
+void reply(const ringMsg* msg) {
+  sent = nowNs();
+  ringPut(shm, &shm->in, msg);
+}
+
+void command(void) {
+  ringMsg msg = {0};
+  char cmd[16];
+  if (!nextToken(cmd)) {
+    printf("scanf error\n");
+    exit(3);
+  }
+
+  echo("  %s", cmd);
+  if (!strcmp(cmd, "w4")) {
+    msg.kind = RING_W4;
+    msg.port = nextValue();
+    echo(" %x", msg.port);
+    for (int i = 0; i < 8; ++i) {
+      unsigned value = nextValue();
+      echo(" %x", value);
+      msg.data[i / 2] |= (value & 0xf) << (i & 1 ? 0 : 4);
+    }
+  } else if (!strcmp(cmd, "w64")) {
+    msg.kind = RING_W64;
+    for (int i = 0; i < 0x80; ++i) {
+      unsigned value = nextValue();
+      echo(" %x", value);
+      msg.data[i / 2] |= (value & 0xf) << (i & 1 ? 0 : 4);
+    }
+  } else if (!strcmp(cmd, "r64")) {
+    msg.kind = RING_R64;
+  } else if (!strcmp(cmd, "reset")) {
+    msg.kind = RING_RESET;
+  } else if (!strcmp(cmd, "pass")) {
+    msg.kind = RING_PASS;
+  } else if (!strcmp(cmd, "q")) {
+    msg.kind = RING_QUIT;
+  } else {
+    printf("\nunrecognized\n");
+    exit(4);
+  }
+  echo("\n");
+
+  reply(&msg);
+}
+
+void value(void) {
+  ringMsg msg = {.kind = RING_VALUE};
+  msg.value = nextValue();
+  echo("  %x\n", msg.value);
+  reply(&msg);
+}
+
+void stats(void) {
+  if (!roundTrips)
+    return;
+  fprintf(stderr, "%llu round trips, mean %llu ns, min %llu ns\n", (unsigned long long)roundTrips,
+          (unsigned long long)(roundTripNs / roundTrips), (unsigned long long)roundTripMin);
+}
+
+int main(int argc, char* argv[]) {
+  int opt;
+  while ((opt = getopt(argc, argv, "q")) != -1) {
+    switch (opt) {
+      case 'q':
+        quiet = 1;
+        break;
+      default:
+        printf("usage: %s [-q] shm-name [trace]\n", argv[0]);
+        exit(4);
+    }
+  }
+  if (optind == argc) {
+    printf("usage: %s [-q] shm-name [trace]\n", argv[0]);
+    exit(4);
+  }
+
+  shm = ringAttach(argv[optind]);
+  if (!shm) {
+    printf("cannot attach to %s\n", argv[optind]);
+    exit(4);
+  }
+  input = optind + 1 < argc ? fopen(argv[optind + 1], "r") : stdin;
+  if (!input) {
+    printf("cannot open %s\n", argv[optind + 1]);
+    exit(4);
+  }
+  atexit(stats);
+
+  // Time from answering a request to receiving the next message, which is
+  // the model's round trip whenever it answers without doing much work.
+  for (;;) {
+    ringMsg msg;
+    ringGet(shm, &shm->out, &msg);
+    if (sent) {
+      uint64_t ns = nowNs() - sent;
+      roundTripNs += ns;
+      if (ns < roundTripMin)
+        roundTripMin = ns;
+      ++roundTrips;
+      sent = 0;
+    }
+
+    switch (msg.kind) {
+      case RING_REGION:
+        echo("r region\n");
+        value();
+        break;
+      case RING_READ:
+        echo("r %x\n", msg.port);
+        value();
+        break;
+      case RING_WRITE:
+        echo("w %x %x\n", msg.port, msg.value);
+        expectWrite(msg.port, msg.value);
+        break;
+      case RING_COMMAND:
+        echo("r command\n");
+        command();
+        break;
+      case RING_RAM:
+        break;
+      case RING_EXIT:
+        if (msg.value == 1)
+          printf("fatal error\n");
+        exit(msg.value);
+      default:
+        printf("unexpected message %d\n", msg.kind);
+        exit(4);
+    }
+  }
+}
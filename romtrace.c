@@ -0,0 +1,402 @@
+#include "cmodel.h"
+#include "cmodel_compare.h"
+#include "cmodel_pif.h"
+
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Generate cmodel traces from cartridge ROM images (.z64, big endian).
+//
+// The CIC is worked out from the image itself: IPL3 checks the header words
+// at 0x10/0x14 against a checksum of the first MiB after the boot code, and
+// each CIC's IPL3 seeds that checksum differently. All four variants are
+// computed in one pass, one per vector lane, and the lane matching the header
+// names the CIC. 6101 and 6102 share the seed and are told apart by the CRC32
+// of the boot code; the header's country code picks the 7xxx PAL parts.
+//
+// The trace boots the PIF the way input.txt does: region, status and seed
+// handshake, ROM lockout, the checksum words the CPU writes, the checksum
+// check, then -n rounds of compare. The CIC side comes from the secrets in
+// cmodel_cic.c, the compare answers from cmodel_compare.h. Expectations
+// (=ram, =w) are embedded, so cmodel checks itself while replaying.
+//
+//   ./romtrace game.z64 > game.txt
+//   ./romtrace -o traces roms/*.z64
+//
+// With -o each ROM gets <dir>/<name>.txt and the ROMs are shared out between
+// -j threads. A line per ROM and the rate go to stderr.
+
+enum {
+  IPL3_START = 0x40,
+  CHECKSUM_START = 0x1000,
+  CHECKSUM_END = 0x101000,  // also the smallest image we accept
+  CRC32_6101 = 0x6170a4a1,  // of the boot code
+};
+
+// lanes of the checksum kernel
+enum {
+  LANE_6102,  // also 6101, 7101, 7102
+  LANE_6103,
+  LANE_6105,
+  LANE_6106,
+  LANES = 4,
+};
+
+typedef u32 lanes __attribute__((vector_size(LANES * sizeof(u32))));
+
+const u32 ipl3Seeds[LANES] = {0xf8ca4ddc, 0xa3886759, 0xdf26f436, 0x1fea617a};
+const int laneTypes[LANES] = {6102, 6103, 6105, 6106};
+
+extern MODEL_TLS bool regionPAL;
+extern MODEL_TLS const u8* romSecret;
+bool initCIC(int cic);
+
+int forceType;
+int rngValue = 1;
+int compares = 16;
+u8 key[4];
+const char* outDir;
+int jobs;
+
+char** roms;
+int romCount;
+atomic_int nextRom;
+atomic_int failedRoms;
+
+// the CIC model is only linked for its secrets
+u8 readIO(u8 port) {
+  (void)port;
+  return 0;
+}
+
+void writeIO(u8 port, u8 value) {
+  (void)port;
+  (void)value;
+}
+
+void fatalError(void) {
+  exit(1);
+}
+
+static inline u32 load32(const u8* p) {
+  return (u32)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+// The IPL3 checksum for all seeds at once. Every lane runs the same loop on
+// the same words; only 6105 mixes in a word of its own boot code instead of
+// t5, which is a per-lane select.
+void ipl3Checksums(const u8* rom, u32 sums[LANES][2]) {
+  lanes seeds;
+  memcpy(&seeds, ipl3Seeds, sizeof(seeds));
+  lanes t1 = seeds, t2 = seeds, t3 = seeds, t4 = seeds, t5 = seeds, t6 = seeds;
+  const lanes use6105 = {0, 0, ~0u, 0};
+
+  for (u32 i = CHECKSUM_START; i < CHECKSUM_END; i += 4) {
+    u32 word = load32(rom + i);
+    u32 rotated = word << (word & 31) | word >> ((32 - (word & 31)) & 31);
+    lanes d = {word, word, word, word};
+    lanes r = {rotated, rotated, rotated, rotated};
+    u32 boot = load32(rom + 0x750 + (i & 0xff));
+    lanes b = {boot, boot, boot, boot};
+
+    t4 -= (lanes)(t6 + d < t6);  // carry out of t6
+    t6 += d;
+    t3 ^= d;
+    t5 += r;
+    lanes less = (lanes)(d < t2);
+    t2 ^= (less & r) | (~less & (t6 ^ d));
+    t1 += ((use6105 & b) | (~use6105 & t5)) ^ d;
+  }
+
+  for (int lane = 0; lane < LANES; ++lane) {
+    switch (lane) {
+      case LANE_6103:
+        sums[lane][0] = (t6[lane] ^ t4[lane]) + t3[lane];
+        sums[lane][1] = (t5[lane] ^ t2[lane]) + t1[lane];
+        break;
+      case LANE_6106:
+        sums[lane][0] = t6[lane] * t4[lane] + t3[lane];
+        sums[lane][1] = t5[lane] * t2[lane] + t1[lane];
+        break;
+      default:
+        sums[lane][0] = t6[lane] ^ t4[lane] ^ t3[lane];
+        sums[lane][1] = t5[lane] ^ t2[lane] ^ t1[lane];
+        break;
+    }
+  }
+}
+
+u32 crc32(const u8* p, size_t n) {
+  u32 crc = ~0u;
+  while (n--) {
+    crc ^= *p++;
+    for (int i = 0; i < 8; ++i)
+      crc = crc >> 1 ^ (0xedb88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+bool countryPAL(u8 country) {
+  return strchr("DFIPSUXY", country) && country;
+}
+
+// Part number from the image, or 0 if no seed reproduces the header.
+int romType(const u8* rom) {
+  u32 sums[LANES][2];
+  ipl3Checksums(rom, sums);
+
+  int type = 0;
+  for (int lane = 0; lane < LANES; ++lane) {
+    if (sums[lane][0] == load32(rom + 0x10) && sums[lane][1] == load32(rom + 0x14))
+      type = laneTypes[lane];
+  }
+  if (type == 6102 && crc32(rom + IPL3_START, CHECKSUM_START - IPL3_START) == CRC32_6101)
+    type = 6101;
+  if (type && countryPAL(rom[0x3e]))
+    type = type == 6101 ? 7102 : type == 6102 ? 7101 : type + 1000;
+  return type;
+}
+
+// cicEncode(), as many times as the PIF will cicDescramble()
+void encode(u8* n, int count, int passes) {
+  while (passes--) {
+    for (int i = 0; i + 1 < count; ++i)
+      n[i + 1] = (n[i + 1] + n[i] + 1) & 0xf;
+  }
+}
+
+// one nibble as the PIF's four cicReadBit() see it
+void printNibble(FILE* f, u8 n) {
+  fprintf(f, "%d %d %d %d\n", n & 8, n >> 2 & 1 ? 8 : 0, n >> 1 & 1 ? 8 : 0, n & 1 ? 8 : 0);
+}
+
+void printRCPWrite(FILE* f, u8 addr, const u8* nibbles) {
+  fprintf(f, "w4 %x", addr);
+  for (int i = 0; i < 8; ++i)
+    fprintf(f, " %x", nibbles[i]);
+  fprintf(f, "\n# P7 RCP write\n0\n");
+}
+
+void printCommand(FILE* f, u8 command) {
+  u8 nibbles[8] = {0, 0, 0, 0, 0, 0, command >> 4, command & 0xf};
+  printRCPWrite(f, 0x3c, nibbles);
+}
+
+void writeTrace(FILE* f, const char* name, int type) {
+  initCIC(type);
+  u8 secret[16];
+  for (int i = 0; i < 16; ++i)
+    secret[i] = romSecret[i / 2] >> (i & 1 ? 0 : 4) & 0xf;
+
+  fprintf(f, "# %s, CIC %d\n", name, type);
+  fprintf(f, "# Simulate %s region PIF\n%d\n\n", regionPAL ? "PAL" : "NTSC", regionPAL);
+
+  fprintf(f, "# P5 handshake - %s region\n", regionPAL ? "PAL" : "NTSC");
+  printNibble(f, BIT(0) | (regionPAL ? BIT(2) : 0));
+
+  u8 seed[6] = {0xb, 5, secret[0], secret[1], secret[2], secret[3]};
+  encode(seed, 6, 2);
+  fprintf(f, "# P5 seed - CIC %d\n", type);
+  for (int i = 0; i < 6; ++i)
+    printNibble(f, seed[i]);
+
+  fprintf(f, "\n# ROM lockout\n");
+  printCommand(f, 0x10);
+  fprintf(f, "# OSINFO and seed swapped into PIF-RAM\n");
+  fprintf(f, "=ram c8 000%x%x%x%x%x\n", BIT(OSINFO_VERSION), secret[0], secret[1], secret[2],
+          secret[3]);
+  fprintf(f, "pass\n=w 6 1\n\n");
+
+  fprintf(f, "# Write checksum - CIC %d\n", type);
+  u8 words[16] = {0};
+  memcpy(words + 4, secret + 4, 12);
+  printRCPWrite(f, 0x30, words);
+  printRCPWrite(f, 0x34, words + 8);
+  fprintf(f, "# Get checksum\n");
+  printCommand(f, 0x20);
+  fprintf(f, "pass\n\n");
+
+  fprintf(f, "# Check checksum\n");
+  printCommand(f, 0x40);
+  fprintf(f, "# Checksum swapped into internal RAM\n=ram 34 ");
+  for (int i = 4; i < 16; ++i)
+    fprintf(f, "%x", secret[i]);
+  fprintf(f, "\npass\n\n");
+
+  fprintf(f, "# P9 RNG, %d steps\n", rngValue);
+  for (int i = 1; i < rngValue; ++i)
+    fprintf(f, "0\n");
+  fprintf(f, "8\n");
+
+  u8 checksum[16];
+  memcpy(checksum, key, 4);
+  memcpy(checksum + 4, secret + 4, 12);
+  encode(checksum, 16, 4);
+  fprintf(f, "# P5 checksum - key %x%x%x%x\n", key[0], key[1], key[2], key[3]);
+  for (int i = 0; i < 16; ++i)
+    printNibble(f, checksum[i]);
+
+  fprintf(f, "\n# Terminate boot process\n");
+  printCommand(f, 0x08);
+  fprintf(f, "pass\n\n");
+
+  // the CIC answers with CIC_COMPARE_HI, which only depends on the RNG's low
+  // nibble
+  fprintf(f, "# Compare mode\n");
+  compareState s;
+  compareSeed(&s, rngValue, regionPAL);
+  for (int i = 0; i < compares; ++i) {
+    compareRounds(&s);
+    fprintf(f, "pass\n");
+    const char* sep = "";
+    for (u8 offset = compareOffset(&s); offset & 0xf; offset += COMPARE_STEP(regionPAL)) {
+      fprintf(f, "%s%d", sep, s.hi[offset].l & 1 ? 8 : 0);
+      sep = " ";
+    }
+    fprintf(f, "\n");
+  }
+  fprintf(f, "q\n");
+}
+
+// Returns false if the ROM was skipped.
+bool processRom(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "%s: cannot open\n", path);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size < CHECKSUM_END) {
+    fprintf(stderr, "%s: too small\n", path);
+    close(fd);
+    return false;
+  }
+  const u8* rom = mmap(NULL, CHECKSUM_END, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (rom == MAP_FAILED) {
+    fprintf(stderr, "%s: cannot map\n", path);
+    return false;
+  }
+  madvise((void*)rom, CHECKSUM_END, MADV_SEQUENTIAL);
+
+  bool ok = 0;
+  int type = 0;
+  if (load32(rom) != 0x80371240)
+    fprintf(stderr, "%s: not a .z64 image\n", path);
+  else if (!(type = forceType ? forceType : romType(rom)))
+    fprintf(stderr, "%s: no CIC matches the header checksum\n", path);
+  else
+    ok = 1;
+  munmap((void*)rom, CHECKSUM_END);
+  if (!ok)
+    return false;
+
+  char* copy = strdup(path);
+  char* name = basename(copy);
+  FILE* f = stdout;
+  if (outDir) {
+    char* dot = strrchr(name, '.');
+    if (dot)
+      *dot = 0;
+    char out[4096];
+    snprintf(out, sizeof(out), "%s/%s.txt", outDir, name);
+    f = fopen(out, "w");
+    if (!f) {
+      fprintf(stderr, "%s: cannot create %s\n", path, out);
+      free(copy);
+      return false;
+    }
+  }
+  writeTrace(f, basename(copy), type);
+  if (outDir)
+    fclose(f);
+  free(copy);
+
+  fprintf(stderr, "%s: cic %d\n", path, type);
+  return true;
+}
+
+void* worker(void* arg) {
+  (void)arg;
+  int i;
+  while ((i = atomic_fetch_add(&nextRom, 1)) < romCount) {
+    if (!processRom(roms[i]))
+      atomic_fetch_add(&failedRoms, 1);
+  }
+  return NULL;
+}
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char* argv[]) {
+  jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:r:n:k:o:j:")) != -1) {
+    switch (opt) {
+      case 't':
+        forceType = atoi(optarg);
+        break;
+      case 'r':
+        rngValue = atoi(optarg);
+        break;
+      case 'n':
+        compares = atoi(optarg);
+        break;
+      case 'k': {
+        unsigned k = strtoul(optarg, NULL, 16);
+        for (int i = 0; i < 4; ++i)
+          key[i] = k >> (12 - 4 * i) & 0xf;
+        break;
+      }
+      case 'o':
+        outDir = optarg;
+        break;
+      case 'j':
+        jobs = atoi(optarg);
+        break;
+      default:
+        printf("usage: %s [-t cic] [-r rng] [-n compares] [-k key] [-o dir] [-j jobs] rom...\n",
+               argv[0]);
+        exit(4);
+    }
+  }
+  if ((forceType && !initCIC(forceType)) || rngValue < 1 || rngValue > 256 || compares < 0 ||
+      jobs < 1) {
+    printf("bad arguments\n");
+    exit(4);
+  }
+  roms = argv + optind;
+  romCount = argc - optind;
+  if (romCount > 1 && !outDir) {
+    printf("more than one ROM needs -o\n");
+    exit(4);
+  }
+  if (jobs > romCount)
+    jobs = romCount;
+
+  double start = now();
+  pthread_t threads[jobs];
+  for (int i = 0; i < jobs; ++i)
+    pthread_create(&threads[i], NULL, worker, NULL);
+  for (int i = 0; i < jobs; ++i)
+    pthread_join(threads[i], NULL);
+  double seconds = now() - start;
+
+  if (romCount > 1)
+    fprintf(stderr, "%d ROMs, %.0f ROMs/s\n", romCount, romCount / seconds);
+  return failedRoms != 0;
+}
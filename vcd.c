@@ -0,0 +1,94 @@
+#include "vcd.h"
+
+#include <assert.h>
+#include <string.h>
+
+void vcdFlush(vcd* v) {
+  fwrite(v->buffer, 1, v->used, v->f);
+  v->used = 0;
+}
+
+// make room for one value change, which is always shorter than this
+char* vcdReserve(vcd* v) {
+  if (v->used + 64 > VCD_BUFFER)
+    vcdFlush(v);
+  return v->buffer + v->used;
+}
+
+bool vcdOpen(vcd* v, const char* path, const char* timescale, const char* scope) {
+  memset(v, 0, sizeof(*v));
+  v->f = fopen(path, "w");
+  if (!v->f)
+    return false;
+
+  fprintf(v->f, "$timescale %s $end\n", timescale);
+  fprintf(v->f, "$scope module %s $end\n", scope);
+  return true;
+}
+
+// signal identifiers are single printable characters starting at '!'
+int vcdSignal(vcd* v, const char* name, int width) {
+  assert(v->signals < VCD_MAX_SIGNALS);
+  int id = v->signals++;
+  v->width[id] = width;
+  fprintf(v->f, "$var wire %d %c %s $end\n", width, '!' + id, name);
+  return id;
+}
+
+void vcdBegin(vcd* v) {
+  fprintf(v->f, "$upscope $end\n$enddefinitions $end\n");
+  fprintf(v->f, "#0\n$dumpvars\n");
+  for (int id = 0; id < v->signals; ++id) {
+    if (v->width[id] == 1)
+      fprintf(v->f, "x%c\n", '!' + id);
+    else
+      fprintf(v->f, "bx %c\n", '!' + id);
+  }
+  fprintf(v->f, "$end\n");
+  v->started = true;
+}
+
+void vcdChange(vcd* v, int signal, uint64_t time, uint32_t value) {
+  if (v->known[signal] && v->value[signal] == value)
+    return;
+  v->known[signal] = true;
+  v->value[signal] = value;
+
+  char* p = vcdReserve(v);
+
+  if (time != v->time) {
+    v->time = time;
+    char digits[20];
+    int n = 0;
+    do {
+      digits[n++] = '0' + time % 10;
+      time /= 10;
+    } while (time);
+    *p++ = '#';
+    while (n)
+      *p++ = digits[--n];
+    *p++ = '\n';
+  }
+
+  int width = v->width[signal];
+  if (width == 1) {
+    *p++ = '0' + (value & 1);
+  } else {
+    *p++ = 'b';
+    for (int bit = width - 1; bit >= 0; --bit)
+      *p++ = '0' + ((value >> bit) & 1);
+    *p++ = ' ';
+  }
+  *p++ = '!' + signal;
+  *p++ = '\n';
+
+  v->used = p - v->buffer;
+}
+
+void vcdClose(vcd* v) {
+  if (!v->f)
+    return;
+  vcdFlush(v);
+  fclose(v->f);
+  v->f = NULL;
+}
@@ -0,0 +1,32 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Buffered, streaming Value Change Dump writer.
+// Declare signals with vcdSignal(), then vcdBegin(); after that vcdChange()
+// only emits anything when a value actually changes. Output goes through a
+// private buffer that is written out in large chunks.
+
+enum {
+  VCD_MAX_SIGNALS = 64,
+  VCD_BUFFER = 1 << 16,
+};
+
+typedef struct {
+  FILE* f;
+  uint64_t time;
+  bool started;
+  int signals;
+  uint8_t width[VCD_MAX_SIGNALS];
+  uint32_t value[VCD_MAX_SIGNALS];
+  bool known[VCD_MAX_SIGNALS];
+  size_t used;
+  char buffer[VCD_BUFFER];
+} vcd;
+
+bool vcdOpen(vcd* v, const char* path, const char* timescale, const char* scope);
+// the new signal's id; at most VCD_MAX_SIGNALS can be declared
+int vcdSignal(vcd* v, const char* name, int width);
+void vcdBegin(vcd* v);
+void vcdChange(vcd* v, int signal, uint64_t time, uint32_t value);
+void vcdClose(vcd* v);